@@ -0,0 +1,58 @@
+/*
+ * allocator.h - The interface through which mdriver drives an allocator
+ *
+ * The mm package mdriver is linked with, and libc malloc, are built in.
+ * Any number of others can be loaded from shared objects with -b; each
+ * must define an allocator_t named ALLOCATOR_SYM. mm-backend.c does this
+ * for any package with the mm.c interface.
+ */
+#ifndef __ALLOCATOR_H_
+#define __ALLOCATOR_H_
+
+#include <stddef.h>
+
+#define ALLOCATOR_SYM "allocator"  /* symbol a backend's allocator_t has */
+
+struct mm_arena;                   /* an arena of the allocator's own */
+
+/* Flags */
+#define ALLOC_MEMLIB 0x1  /* gets its heap from mem_sbrk, so mdriver can
+			     bound-check its blocks, measure its space
+			     utilization, and empty it between runs */
+#define ALLOC_THREADSAFE 0x2 /* may be called from several threads at
+				once, so mdriver can replay multi-threaded
+				traces against it */
+
+/* What an allocator's stats hook reports about its heap */
+typedef struct {
+    size_t heap_size;     /* bytes the allocator holds */
+    size_t free_bytes;    /* bytes of that in free blocks */
+    size_t free_blocks;   /* number of free blocks */
+    size_t largest_free;  /* size of the largest free block */
+    size_t dirty_bytes;   /* bytes of whole pages in free blocks that are
+			     still backed by memory */
+    size_t purged_bytes;  /* and that were given back to the system */
+} alloc_stats_t;
+
+typedef struct {
+    char *name;                            /* e.g. "mm"; NULL for the
+					      name of the shared object */
+    int (*init)(void);                     /* -1 on failure, 0 if OK */
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+
+    /* Optional hooks, NULL if the allocator has none */
+    int (*check)(void);                    /* nonzero iff heap consistent */
+    void (*stats)(alloc_stats_t *st);      /* describe the heap */
+
+    int flags;                             /* ALLOC_xxx */
+
+    /* Optional arena hooks, with the mm_arena_ functions' meanings */
+    struct mm_arena *(*arena_create)(void);
+    void *(*arena_malloc)(struct mm_arena *arena, size_t size);
+    void (*arena_reset)(struct mm_arena *arena);
+    void (*arena_destroy)(struct mm_arena *arena);
+} allocator_t;
+
+#endif /* __ALLOCATOR_H_ */
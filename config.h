@@ -68,6 +68,7 @@
  *****************************************************************************/
 #define USE_FCYC   0   /* cycle counter w/K-best scheme (x86 & Alpha only) */
 #define USE_ITIMER 0   /* interval timer (any Unix box) */
-#define USE_GETTOD 1   /* gettimeofday (any Unix box) */
+#define USE_GETTOD 0   /* gettimeofday (any Unix box) */
+#define USE_RTIMER 1   /* TSC or clock_gettime, median of adaptive runs (Linux) */
 
 #endif /* __CONFIG_H */
@@ -0,0 +1,247 @@
+/*
+ * falseshare.c - Benchmarks of the false sharing that an allocator
+ *     causes between threads, after cache-thrash and cache-scratch of
+ *     the Hoard benchmark suite.
+ *
+ * usage: falseshare [-t threads] [-i iterations] [-r repetitions]
+ *                   [-s size] [-l line]
+ *        LD_PRELOAD=./libmm.so falseshare ...
+ *
+ * thrash (active false sharing): each thread allocates an object of
+ *     size bytes, writes each of its bytes repetitions times and frees
+ *     it, iterations times over. An allocator that gives the threads
+ *     objects in the same cache line makes the line bounce between
+ *     their caches on every write.
+ * scratch (passive false sharing): the main thread first allocates an
+ *     object for each thread, side by side, and hands them over. Each
+ *     thread frees its object, and then loops as in thrash. An allocator
+ *     that gives the memory freed by one thread back to it passes the
+ *     sharing of the main thread's objects on to the threads.
+ *
+ * Besides the time per run of each benchmark, the number of threads
+ * whose first object shares a line with another thread's is counted,
+ * which shows the sharing even where the threads do not really run in
+ * parallel. If the allocator has mm_isolate_config, as libmm.so does,
+ * each benchmark is run twice: by default, and with objects of size
+ * bytes given cache lines of their own. The ratio of the two times is
+ * what the false sharing costs.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <dlfcn.h>
+
+#include "rtimer.h"
+
+#define MAXTHREADS 256    /* most threads a benchmark runs */
+
+/* One run of a benchmark, shared by its threads */
+typedef struct {
+    int scratch;                  /* cache-scratch rather than thrash? */
+    char *objects[MAXTHREADS];    /* objects handed to the threads */
+    char *firsts[MAXTHREADS];     /* first object each allocated */
+    pthread_barrier_t first;      /* all of those are allocated */
+} run_t;
+
+/* A thread of the run */
+typedef struct {
+    run_t *run;
+    int id;
+} worker_t;
+
+/* Global variables */
+static int nthreads;              /* threads per run (-t) */
+static long iterations = 1000;    /* objects each thread allocates (-i) */
+static long repetitions = 100;    /* writes to each byte of them (-r) */
+static size_t size = 8;           /* object size (-s) */
+static size_t line = 64;          /* cache line size (-l) */
+
+/* The allocator's mm_isolate_config, if it has one */
+static void (*isolate)(size_t min, size_t max);
+
+/* function prototypes for internal helper routines */
+static void run_bench(void *arg);
+static void *worker(void *arg);
+static int shared_objects(char **objects);
+static void usage(void);
+static void unix_error(char *msg);
+
+int main(int argc, char **argv)
+{
+    static run_t run;
+    static char *benches[] = {"thrash", "scratch"};
+    static char *kinds[] = {"active", "passive"};
+    rtimer_stats_t st;
+    double secs[2];               /* default and isolated */
+    int nmodes;
+    int bench, mode, c;
+
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads < 2)
+	nthreads = 2;
+    if (nthreads > MAXTHREADS)
+	nthreads = MAXTHREADS;
+
+    while ((c = getopt(argc, argv, "t:i:r:s:l:h")) != EOF) {
+	switch (c) {
+	case 't': nthreads = atoi(optarg); break;
+	case 'i': iterations = atol(optarg); break;
+	case 'r': repetitions = atol(optarg); break;
+	case 's': size = strtoul(optarg, NULL, 0); break;
+	case 'l': line = strtoul(optarg, NULL, 0); break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (nthreads < 1 || nthreads > MAXTHREADS || iterations < 1 ||
+	repetitions < 0 || size < 1 || line < 1) {
+	usage();
+	exit(1);
+    }
+
+    isolate = dlsym(RTLD_DEFAULT, "mm_isolate_config");
+    nmodes = (isolate != NULL) ? 2 : 1;
+    rtimer_init(0);
+
+    printf("%d threads, %ld objects of %zu bytes each, %ld writes per "
+	   "byte, %zu-byte lines\n",
+	   nthreads, iterations, size, repetitions, line);
+    printf("%-8s %-9s %11s %25s %7s\n",
+	   "bench", "mode", "secs", "95% CI", "shared");
+    for (bench = 0; bench < 2; bench++) {
+	run.scratch = bench;
+	for (mode = 0; mode < nmodes; mode++) {
+	    if (isolate != NULL)
+		isolate(mode ? size : 1, mode ? size : 0);
+	    secs[mode] = rtimer(run_bench, &run, &st);
+	    printf("%-8s %-9s %11.6f   [%10.6f, %10.6f] %3d/%d\n",
+		   benches[bench], mode ? "isolated" : "default", secs[mode],
+		   st.ci_lo, st.ci_hi, shared_objects(run.firsts), nthreads);
+	}
+	if (nmodes == 2)
+	    printf("%s false sharing: %.2fx the time with isolated objects\n",
+		   kinds[bench], secs[0] / secs[1]);
+    }
+    if (nmodes == 1)
+	printf("The allocator has no mm_isolate_config, so there is no "
+	       "isolated mode.\n");
+    exit(0);
+}
+
+/*
+ * run_bench - Run the benchmark once, in nthreads threads
+ */
+static void run_bench(void *arg)
+{
+    run_t *r = arg;
+    pthread_t tids[MAXTHREADS];
+    worker_t workers[MAXTHREADS];
+    int i;
+
+    /* The objects to hand over are allocated, and written, here */
+    for (i = 0; r->scratch && i < nthreads; i++) {
+	if ((r->objects[i] = malloc(size)) == NULL)
+	    unix_error("malloc failed in run_bench");
+	memset(r->objects[i], 0, size);
+    }
+
+    pthread_barrier_init(&r->first, NULL, nthreads);
+    for (i = 0; i < nthreads; i++) {
+	workers[i].run = r;
+	workers[i].id = i;
+	if ((errno = pthread_create(&tids[i], NULL, worker, &workers[i])) != 0)
+	    unix_error("pthread_create failed in run_bench");
+    }
+    for (i = 0; i < nthreads; i++)
+	pthread_join(tids[i], NULL);
+    pthread_barrier_destroy(&r->first);
+}
+
+/*
+ * worker - Body of each thread: allocate, write and free its objects.
+ *     The first objects of all the threads are live at the same time,
+ *     for shared_objects to look at.
+ */
+static void *worker(void *arg)
+{
+    worker_t *w = arg;
+    run_t *r = w->run;
+    volatile char *obj;
+    long i, j;
+    size_t k;
+
+    if (r->scratch)
+	free(r->objects[w->id]);
+    for (i = 0; i < iterations; i++) {
+	if ((obj = malloc(size)) == NULL)
+	    unix_error("malloc failed in worker");
+	if (i == 0) {
+	    r->firsts[w->id] = (char *)obj;
+	    pthread_barrier_wait(&r->first);
+	}
+	for (j = 0; j < repetitions; j++)
+	    for (k = 0; k < size; k++)
+		obj[k]++;
+	free((char *)obj);
+    }
+    return NULL;
+}
+
+/*
+ * shared_objects - Count the objects that share a cache line with the
+ *     object of another thread
+ */
+static int shared_objects(char **objects)
+{
+    uintptr_t lo, hi;             /* lines of objects[i] */
+    int n = 0;
+    int i, j;
+
+    for (i = 0; i < nthreads; i++) {
+	lo = (uintptr_t)objects[i] / line;
+	hi = ((uintptr_t)objects[i] + size - 1) / line;
+	for (j = 0; j < nthreads; j++)
+	    if (j != i && (uintptr_t)objects[j] / line <= hi &&
+		((uintptr_t)objects[j] + size - 1) / line >= lo)
+		break;
+	if (j < nthreads)
+	    n++;
+    }
+    return n;
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: falseshare [-h] [-t <threads>] [-i <iterations>] "
+	    "[-r <repetitions>]\n"
+	    "                  [-s <size>] [-l <line>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-i <iterations> Objects each thread allocates (1000).\n");
+    fprintf(stderr, "\t-l <line>  Cache line size (64).\n");
+    fprintf(stderr, "\t-r <repetitions> Writes to each byte of an object "
+	    "(100).\n");
+    fprintf(stderr, "\t-s <size>  Object size (8).\n");
+    fprintf(stderr, "\t-t <threads> Number of threads (one per CPU).\n");
+}
+
+/*
+ * unix_error - Report a Unix-style error
+ */
+static void unix_error(char *msg)
+{
+    fprintf(stderr, "%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
@@ -6,9 +6,11 @@
 #include "fcyc.h"
 #include "clock.h"
 #include "ftimer.h"
+#include "rtimer.h"
 #include "config.h"
 
 static double Mhz;  /* estimated CPU clock frequency */
+static rtimer_stats_t last;  /* spread of the last rtimer measurement */
 
 extern int verbose; /* -v option in mdriver.c */
 
@@ -36,6 +38,8 @@ void init_fsecs(void)
 #elif USE_GETTOD
     if (verbose)
 	printf("Measuring performance with gettimeofday().\n");
+#elif USE_RTIMER
+    rtimer_init(verbose);
 #endif
 }
 
@@ -51,7 +55,29 @@ double fsecs(fsecs_test_funct f, void *argp)
     return ftimer_itimer(f, argp, 10);
 #elif USE_GETTOD
     return ftimer_gettod(f, argp, 10);
+#elif USE_RTIMER
+    return rtimer(f, argp, &last);
 #endif 
 }
 
+/*
+ * fsecs_spread - Describe the noise in the last fsecs measurement: the
+ *     median absolute deviation, a 95% confidence interval, and the
+ *     number of runs. Timers that only average report no spread.
+ */
+void fsecs_spread(double secs, double *mad, double *ci_lo, double *ci_hi,
+		  long *runs)
+{
+#if USE_RTIMER
+    *mad = last.mad;
+    *ci_lo = last.ci_lo;
+    *ci_hi = last.ci_hi;
+    *runs = last.runs;
+#else
+    *mad = 0;
+    *ci_lo = *ci_hi = secs;
+    *runs = 10;
+#endif
+}
+
 
@@ -2,3 +2,5 @@ typedef void (*fsecs_test_funct)(void *);
 
 void init_fsecs(void);
 double fsecs(fsecs_test_funct f, void *argp);
+void fsecs_spread(double secs, double *mad, double *ci_lo, double *ci_hi,
+		  long *runs);
@@ -0,0 +1,415 @@
+/*
+ * heapprof.c - Sampling heap profiler for the preloadable mm.c
+ *
+ * usage: make libmm.so
+ *        MMPROF_OUT=app LD_PRELOAD=./libmm.so <program>
+ *        pprof --text <program> app.0001.heap
+ *
+ * MMPROF_OUT turns the profiler on. A profile is written to app.0001.heap,
+ * app.0002.heap, ... at the first sampled allocation after each SIGUSR2
+ * the program gets, and a last one when it exits. A "%p" in MMPROF_OUT
+ * is replaced by the process id. MMPROF_RATE sets the mean number of
+ * bytes between samples (default 524288).
+ *
+ * The stack of each sampled block is looked up in a hash table of the
+ * stacks seen so far, which counts the blocks sampled there and those
+ * of them still live. The block itself goes into a hash table by
+ * address, until it is freed. free only looks for its block there if a
+ * filter of counters, indexed by a hash of the address, says that it
+ * may have been sampled. The tables are mmap'd rather than taken from
+ * the heap being profiled, and are bounded. While as many sampled blocks
+ * are live as the block table holds, further samples are dropped, until
+ * some of those are freed. Stacks are never freed, though, so once the
+ * stack table is full, no more blocks are sampled.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include <execinfo.h>
+#include <sys/mman.h>
+
+#include "heapprof.h"
+
+#define MAXLINE    1024         /* max string size */
+#define MAX_DEPTH  32           /* frames recorded per stack */
+#define SKIP       2            /* frames of prof_sample and its caller */
+#define MAX_STACKS (1 << 14)    /* distinct stacks recorded */
+#define MAX_BLOCKS (1 << 16)    /* sampled blocks live at once */
+#define BUCKETS    (1 << 14)    /* hash chains of each table */
+#define DEFAULT_RATE (512 * 1024)
+
+/* A call stack at which blocks were sampled */
+typedef struct prof_stack {
+    uint32_t hash;
+    int depth;
+    void *pcs[MAX_DEPTH];
+    long allocs;               /* blocks sampled here... */
+    long long alloc_bytes;     /* ...and their bytes */
+    long live;                 /* of those, the blocks still live... */
+    long long live_bytes;      /* ...and their bytes */
+    struct prof_stack *next;   /* in its hash chain */
+} prof_stack_t;
+
+/* A live sampled block */
+typedef struct prof_block {
+    void *ptr;
+    size_t size;
+    prof_stack_t *stack;       /* where it was allocated */
+    struct prof_block *next;   /* in its hash chain, or the free list */
+} prof_block_t;
+
+/* Global variables */
+__thread long prof_countdown = 0;
+unsigned char prof_filter[PROF_FILTER];
+
+static enum {UNINIT, OFF, ON} state = UNINIT;
+static long rate = DEFAULT_RATE;      /* mean bytes between samples */
+static char prefix[MAXLINE];          /* of the profiles' file names */
+static int ndumps = 0;                /* profiles written so far */
+static volatile sig_atomic_t dump_pending = 0;
+
+static volatile int lock = 0;         /* protects everything below */
+static prof_stack_t *stacks;          /* pool of stacks... */
+static int nstacks = 0;               /* ...of which this many are used */
+static prof_stack_t *stack_table[BUCKETS];
+static prof_block_t *blocks;          /* pool of blocks... */
+static int nblocks = 0;               /* ...of which this many were used */
+static prof_block_t *free_blocks;     /* and freed again */
+static prof_block_t *block_table[BUCKETS];
+static int full = 0;                  /* set once the stacks ran out */
+
+static __thread int busy;             /* set while inside the profiler */
+static __thread int started;          /* has the first interval been drawn? */
+static __thread uint64_t rng_state;   /* xorshift64* state */
+
+/* function prototypes for internal helper routines */
+static void init(void);
+static void finish(void) __attribute__((destructor));
+static long next_interval(void);
+static void record(void *p, size_t size, void **pcs, int depth);
+static void dump_next(void);
+static void on_sigusr2(int sig);
+static void lock_prof(void);
+static void unlock_prof(void);
+static void *map_pages(size_t bytes);
+
+#define LOCK(l)   while (__atomic_test_and_set(&(l), __ATOMIC_ACQUIRE))
+#define UNLOCK(l) __atomic_clear(&(l), __ATOMIC_RELEASE)
+
+/*
+ * prof_sample - Called by PROF_MALLOC when this thread's countdown runs
+ *     out: sample the block of size bytes at p, and start a new interval
+ */
+void prof_sample(void *p, size_t size)
+{
+    void *pcs[MAX_DEPTH + SKIP];
+    int depth;
+
+    /* backtrace may allocate, the first time it is called */
+    if (busy)
+	return;
+    busy = 1;
+    if (state == UNINIT)
+	init();
+    if (state == OFF) {
+	prof_countdown = LONG_MAX;
+	busy = 0;
+	return;
+    }
+
+    /* A thread's first countdown starts at 0; draw its first interval */
+    if (!started) {
+	started = 1;
+	prof_countdown += next_interval();
+	if (prof_countdown >= 0) {
+	    busy = 0;
+	    return;
+	}
+    }
+    prof_countdown = next_interval();
+
+    depth = backtrace(pcs, MAX_DEPTH + SKIP) - SKIP;
+    LOCK(lock);
+    record(p, size, pcs + SKIP, (depth > 0) ? depth : 0);
+    UNLOCK(lock);
+
+    if (dump_pending) {
+	dump_pending = 0;
+	dump_next();
+    }
+    busy = 0;
+}
+
+/*
+ * prof_free - Called by PROF_FREE when p may be a sampled block: if it
+ *     is, it is no longer live
+ */
+void prof_free(void *p)
+{
+    prof_block_t **bp, *b;
+    uint32_t slot = PROF_SLOT(p);
+
+    LOCK(lock);
+    for (bp = &block_table[slot & (BUCKETS - 1)]; (b = *bp) != NULL;
+	 bp = &b->next)
+	if (b->ptr == p)
+	    break;
+    if (b != NULL) {
+	*bp = b->next;
+	b->stack->live--;
+	b->stack->live_bytes -= b->size;
+	b->next = free_blocks;
+	free_blocks = b;
+	if (prof_filter[slot] < UCHAR_MAX)
+	    prof_filter[slot]--;
+    }
+    UNLOCK(lock);
+}
+
+/*
+ * mm_heapprof_dump - Write the live and the cumulative profile to path,
+ *     in the text format of gperftools' heap profiler, followed by the
+ *     program's mappings for pprof to symbolize the stacks with. The
+ *     counts are those of the samples; pprof scales them by the rate
+ *     given in the header.
+ */
+int mm_heapprof_dump(const char *path)
+{
+    prof_stack_t *s;
+    long live = 0, allocs = 0;
+    long long live_bytes = 0, alloc_bytes = 0;
+    char buf[MAXLINE];
+    int fd, maps, i;
+    ssize_t n;
+
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+	return -1;
+
+    LOCK(lock);
+    for (s = stacks; s < stacks + nstacks; s++) {
+	live += s->live;
+	live_bytes += s->live_bytes;
+	allocs += s->allocs;
+	alloc_bytes += s->alloc_bytes;
+    }
+    dprintf(fd, "heap profile: %6ld: %8lld [%6ld: %8lld] @ heap_v2/%ld\n",
+	    live, live_bytes, allocs, alloc_bytes, rate);
+    for (s = stacks; s < stacks + nstacks; s++) {
+	dprintf(fd, "%6ld: %8lld [%6ld: %8lld] @",
+		s->live, s->live_bytes, s->allocs, s->alloc_bytes);
+	for (i = 0; i < s->depth; i++)
+	    dprintf(fd, " 0x%lx", (unsigned long)(uintptr_t)s->pcs[i]);
+	dprintf(fd, "\n");
+    }
+    UNLOCK(lock);
+
+    dprintf(fd, "\nMAPPED_LIBRARIES:\n");
+    if ((maps = open("/proc/self/maps", O_RDONLY)) >= 0) {
+	while ((n = read(maps, buf, sizeof(buf))) > 0)
+	    write(fd, buf, n);
+	close(maps);
+    }
+    return close(fd);
+}
+
+/**************************
+ * Internal helper routines
+ **************************/
+
+/*
+ * init - Read the settings from the environment, and if the profiler is
+ *     on, map its tables
+ */
+static void init(void)
+{
+    static volatile int init_lock = 0;
+    struct sigaction sa;
+    char *spec, *pct;
+
+    LOCK(init_lock);
+    if (state != UNINIT) {
+	UNLOCK(init_lock);
+	return;
+    }
+    if ((spec = getenv("MMPROF_OUT")) == NULL) {
+	state = OFF;
+	UNLOCK(init_lock);
+	return;
+    }
+
+    /* Expand %p in the profile file names to the process id */
+    if ((pct = strstr(spec, "%p")) != NULL)
+	snprintf(prefix, MAXLINE, "%.*s%d%s", (int)(pct - spec), spec,
+		 (int)getpid(), pct + 2);
+    else
+	snprintf(prefix, MAXLINE, "%s", spec);
+    if (getenv("MMPROF_RATE") != NULL && atol(getenv("MMPROF_RATE")) > 0)
+	rate = atol(getenv("MMPROF_RATE"));
+
+    stacks = map_pages(MAX_STACKS * sizeof(prof_stack_t));
+    blocks = map_pages(MAX_BLOCKS * sizeof(prof_block_t));
+    if (stacks == NULL || blocks == NULL) {
+	state = OFF;
+	UNLOCK(init_lock);
+	return;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_sigusr2;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR2, &sa, NULL);
+    pthread_atfork(lock_prof, unlock_prof, unlock_prof);
+    state = ON;
+    UNLOCK(init_lock);
+}
+
+/*
+ * finish - At exit, write the last profile
+ */
+static void finish(void)
+{
+    if (state != ON)
+	return;
+    busy = 1;
+    dump_next();
+}
+
+/*
+ * next_interval - Draw the bytes until the next sample from an
+ *     exponential distribution with mean rate, so that the samples
+ *     are a Poisson process over the bytes allocated
+ */
+static long next_interval(void)
+{
+    double u, x;
+
+    if (rng_state == 0) {
+	rng_state = (uint64_t)(uintptr_t)&rng_state ^
+	    ((uint64_t)time(NULL) << 32) ^ (uint64_t)getpid();
+	if (rng_state == 0)
+	    rng_state = 1;
+    }
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    u = ((rng_state * 0x2545f4914f6cdd1dULL) >> 11) * (1.0 / (1ULL << 53));
+
+    x = -log(1.0 - u) * rate;
+    return (x < LONG_MAX / 2) ? (long)x : LONG_MAX / 2;
+}
+
+/*
+ * record - Count a sample of size bytes at p, allocated at the stack
+ *     pcs, and keep the block until it is freed. Called with the lock.
+ */
+static void record(void *p, size_t size, void **pcs, int depth)
+{
+    prof_stack_t *s;
+    prof_block_t *b;
+    uint32_t hash = 2166136261u;  /* FNV-1a over the frames */
+    uint32_t slot = PROF_SLOT(p);
+    int i;
+
+    if (full)
+	return;
+
+    /* Drop the sample if as many as the pool holds are live */
+    if ((b = free_blocks) != NULL)
+	free_blocks = b->next;
+    else if (nblocks < MAX_BLOCKS)
+	b = &blocks[nblocks++];
+    else
+	return;
+
+    for (i = 0; i < depth; i++)
+	hash = (hash ^ (uint32_t)(uintptr_t)pcs[i]) * 16777619u;
+
+    for (s = stack_table[hash & (BUCKETS - 1)]; s != NULL; s = s->next)
+	if (s->hash == hash && s->depth == depth &&
+	    memcmp(s->pcs, pcs, depth * sizeof(void *)) == 0)
+	    break;
+    if (s == NULL) {
+	if (nstacks == MAX_STACKS) {
+	    b->next = free_blocks;
+	    free_blocks = b;
+	    full = 1;
+	    return;
+	}
+	s = &stacks[nstacks++];
+	s->hash = hash;
+	s->depth = depth;
+	memcpy(s->pcs, pcs, depth * sizeof(void *));
+	s->next = stack_table[hash & (BUCKETS - 1)];
+	stack_table[hash & (BUCKETS - 1)] = s;
+    }
+
+    b->ptr = p;
+    b->size = size;
+    b->stack = s;
+    b->next = block_table[slot & (BUCKETS - 1)];
+    block_table[slot & (BUCKETS - 1)] = b;
+    if (prof_filter[slot] < UCHAR_MAX)
+	prof_filter[slot]++;
+
+    s->allocs++;
+    s->alloc_bytes += size;
+    s->live++;
+    s->live_bytes += size;
+}
+
+/*
+ * dump_next - Write the next numbered profile
+ */
+static void dump_next(void)
+{
+    char path[MAXLINE + 32];
+
+    snprintf(path, sizeof(path), "%s.%04d.heap", prefix, ++ndumps);
+    if (mm_heapprof_dump(path) < 0) {
+	static const char msg[] = "heapprof: could not write a profile\n";
+	write(2, msg, sizeof(msg) - 1);
+    }
+}
+
+/*
+ * on_sigusr2 - Have the next sampled allocation write a profile; the
+ *     tables cannot be read safely from a signal handler
+ */
+static void on_sigusr2(int sig)
+{
+    dump_pending = 1;
+}
+
+/*
+ * lock_prof, unlock_prof - Hold the lock across fork, so that the child
+ *     gets consistent tables
+ */
+static void lock_prof(void)
+{
+    LOCK(lock);
+}
+
+static void unlock_prof(void)
+{
+    UNLOCK(lock);
+}
+
+/*
+ * map_pages - Get zeroed memory for a table straight from the kernel,
+ *     or NULL
+ */
+static void *map_pages(size_t bytes)
+{
+    void *p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    return (p == MAP_FAILED) ? NULL : p;
+}
@@ -0,0 +1,54 @@
+/*
+ * heapprof.h - Sampling heap profiler for the preloadable mm.c (libmm.so)
+ *
+ * Every thread counts down the bytes it allocates, from a random
+ * interval drawn from an exponential distribution with a mean of
+ * MMPROF_RATE bytes. The allocation that takes the count below zero is
+ * sampled: its call stack is recorded, and the block is kept in a side
+ * table until it is freed. The count is all that an allocation that is
+ * not sampled pays for.
+ *
+ * The profiles are written in the text format of gperftools' heap
+ * profiler, which pprof reads: the live blocks and all the blocks ever
+ * allocated, by call stack.
+ */
+#ifndef __HEAPPROF_H_
+#define __HEAPPROF_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PROF_FILTER (1 << 16)  /* counters of the sampled block filter */
+
+/* Slot of block p in the filter */
+#define PROF_SLOT(p) ((uint32_t)(((uintptr_t)(p) >> 3) * 2654435761u) >> 16)
+
+/* Call after a successful allocation of size bytes at p */
+#define PROF_MALLOC(p, size) \
+    do { \
+	if ((prof_countdown -= (long)(size)) < 0) \
+	    prof_sample((p), (size)); \
+    } while (0)
+
+/* Call before p is freed or reallocated */
+#define PROF_FREE(p) \
+    do { \
+	if (prof_filter[PROF_SLOT(p)] != 0) \
+	    prof_free(p); \
+    } while (0)
+
+/* Bytes this thread has left to allocate until the next sample. The
+   library is preloaded, so its TLS can be reached without a call */
+extern __thread long prof_countdown
+    __attribute__((tls_model("initial-exec")));
+
+/* Number of sampled blocks in each slot; 0 means p was not sampled */
+extern unsigned char prof_filter[PROF_FILTER];
+
+void prof_sample(void *p, size_t size);
+void prof_free(void *p);
+
+/* Write the profiles to path now. Returns 0, or -1 on error */
+int mm_heapprof_dump(const char *path);
+
+#endif /* __HEAPPROF_H_ */
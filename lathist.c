@@ -0,0 +1,131 @@
+/*
+ * lathist.c - Log-linear latency histograms; see lathist.h
+ */
+#include <string.h>
+#include <time.h>
+
+#include "lathist.h"
+
+#define CALIB_SAMPLES 10000  /* timestamp pairs used to measure overhead */
+#define CALIB_NSECS   20000000 /* 20 ms to measure the counter's rate */
+
+/* function prototypes for internal helper routines */
+static int bucket(uint64_t v);
+static uint64_t bucket_top(int b);
+static uint64_t mono_ns(void);
+
+/*
+ * lat_reset - Empty a histogram
+ */
+void lat_reset(lathist_t *h)
+{
+    memset(h, 0, sizeof(lathist_t));
+}
+
+/*
+ * lat_record - Record one value
+ */
+void lat_record(lathist_t *h, uint64_t v)
+{
+    h->buckets[bucket(v)]++;
+    h->count++;
+    if (v > h->max)
+	h->max = v;
+}
+
+/*
+ * lat_percentile - Walk the buckets until a fraction p of the values
+ *     has been seen and return the top of that bucket, capped at the 
+ *     true maximum
+ */
+uint64_t lat_percentile(lathist_t *h, double p)
+{
+    uint64_t target = (uint64_t)(p * h->count + 0.5);
+    uint64_t seen = 0;
+    uint64_t top;
+    int b;
+
+    if (target == 0)
+	target = 1;
+    for (b = 0; b < LAT_BUCKETS; b++) {
+	seen += h->buckets[b];
+	if (seen >= target) {
+	    top = bucket_top(b);
+	    return (top < h->max) ? top : h->max;
+	}
+    }
+    return h->max;
+}
+
+/*
+ * lat_overhead - Measure the cost of the timestamp pair around a timed
+ *     call. The minimum over many back-to-back pairs is what every
+ *     sample pays, so that is what gets subtracted.
+ */
+uint64_t lat_overhead(void)
+{
+    uint64_t t0, t1, best = UINT64_MAX;
+    int i;
+
+    for (i = 0; i < CALIB_SAMPLES; i++) {
+	t0 = lat_now();
+	t1 = lat_now();
+	if (t1 - t0 < best)
+	    best = t1 - t0;
+    }
+    return best;
+}
+
+/*
+ * lat_ticks_per_ns - Measure the counter against the monotonic clock
+ */
+double lat_ticks_per_ns(void)
+{
+    uint64_t ns0, ns1, t0, t1;
+
+    ns0 = mono_ns();
+    t0 = lat_now();
+    do {
+	ns1 = mono_ns();
+    } while (ns1 - ns0 < CALIB_NSECS);
+    t1 = lat_now();
+    return (double)(t1 - t0) / (double)(ns1 - ns0);
+}
+
+/*
+ * bucket - Map a value to its log-linear bucket
+ */
+static int bucket(uint64_t v)
+{
+    int msb;
+
+    if (v < LAT_SUB)
+	return (int)v;
+    msb = 63 - __builtin_clzll(v);
+    return (msb - LAT_SUB_BITS + 1) * LAT_SUB + 
+	(int)(v >> (msb - LAT_SUB_BITS)) - LAT_SUB;
+}
+
+/*
+ * bucket_top - Largest value that maps to bucket b
+ */
+static uint64_t bucket_top(int b)
+{
+    int group = b / LAT_SUB;
+    uint64_t sub = b % LAT_SUB;
+
+    if (group == 0)
+	return sub;
+    return ((LAT_SUB + sub + 1) << (group - 1)) - 1;
+}
+
+/*
+ * mono_ns - Nanoseconds from the monotonic clock
+ */
+static uint64_t mono_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
@@ -0,0 +1,60 @@
+/*
+ * lathist.h - Log-linear latency histograms (in the style of HDR 
+ *     histograms) and a low-overhead timestamp counter, used by mdriver
+ *     to time individual allocator calls.
+ *
+ * Values below LAT_SUB get a bucket each; above that, every power of 
+ * two is split into LAT_SUB equal buckets, so a recorded value is off
+ * by at most 1/LAT_SUB (about 3%) of itself.
+ */
+#ifndef __LATHIST_H_
+#define __LATHIST_H_
+
+#include <stdint.h>
+#include <time.h>
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+#define LAT_SUB_BITS 5
+#define LAT_SUB      (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS  ((64 - LAT_SUB_BITS + 1) * LAT_SUB)
+
+typedef struct {
+    uint64_t count;                /* number of recorded values */
+    uint64_t max;                  /* exact largest value */
+    uint64_t buckets[LAT_BUCKETS]; /* counts per log-linear bucket */
+} lathist_t;
+
+/* 
+ * lat_now - Read the timestamp counter: the TSC on x86, nanoseconds
+ *     from the monotonic clock elsewhere. Inlined, since it sits
+ *     between the calls being timed.
+ */
+static inline uint64_t lat_now(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/* Empty a histogram */
+void lat_reset(lathist_t *h);
+
+/* Record one value */
+void lat_record(lathist_t *h, uint64_t v);
+
+/* Smallest value v such that a fraction p of the recorded values are <= v */
+uint64_t lat_percentile(lathist_t *h, double p);
+
+/* Cost in ticks of the lat_now() pair around a timed call */
+uint64_t lat_overhead(void);
+
+/* Rate of the lat_now() counter in ticks per nanosecond */
+double lat_ticks_per_ns(void);
+
+#endif /* __LATHIST_H_ */
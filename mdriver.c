@@ -10,16 +10,28 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <errno.h>
 #include <string.h>
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dlfcn.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
 #include "config.h"
+#include "trace.h"
+#include "lathist.h"
+#include "pmc.h"
+#include "report.h"
+#include "allocator.h"
+#include "mtreplay.h"
+#include "pattern.h"
 
 /**********************
  * Constants and macros
@@ -29,6 +41,12 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define RANGE_CHUNK 4096 /* range records allocated from libc at a time */
+#define PMC_RUNS       5 /* runs of a trace to average the counters over */
+#define MAX_BACKENDS  16 /* max number of allocators to compare */
+#define MT_RUNS        5 /* multi-threaded replays per core count (K-best) */
+
+#define MIN(x, y) ((x) < (y) ? (x) : (y)) /* Minimum of two numbers */
 
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
@@ -37,29 +55,36 @@
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
+/* 
+ * Records the extent of each block's payload. Ranges are kept in an
+ * AA-tree (a balanced binary search tree) ordered by payload address,
+ * so overlap checks and removals take O(log n) time.
+ */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    struct range_t *left;  /* subtree of lower payload addresses */
+    struct range_t *right; /* subtree of higher addresses (free list link) */
+    int level;             /* AA-tree level, 1 for leaves */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
-    int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
-} traceop_t;
-
 /* Holds the information for one trace file*/
 typedef struct {
     int sugg_heapsize;   /* suggested heap size (unused) */
     int num_ids;         /* number of alloc/realloc ids */
     int num_ops;         /* number of distinct requests */
+    int num_threads;     /* number of threads making them */
+    int num_scopes;      /* number of scopes they mark */
     int weight;          /* weight for this trace (unused) */
     traceop_t *ops;      /* array of requests */
+    int *scope;          /* of each op on a block allocated in a scope,
+			    1 + the scope's thread, else 0 (NULL if the
+			    trace has no scopes) */
+    struct mm_arena **arenas; /* the arena of each thread's scopes */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    void *map;           /* mmap'd binary trace file that ops points into */
+    size_t map_len;      /* length of that mapping (0 if ops was malloc'd) */
 } trace_t;
 
 /* 
@@ -70,26 +95,28 @@ typedef struct {
 typedef struct {
     trace_t *trace;  
     range_t *ranges;
+    allocator_t *alloc;
 } speed_t;
 
-/* Summarizes the important stats for some malloc function on some trace */
+/* An allocator under test, and how it fared on each trace */
 typedef struct {
-    /* defined for both libc malloc and student malloc package (mm.c) */
-    double ops;      /* number of ops (malloc/free/realloc) in the trace */
-    int valid;       /* was the trace processed correctly by the allocator? */
-    double secs;     /* number of secs needed to run the trace */
-
-    /* defined only for the student malloc package */
-    double util;     /* space utilization for this trace (always 0 for libc) */
-
-    /* Note: secs and util are only defined if valid is true */
-} stats_t; 
+    allocator_t *alloc;
+    stats_t *stats;      /* one stats_t per tracefile */
+    int errors;          /* number of errors found in the allocator */
+} backend_t;
 
 /********************
  * Global variables
  *******************/
 int verbose = 0;        /* global flag for verbose output */
-static int errors = 0;  /* number of errs found when running student malloc */
+static int errors = 0;  /* number of errs found when running an allocator */
+static int heapcheck = 0; /* check the heap after every op (-k) */
+static int sweep = 0;     /* verify every live block before each free (-w) */
+static int calibrate = 0; /* time the driver with the null allocator (-n) */
+static int sampling = 0;  /* sample the heap as the traces run (-s) */
+static int sample_every = 0; /* every so many ops as well as at growth */
+static FILE *series = NULL;  /* file the heap samples go to (--series) */
+static size_t rss_base = 0;  /* resident bytes of the driver, heap empty */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
 /* Directory where default tracefiles are found */
@@ -100,33 +127,99 @@ static char *default_tracefiles[] = {
     DEFAULT_TRACEFILES, NULL
 };
 
+/* Pool of unused range records, linked through their right fields */
+static range_t *range_pool = NULL;
+
+/* The allocators built into the driver: the student's mm package... */
+extern int mm_check(void) __attribute__((weak));   /* all optional */
+extern void mm_stats(alloc_stats_t *st) __attribute__((weak));
+extern mm_arena_t *mm_arena_create(void) __attribute__((weak));
+extern void *mm_arena_malloc(mm_arena_t *arena, size_t size) 
+    __attribute__((weak));
+extern void mm_arena_reset(mm_arena_t *arena) __attribute__((weak));
+extern void mm_arena_destroy(mm_arena_t *arena) __attribute__((weak));
+static allocator_t mm_allocator = {
+    "mm", mm_init, mm_malloc, mm_free, mm_realloc, mm_check, mm_stats,
+    ALLOC_MEMLIB, 
+    mm_arena_create, mm_arena_malloc, mm_arena_reset, mm_arena_destroy
+};
+
+/* ...and libc malloc */
+static int libc_init(void);
+static allocator_t libc_allocator = {
+    "libc", libc_init, malloc, free, realloc, NULL, NULL, ALLOC_THREADSAFE
+};
+
+/* ...and a bump allocator that does next to nothing, against which the
+   driver times its own overhead (-n). Nothing ever touches its blocks,
+   so they need no memory behind them. Like mm's, its heap starts over
+   at each init, so it is flagged ALLOC_MEMLIB for eval_speed to run it
+   exactly as it runs mm, without freeing the blocks left at the end */
+static int null_init(void);
+static void *null_malloc(size_t size);
+static void null_free(void *ptr);
+static void *null_realloc(void *ptr, size_t size);
+static allocator_t null_allocator = {
+    "null", null_init, null_malloc, null_free, null_realloc, NULL, NULL,
+    ALLOC_MEMLIB
+};
+static char *null_brk;
+
 
 /********************* 
  * Function prototypes 
  *********************/
 
-/* these functions manipulate range lists */
-static int add_range(range_t **ranges, char *lo, int size, 
+/* these functions manipulate range trees */
+static int add_range(allocator_t *a, range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
+static range_t *new_range(char *lo, char *hi);
+static void free_range(range_t *p);
+static range_t *insert_range(range_t *t, range_t *p);
+static range_t *delete_range(range_t *t, char *lo);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static void map_bin_trace(trace_t *trace, char *path);
+static void check_scopes(trace_t *trace, char *path);
 static void free_trace(trace_t *trace);
 
-/* Routines for evaluating the correctness and speed of libc malloc */
-static int eval_libc_valid(trace_t *trace, int tracenum);
-static void eval_libc_speed(void *ptr);
-
 /* Routines for evaluating correctnes, space utilization, and speed 
-   of the student's malloc package in mm.c */
-static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
-static void eval_mm_speed(void *ptr);
+   of an allocator */
+static int eval_valid(allocator_t *a, trace_t *trace, int tracenum, 
+		      range_t **ranges);
+static void eval_util(allocator_t *a, trace_t *trace, int tracenum, 
+		      range_t **ranges, stats_t *stats);
+static double sample_heap(allocator_t *a, int tracenum, int opnum, 
+			  int total_size, double *int_frag);
+static size_t heap_rss(void);
+static void eval_speed(void *ptr);
+static void eval_latency(allocator_t *a, trace_t *trace, lathist_t *hists, 
+			 uint64_t ovhd);
+static void eval_counters(speed_t *speed, pmc_counts_t *c);
+static void eval_scaling(allocator_t *a, trace_t *trace, int tracenum,
+			 int maxcpus);
+static int eval_arena(allocator_t *a, trace_t *trace, int tracenum, 
+		      range_t **ranges, stats_t *stats);
+static void eval_arena_speed(void *ptr);
+static void release_blocks(allocator_t *a, trace_t *trace);
+static int sweep_blocks(trace_t *trace, int tracenum, int opnum);
+
+/* Loads an allocator from a shared object */
+static allocator_t *load_backend(char *path);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void getspread(stats_t *stats);
+static void printcompare(int n, backend_t *backends, int nbackends);
+static void printfootprint(char *name, int n, stats_t *stats);
+static void printarena(char *name, int n, stats_t *stats);
+static int paged(int n, stats_t *stats);
+static void printlatency(char *name, int tracenum, lathist_t *hists, 
+			 uint64_t ovhd, double ticks_per_ns);
+static void printcounters(char *name, int n, stats_t *stats);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -143,22 +236,57 @@ int main(int argc, char **argv)
     int num_tracefiles = 0;    /* the number of traces in that array */
     trace_t *trace = NULL;     /* stores a single trace file in memory */
     range_t *ranges = NULL;    /* keeps track of block extents for one trace */
-    stats_t *libc_stats = NULL;/* libc stats for each trace */
+    stats_t *stats = NULL;     /* stats of one allocator for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
     speed_t speed_params;      /* input parameters to the xx_speed routines */ 
+    backend_t backends[MAX_BACKENDS]; /* the allocators to evaluate */
+    int nbackends = 0;
+    allocator_t *alloc;        /* the allocator being evaluated */
+    int b;
 
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int latency = 0;     /* If set, report per-op latencies (-L) */
+    int counters = 0;    /* If set, report hardware counters (-c) */
+    int maxcpus = 0;     /* If set, replay threaded traces on up to this
+			    many cores (-p) */
+    int mt_skipped;      /* If set, the allocator is not thread-safe, and
+			    was not replayed multi-threaded */
+    int arena = 0;       /* If set, replay traces with scopes using the
+			    allocator's arenas as well (-A) */
+    int arena_runs;      /* traces the allocator was so replayed on */
+    char *json_file = NULL;    /* write the results here as JSON (--json) */
+    char *csv_file = NULL;     /* and here as CSV (--csv) */
+    char *baseline = NULL;     /* JSON results to compare with (--compare) */
+    char *series_file = NULL;  /* write the heap samples here (--series) */
+    double *driver_secs = NULL;/* time the driver takes on each trace (-n) */
+    result_t results[MAX_BACKENDS]; /* results of each, for the reports */
+    int nresults = 0;
+    int regressions = 0;
+    static struct option longopts[] = {
+	{"json", required_argument, NULL, 'J'},
+	{"csv", required_argument, NULL, 'C'},
+	{"compare", required_argument, NULL, 'B'},
+	{"series", required_argument, NULL, 'S'},
+	{NULL, 0, NULL, 0}
+    };
+
+    lathist_t lat_hists[3];    /* latencies of each op type, for one trace */
+    uint64_t lat_ovhd = 0;     /* timestamp overhead, in counter ticks */
+    double ticks_per_ns = 1;   /* rate of the latency counter */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
+    double net_secs;
     int numcorrect;
     
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    backends[nbackends++].alloc = &mm_allocator;
+    while ((c = getopt_long(argc, argv, "f:t:b:s:p:hvVgalLcknwA", longopts, NULL)) 
+	   != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -184,6 +312,57 @@ int main(int argc, char **argv)
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'b': /* Run the allocator in a shared object */
+            if (!strcmp(optarg, "libc")) {
+                run_libc = 1;
+                break;
+            }
+            if (nbackends == MAX_BACKENDS - 1)
+                app_error("Too many allocators");
+            backends[nbackends++].alloc = load_backend(optarg);
+            break;
+        case 'k': /* Check the heap after every op */
+            heapcheck = 1;
+            break;
+        case 'w': /* Verify every live block before each free */
+            sweep = 1;
+            break;
+        case 's': /* Sample the heap every so many ops, 0 at growth only */
+            sampling = 1;
+            sample_every = atoi(optarg);
+            if (sample_every < 0)
+                app_error("-s needs a number of ops");
+            break;
+        case 'n': /* Report throughput net of the driver's own overhead */
+            calibrate = 1;
+            break;
+        case 'p': /* Replay threaded traces on 1, 2, 4, ... n cores */
+            maxcpus = atoi(optarg);
+            if (maxcpus <= 0 || maxcpus > mt_cpus())
+                maxcpus = mt_cpus();
+            break;
+        case 'A': /* Compare arena-scoped replays with per-object frees */
+            arena = 1;
+            break;
+        case 'L': /* Report per-op latency percentiles */
+            latency = 1;
+            break;
+        case 'c': /* Report hardware performance counters */
+            counters = 1;
+            break;
+        case 'J': /* Write the results as JSON */
+            json_file = optarg;
+            break;
+        case 'C': /* Write the results as CSV */
+            csv_file = optarg;
+            break;
+        case 'B': /* Compare the results with a JSON baseline */
+            baseline = optarg;
+            break;
+        case 'S': /* Write the heap samples as CSV */
+            sampling = 1;
+            series_file = optarg;
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -245,83 +424,161 @@ int main(int argc, char **argv)
 
     /* Initialize the timing package */
     init_fsecs();
+    if (latency) {
+	lat_ovhd = lat_overhead();
+	ticks_per_ns = lat_ticks_per_ns();
+    }
+    if (counters && pmc_open() == 0) {
+	printf("Hardware counters are not available here "
+	       "(see /proc/sys/kernel/perf_event_paranoid), ignoring -c.\n");
+	counters = 0;
+    }
+
+    if (series_file != NULL) {
+	if ((series = fopen(series_file, "w")) == NULL)
+	    unix_error("Could not open the --series file");
+	fprintf(series, "allocator,trace,op,live,heap,rss,free,"
+		"largest_free,dirty,purged\n");
+    }
+
+    /* Initialize the simulated memory system in memlib.c */
+    mem_init(); 
 
     /*
-     * Optionally run and evaluate the libc malloc package 
+     * Time the driver replaying each trace against the null allocator;
+     * that much of each allocator's time is the driver's, not its own
      */
-    if (run_libc) {
+    if (calibrate) {
+	if ((driver_secs = calloc(num_tracefiles, sizeof(double))) == NULL)
+	    unix_error("driver_secs calloc in main failed");
+	for (i = 0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    speed_params.trace = trace;
+	    speed_params.ranges = NULL;
+	    speed_params.alloc = &null_allocator;
+	    driver_secs[i] = fsecs(eval_speed, &speed_params);
+	    if (verbose > 1)
+		printf("Driver overhead on trace %d: %.3f usecs\n", i, 
+		       driver_secs[i]*1e6);
+	    free_trace(trace);
+	}
+    }
+
+    /*
+     * Run and evaluate each allocator in turn, starting with the
+     * student's mm package, and optionally ending with libc malloc
+     */
+    if (run_libc)
+	backends[nbackends++].alloc = &libc_allocator;
+
+    for (b = 0; b < nbackends; b++) {
+	alloc = backends[b].alloc;
 	if (verbose > 1)
-	    printf("\nTesting libc malloc\n");
-	
-	/* Allocate libc stats array, with one stats_t struct per tracefile */
-	libc_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
-	if (libc_stats == NULL)
-	    unix_error("libc_stats calloc in main failed");
-	
-	/* Evaluate the libc malloc package using the K-best scheme */
+	    printf("\nTesting %s malloc\n", alloc->name);
+
+	/* Allocate the stats array, with one stats_t struct per tracefile */
+	stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+	if (stats == NULL)
+	    unix_error("stats calloc in main failed");
+	backends[b].stats = stats;
+	errors = 0;
+	mt_skipped = 0;
+	arena_runs = 0;
+
+	/* Evaluate the allocator using the K-best scheme */
 	for (i=0; i < num_tracefiles; i++) {
 	    trace = read_trace(tracedir, tracefiles[i]);
-	    libc_stats[i].ops = trace->num_ops;
+	    stats[i].ops = trace->num_ops;
+	    stats[i].ext_frag = stats[i].int_frag = -1;
+	    if (calibrate)
+		stats[i].driver_secs = driver_secs[i];
 	    if (verbose > 1)
-		printf("Checking libc malloc for correctness, ");
-	    libc_stats[i].valid = eval_libc_valid(trace, i);
-	    if (libc_stats[i].valid) {
+		printf("Checking %s malloc for correctness, ", alloc->name);
+	    stats[i].valid = eval_valid(alloc, trace, i, &ranges);
+	    if (stats[i].valid) {
+		if (alloc->flags & ALLOC_MEMLIB) {
+		    if (verbose > 1)
+			printf("efficiency, ");
+		    eval_util(alloc, trace, i, &ranges, &stats[i]);
+		}
 		speed_params.trace = trace;
+		speed_params.ranges = ranges;
+		speed_params.alloc = alloc;
 		if (verbose > 1)
 		    printf("and performance.\n");
-		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+		stats[i].secs = fsecs(eval_speed, &speed_params);
+		getspread(&stats[i]);
+		if (counters)
+		    eval_counters(&speed_params, &stats[i].pmc);
+		if (latency) {
+		    eval_latency(alloc, trace, lat_hists, lat_ovhd);
+		    printlatency(alloc->name, i, lat_hists, lat_ovhd, 
+				 ticks_per_ns);
+		}
+		if (maxcpus && trace->num_threads > 1) {
+		    if (alloc->flags & ALLOC_THREADSAFE)
+			eval_scaling(alloc, trace, i, maxcpus);
+		    else
+			mt_skipped = 1;
+		}
+		if (arena && trace->num_scopes > 0 && 
+		    alloc->arena_create != NULL) {
+		    if (verbose > 1)
+			printf("Replaying the %d scopes with arenas.\n", 
+			       trace->num_scopes);
+		    if (eval_arena(alloc, trace, i, &ranges, &stats[i])) {
+			stats[i].arena_secs = 
+			    fsecs(eval_arena_speed, &speed_params);
+			arena_runs++;
+		    }
+		}
 	    }
 	    free_trace(trace);
 	}
-
-	/* Display the libc results in a compact table */
+	backends[b].errors = errors;
+	if (mt_skipped)
+	    printf("%s malloc is not thread-safe, so its multi-threaded "
+		   "replays were skipped.\n", alloc->name);
+	if (arena && alloc->arena_create == NULL)
+	    printf("%s malloc has no arenas, so its arena-scoped "
+		   "replays were skipped.\n", alloc->name);
+
+	/* Display the results in a compact table */
 	if (verbose) {
-	    printf("\nResults for libc malloc:\n");
-	    printresults(num_tracefiles, libc_stats);
+	    printf("\nResults for %s malloc:\n", alloc->name);
+	    printresults(num_tracefiles, stats);
+	    printf("\n");
 	}
-    }
-
-    /*
-     * Always run and evaluate the student's mm package
-     */
-    if (verbose > 1)
-	printf("\nTesting mm malloc\n");
-
-    /* Allocate the mm stats array, with one stats_t struct per tracefile */
-    mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
-    if (mm_stats == NULL)
-	unix_error("mm_stats calloc in main failed");
-    
-    /* Initialize the simulated memory system in memlib.c */
-    mem_init(); 
-
-    /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
-	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
-	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-	    speed_params.trace = trace;
-	    speed_params.ranges = ranges;
-	    if (verbose > 1)
-		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	/* and how the heap evolved, or what remapping and purging saved */
+	if ((alloc->flags & ALLOC_MEMLIB) && 
+	    (sampling || (verbose && paged(num_tracefiles, stats)))) {
+	    printfootprint(alloc->name, num_tracefiles, stats);
+	    printf("\n");
+	}
+	if (arena_runs > 0) {
+	    printarena(alloc->name, num_tracefiles, stats);
+	    printf("\n");
+	}
+	if (counters) {
+	    printcounters(alloc->name, num_tracefiles, stats);
+	    printf("\n");
 	}
-	free_trace(trace);
     }
-
-    /* Display the mm results in a compact table */
-    if (verbose) {
-	printf("\nResults for mm malloc:\n");
-	printresults(num_tracefiles, mm_stats);
+    if (counters)
+	pmc_close();
+    if (series != NULL && fclose(series) != 0)
+	unix_error("Could not write the --series file");
+
+    /* Set the allocators side by side */
+    if (nbackends > 1) {
+	printcompare(num_tracefiles, backends, nbackends);
 	printf("\n");
     }
 
+    /* The performance index is that of the student's mm package */
+    mm_stats = backends[0].stats;
+    errors = backends[0].errors;
+
     /* 
      * Accumulate the aggregate statistics for the student's mm package 
      */
@@ -358,6 +615,17 @@ int main(int argc, char **argv)
 	       p1*100, 
 	       p2*100, 
 	       perfindex);
+
+	/* The index counts the driver's time; say what it was */
+	if (calibrate) {
+	    net_secs = secs;
+	    for (i = 0; i < num_tracefiles; i++)
+		net_secs -= mm_stats[i].driver_secs;
+	    printf("Throughput = %.0f Kops, or %.0f Kops net of the driver's "
+		   "%.0f%% of the time\n", (ops/1e3)/secs, 
+		   net_secs > 0 ? (ops/1e3)/net_secs : 0, 
+		   (secs - net_secs)*100/secs);
+	}
 	
     }
     else { /* There were errors */
@@ -370,27 +638,51 @@ int main(int argc, char **argv)
 	printf("perfidx:%.0f\n", perfindex);
     }
 
+    /* 
+     * Export the results, and compare them with the baseline
+     */
+    for (b = 0; b < nbackends; b++)
+	results[nresults++] = (result_t){backends[b].alloc->name, 
+					 num_tracefiles, tracefiles,
+					 backends[b].stats, 
+					 b == 0 ? perfindex : -1};
+    if (json_file && report_json(json_file, results, nresults) < 0)
+	unix_error("Could not write the JSON results");
+    if (csv_file && report_csv(csv_file, results, nresults) < 0)
+	unix_error("Could not write the CSV results");
+    if (baseline) {
+	printf("\n");
+	if ((regressions = report_compare(baseline, results, nresults)) < 0)
+	    app_error("Could not read the baseline results");
+	if (regressions > 0) {
+	    printf("%d regressions against %s\n", regressions, baseline);
+	    exit(2);
+	}
+    }
+
     exit(0);
 }
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
+ * The following routines manipulate the range tree, which keeps 
  * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks.
  ****************************************************************/
 
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     we create a range struct for this block and add it to the range tree. 
  */
-static int add_range(range_t **ranges, char *lo, int size, 
+static int add_range(allocator_t *a, range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum)
 {
     char *hi = lo + size - 1;
     range_t *p;
+    range_t *pred = NULL;  /* live range with the largest lo <= new lo */
+    range_t *succ = NULL;  /* live range with the smallest lo > new lo */
     char msg[MAXLINE];
 
     assert(size > 0);
@@ -403,36 +695,49 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap, if we know it */
+    if ((a->flags & ALLOC_MEMLIB) &&
+	((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
+	 (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi()))) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
         return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
+    /* 
+     * The payload must not overlap any other payloads. Live payloads
+     * never overlap each other, so only the two ranges adjacent to lo
+     * in address order can possibly overlap the new one.
+     */
+    for (p = *ranges;  p != NULL; ) {
+        if (lo < p->lo) {
+            succ = p;
+            p = p->left;
+        }
+        else {
+            pred = p;
+            p = p->right;
         }
     }
+    if (pred != NULL && pred->hi >= lo)
+        p = pred;
+    else if (succ != NULL && succ->lo <= hi)
+        p = succ;
+    else
+        p = NULL;
+    if (p != NULL) {
+	sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+		lo, hi, p->lo, p->hi);
+	malloc_error(tracenum, opnum, msg);
+	return 0;
+    }
 
     /* 
      * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
+     * by creating a range struct and adding it the range tree.
      */
-    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
-	unix_error("malloc error in add_range");
-    p->next = *ranges;
-    p->lo = lo;
-    p->hi = hi;
-    *ranges = p;
+    *ranges = insert_range(*ranges, new_range(lo, hi));
     return 1;
 }
 
@@ -440,35 +745,161 @@ static int add_range(range_t **ranges, char *lo, int size,
  * remove_range - Free the range record of block whose payload starts at lo 
  */
 static void remove_range(range_t **ranges, char *lo)
+{
+    *ranges = delete_range(*ranges, lo);
+}
+
+/*
+ * clear_ranges - return all of the range records for a trace to the pool
+ */
+static void clear_ranges(range_t **ranges)
+{
+    range_t *p = *ranges;
+
+    if (p == NULL)
+        return;
+    clear_ranges(&p->left);
+    clear_ranges(&p->right);
+    free_range(p);
+    *ranges = NULL;
+}
+
+/*
+ * new_range - Take a range record from the pool, refilling the pool
+ *     from libc RANGE_CHUNK records at a time when it runs dry.
+ */
+static range_t *new_range(char *lo, char *hi)
 {
     range_t *p;
-    range_t **prevpp = ranges;
-    //    int size;
-
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-	    //            size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
+    int i;
+
+    if (range_pool == NULL) {
+        if ((p = (range_t *)malloc(RANGE_CHUNK * sizeof(range_t))) == NULL)
+            unix_error("malloc error in new_range");
+        for (i = 0; i < RANGE_CHUNK; i++)
+            free_range(&p[i]);
     }
+    p = range_pool;
+    range_pool = p->right;
+
+    p->lo = lo;
+    p->hi = hi;
+    p->left = p->right = NULL;
+    p->level = 1;
+    return p;
 }
 
 /*
- * clear_ranges - free all of the range records for a trace 
+ * free_range - Return a range record to the pool
  */
-static void clear_ranges(range_t **ranges)
+static void free_range(range_t *p)
+{
+    p->right = range_pool;
+    range_pool = p;
+}
+
+/* Level of an AA-tree node; empty subtrees have level 0 */
+#define LEVEL(t) ((t) == NULL ? 0 : (t)->level)
+
+/*
+ * skew - Rotate right to remove a left child on the same level as t
+ */
+static range_t *skew(range_t *t)
+{
+    range_t *l;
+
+    if (t == NULL || t->left == NULL || t->left->level != t->level)
+        return t;
+    l = t->left;
+    t->left = l->right;
+    l->right = t;
+    return l;
+}
+
+/*
+ * split - Rotate left and promote to break up two consecutive right
+ *     children on the same level as t
+ */
+static range_t *split(range_t *t)
+{
+    range_t *r;
+
+    if (t == NULL || t->right == NULL || t->right->right == NULL ||
+        t->right->right->level != t->level)
+        return t;
+    r = t->right;
+    t->right = r->left;
+    r->left = t;
+    r->level++;
+    return r;
+}
+
+/*
+ * insert_range - Insert range record p into the tree rooted at t and
+ *     return the new root
+ */
+static range_t *insert_range(range_t *t, range_t *p)
+{
+    if (t == NULL)
+        return p;
+    if (p->lo < t->lo)
+        t->left = insert_range(t->left, p);
+    else
+        t->right = insert_range(t->right, p);
+    return split(skew(t));
+}
+
+/*
+ * delete_range - Remove the range starting at lo from the tree rooted
+ *     at t, if there is one, and return the new root
+ */
+static range_t *delete_range(range_t *t, char *lo)
 {
     range_t *p;
-    range_t *pnext;
+    int level;
+
+    if (t == NULL)
+        return NULL;
+
+    if (lo < t->lo) 
+        t->left = delete_range(t->left, lo);
+    else if (lo > t->lo)
+        t->right = delete_range(t->right, lo);
+    else if (t->left == NULL && t->right == NULL) {
+        free_range(t);
+        return NULL;
+    }
+    else if (t->left == NULL) {
+        /* Replace t's extent with its successor's, then delete that */
+        for (p = t->right; p->left != NULL; p = p->left)
+            ;
+        t->lo = p->lo;
+        t->hi = p->hi;
+        t->right = delete_range(t->right, p->lo);
+    }
+    else {
+        /* Replace t's extent with its predecessor's, then delete that */
+        for (p = t->left; p->right != NULL; p = p->right)
+            ;
+        t->lo = p->lo;
+        t->hi = p->hi;
+        t->left = delete_range(t->left, p->lo);
+    }
 
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
+    /* Restore the AA-tree invariants on the way back up */
+    level = MIN(LEVEL(t->left), LEVEL(t->right)) + 1;
+    if (level < t->level) {
+        t->level = level;
+        if (t->right != NULL && level < t->right->level)
+            t->right->level = level;
     }
-    *ranges = NULL;
+    t = skew(t);
+    t->right = skew(t->right);
+    if (t->right != NULL)
+        t->right->right = skew(t->right->right);
+    t = split(t);
+    t->right = split(t->right);
+    return t;
 }
 
 
@@ -477,7 +908,9 @@ static void clear_ranges(range_t **ranges)
  *********************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * read_trace - read a trace file and store it in memory. Binary traces
+ *     (see trace.h) are recognized by their magic number and mapped
+ *     rather than parsed.
  */
 static trace_t *read_trace(char *tracedir, char *filename)
 {
@@ -488,6 +921,8 @@ static trace_t *read_trace(char *tracedir, char *filename)
     unsigned index, size;
     unsigned max_index = 0;
     unsigned op_index;
+    int thread;
+    uint32_t magic = 0;
 
     if (verbose > 1)
 	printf("Reading tracefile: %s\n", filename);
@@ -495,6 +930,12 @@ static trace_t *read_trace(char *tracedir, char *filename)
     /* Allocate the trace record */
     if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
 	unix_error("malloc 1 failed in read_trance");
+    trace->map = NULL;
+    trace->map_len = 0;
+    trace->num_threads = 1;
+    trace->num_scopes = 0;
+    trace->scope = NULL;
+    trace->arenas = NULL;
 	
     /* Read the trace file header */
     strcpy(path, tracedir);
@@ -503,15 +944,23 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	sprintf(msg, "Could not open %s in read_trace", path);
 	unix_error(msg);
     }
-    fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
-    fscanf(tracefile, "%d", &(trace->num_ids));     
-    fscanf(tracefile, "%d", &(trace->num_ops));     
-    fscanf(tracefile, "%d", &(trace->weight));        /* not used */
+    if (fread(&magic, sizeof(magic), 1, tracefile) == 1 && 
+	magic == TRACE_MAGIC) {
+	fclose(tracefile);
+	map_bin_trace(trace, path);
+    }
+    else {
+	rewind(tracefile);
+	fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
+	fscanf(tracefile, "%d", &(trace->num_ids));     
+	fscanf(tracefile, "%d", &(trace->num_ops));     
+	fscanf(tracefile, "%d", &(trace->weight));        /* not used */
     
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops = 
-	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-	unix_error("malloc 2 failed in read_trace");
+	/* We'll store each request line in the trace in this array */
+	if ((trace->ops = 
+	     (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+	    unix_error("malloc 2 failed in read_trace");
+    }
 
     /* We'll keep an array of pointers to the allocated blocks here... */
     if ((trace->blocks = 
@@ -522,12 +971,17 @@ static trace_t *read_trace(char *tracedir, char *filename)
     if ((trace->block_sizes = 
 	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
 	unix_error("malloc 4 failed in read_trace");
+
+    if (trace->map != NULL) {
+	check_scopes(trace, path);
+	return trace;
+    }
     
     /* read every request line in the trace file */
     index = 0;
     op_index = 0;
     while (fscanf(tracefile, "%s", type) != EOF) {
-	switch(type[0]) {
+	switch(trace_optype(type, &thread)) {
 	case 'a':
 	    fscanf(tracefile, "%u %u", &index, &size);
 	    trace->ops[op_index].type = ALLOC;
@@ -547,58 +1001,225 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	    trace->ops[op_index].type = FREE;
 	    trace->ops[op_index].index = index;
 	    break;
+	case 'b':
+	    trace->ops[op_index].type = SCOPE_BEGIN;
+	    trace->ops[op_index].index = 0;
+	    trace->ops[op_index].size = 0;
+	    break;
+	case 'e':
+	    trace->ops[op_index].type = SCOPE_END;
+	    trace->ops[op_index].index = 0;
+	    trace->ops[op_index].size = 0;
+	    break;
 	default:
-	    printf("Bogus type character (%c) in tracefile %s\n", 
-		   type[0], path);
+	    printf("Bogus request (%s) in tracefile %s\n", 
+		   type, path);
 	    exit(1);
 	}
+	trace->ops[op_index].thread = thread;
+	if (thread >= trace->num_threads)
+	    trace->num_threads = thread + 1;
 	op_index++;
 	
     }
     fclose(tracefile);
     assert(max_index == trace->num_ids - 1);
     assert(trace->num_ops == op_index);
+    check_scopes(trace, path);
     
     return trace;
 }
 
 /*
- * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ * map_bin_trace - mmap the binary trace file at path and point the
+ *     trace's ops array directly at the records in the mapping. The
+ *     header, checksum, and every op are validated before use, but
+ *     nothing is copied.
+ */
+static void map_bin_trace(trace_t *trace, char *path)
+{
+    int fd, i;
+    struct stat st;
+    tracehdr_t *hdr;
+    traceop_t *op;
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+	sprintf(msg, "Could not open %s in map_bin_trace", path);
+	unix_error(msg);
+    }
+    if (fstat(fd, &st) < 0)
+	unix_error("fstat failed in map_bin_trace");
+    if (st.st_size < sizeof(tracehdr_t)) {
+	sprintf(msg, "Truncated binary trace header in %s", path);
+	app_error(msg);
+    }
+    hdr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (hdr == MAP_FAILED)
+	unix_error("mmap failed in map_bin_trace");
+    close(fd);
+    madvise(hdr, st.st_size, MADV_SEQUENTIAL);
+
+    if (hdr->version != TRACE_VERSION || hdr->oplen != sizeof(traceop_t)) {
+	sprintf(msg, "Unsupported binary trace version %u (oplen %u) in %s",
+		hdr->version, hdr->oplen, path);
+	app_error(msg);
+    }
+    if (hdr->num_ops < 0 || hdr->num_ids < 0 ||
+	st.st_size != sizeof(tracehdr_t) + 
+	(off_t)hdr->num_ops * sizeof(traceop_t)) {
+	sprintf(msg, "Size of %s does not match its header", path);
+	app_error(msg);
+    }
+
+    trace->sugg_heapsize = hdr->sugg_heapsize;
+    trace->num_ids = hdr->num_ids;
+    trace->num_ops = hdr->num_ops;
+    trace->weight = hdr->weight;
+    trace->ops = (traceop_t *)(hdr + 1);
+    trace->map = hdr;
+    trace->map_len = st.st_size;
+
+    /* A corrupt op would send the driver outside its blocks array */
+    if (trace_checksum(TRACE_CKSUM_INIT, trace->ops, trace->num_ops) != 
+	hdr->checksum) {
+	sprintf(msg, "Checksum mismatch in %s", path);
+	app_error(msg);
+    }
+    for (i = 0, op = trace->ops; i < trace->num_ops; i++, op++) {
+	if (op->type < ALLOC || op->type > SCOPE_END ||
+	    op->index < 0 || op->index >= trace->num_ids || op->size < 0 ||
+	    op->thread < 0 || op->thread >= TRACE_MAX_THREADS) {
+	    sprintf(msg, "Bogus op %d in binary tracefile %s", i, path);
+	    app_error(msg);
+	}
+	if (op->thread >= trace->num_threads)
+	    trace->num_threads = op->thread + 1;
+    }
+}
+
+/*
+ * check_scopes - Count the scopes a trace marks, make sure that they
+ *     are as trace.h says, and note which ops are on blocks allocated
+ *     in a scope: a thread has one scope open at a time, ends every
+ *     scope it begins, and frees the blocks of a scope before its end.
+ */
+static void check_scopes(trace_t *trace, char *path)
+{
+    int *open;      /* of each thread, whether it has a scope open... */
+    int *live;      /* ...and how many of its scope's blocks are live */
+    int *owner;     /* of each live block, 1 + the thread of its scope */
+    int i, t, index;
+
+    for (i = 0; i < trace->num_ops; i++)
+	if (trace->ops[i].type >= SCOPE_BEGIN)
+	    break;
+    if (i == trace->num_ops)
+	return;
+
+    open = calloc(trace->num_threads, sizeof(int));
+    live = calloc(trace->num_threads, sizeof(int));
+    owner = calloc(trace->num_ids, sizeof(int));
+    trace->arenas = calloc(trace->num_threads, sizeof(struct mm_arena *));
+    trace->scope = calloc(trace->num_ops, sizeof(int));
+    if (open == NULL || live == NULL || owner == NULL || 
+	trace->arenas == NULL || trace->scope == NULL)
+	unix_error("calloc failed in check_scopes");
+
+    /* Follow each block allocated in a scope until it is freed */
+    for (i = 0; i < trace->num_ops; i++) {
+	t = trace->ops[i].thread;
+	index = trace->ops[i].index;
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    owner[index] = open[t] ? t + 1 : 0;
+	    live[t] += open[t];
+	    break;
+	case REALLOC:
+	    break;
+	case FREE:
+	    if (owner[index] != 0)
+		live[owner[index] - 1]--;
+	    break;
+	case SCOPE_BEGIN:
+	    if (open[t]) {
+		sprintf(msg, "Op %d of %s begins a scope inside a scope", 
+			i, path);
+		app_error(msg);
+	    }
+	    open[t] = 1;
+	    trace->num_scopes++;
+	    continue;
+	case SCOPE_END:
+	    if (!open[t] || live[t] > 0) {
+		sprintf(msg, "Op %d of %s ends %s", i, path, !open[t] ? 
+			"a scope that was not begun" : 
+			"a scope with blocks still live");
+		app_error(msg);
+	    }
+	    open[t] = 0;
+	    continue;
+	}
+	trace->scope[i] = owner[index];
+	if (trace->ops[i].type == FREE)
+	    owner[index] = 0;
+    }
+    for (t = 0; t < trace->num_threads; t++)
+	if (open[t]) {
+	    sprintf(msg, "Thread %d of %s never ends its scope", t, path);
+	    app_error(msg);
+	}
+    free(open);
+    free(live);
+    free(owner);
+}
+
+/*
+ * free_trace - Free the trace record and the arrays it points to, all
+ *              of which were allocated in read_trace(). The ops of a
+ *              binary trace are unmapped instead.
  */
 void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    if (trace->map != NULL)   /* free the arrays... */
+	munmap(trace->map, trace->map_len);
+    else
+	free(trace->ops);
     free(trace->blocks);      
     free(trace->block_sizes);
+    free(trace->scope);
+    free(trace->arenas);
     free(trace);              /* and the trace record itself... */
 }
 
 /**********************************************************************
  * The following functions evaluate the correctness, space utilization,
- * and throughput of the libc and mm malloc packages.
+ * and throughput of an allocator, driving it through its allocator_t.
  **********************************************************************/
 
 /*
- * eval_mm_valid - Check the mm malloc package for correctness
+ * eval_valid - Check an allocator for correctness
  */
-static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) 
+static int eval_valid(allocator_t *a, trace_t *trace, int tracenum, 
+		      range_t **ranges) 
 {
-    int i, j;
+    int i;
     int index;
     int size;
     int oldsize;
+    size_t bad;
     char *newp;
     char *oldp;
     char *p;
     
     /* Reset the heap and free any records in the range list */
-    mem_reset_brk();
+    if (a->flags & ALLOC_MEMLIB)
+	mem_reset_brk();
     clear_ranges(ranges);
+    memset(trace->blocks, 0, trace->num_ids * sizeof(char *));
 
-    /* Call the mm package's init function */
-    if (mm_init() < 0) {
-	malloc_error(tracenum, 0, "mm_init failed.");
+    /* Call the allocator's init function */
+    if (a->init() < 0) {
+	malloc_error(tracenum, 0, "init failed.");
 	return 0;
     }
 
@@ -609,11 +1230,11 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 
         switch (trace->ops[i].type) {
 
-        case ALLOC: /* mm_malloc */
+        case ALLOC: /* malloc */
 
-	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
-		malloc_error(tracenum, i, "mm_malloc failed.");
+	    /* Call the allocator's malloc */
+	    if ((p = a->malloc(size)) == NULL) {
+		malloc_error(tracenum, i, "malloc failed.");
 		return 0;
 	    }
 	    
@@ -622,27 +1243,36 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	     * to the range list if OK. The block must be  be aligned properly,
 	     * and must not overlap any currently allocated block. 
 	     */ 
-	    if (add_range(ranges, p, size, tracenum, i) == 0)
+	    if (add_range(a, ranges, p, size, tracenum, i) == 0)
 		return 0;
 	    
-	    /* ADDED: cgw
-	     * fill range with low byte of index.  This will be used later
-	     * if we realloc the block and wish to make sure that the old
-	     * data was copied to the new block
+	    /* 
+	     * Fill the block with its pattern, which is checked when the
+	     * block is reallocated or freed, to make sure that realloc
+	     * copied the old data and nothing else wrote into the block
 	     */
-	    memset(p, index & 0xFF, size);
+	    pat_fill(p, 0, size, index);
 
 	    /* Remember region */
 	    trace->blocks[index] = p;
 	    trace->block_sizes[index] = size;
 	    break;
 
-        case REALLOC: /* mm_realloc */
+        case REALLOC: /* realloc */
 	    
-	    /* Call the student's realloc */
+	    /* Make sure that the old block is intact */
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp, size)) == NULL) {
-		malloc_error(tracenum, i, "mm_realloc failed.");
+	    oldsize = trace->block_sizes[index];
+	    if ((bad = pat_check(oldp, oldsize, index)) < oldsize) {
+		sprintf(msg, "block %d was overwritten at byte %zu before "
+			"realloc", index, bad);
+		malloc_error(tracenum, i, msg);
+		return 0;
+	    }
+
+	    /* Call the allocator's realloc */
+	    if ((newp = a->realloc(oldp, size)) == NULL) {
+		malloc_error(tracenum, i, "realloc failed.");
 		return 0;
 	    }
 	    
@@ -650,50 +1280,77 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    remove_range(ranges, oldp);
 	    
 	    /* Check new block for correctness and add it to range list */
-	    if (add_range(ranges, newp, size, tracenum, i) == 0)
+	    if (add_range(a, ranges, newp, size, tracenum, i) == 0)
 		return 0;
 	    
-	    /* ADDED: cgw
+	    /* 
 	     * Make sure that the new block contains the data from the old 
-	     * block and then fill in the new block with the low order byte
-	     * of the new index
+	     * block, which is already the start of its pattern, and then
+	     * fill in the rest
 	     */
-	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
-	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
-		malloc_error(tracenum, i, "mm_realloc did not preserve the "
-			     "data from old block");
+	    if ((bad = pat_check(newp, oldsize, index)) < oldsize) {
+		sprintf(msg, "realloc did not preserve the data from old "
+			"block (byte %zu)", bad);
+		malloc_error(tracenum, i, msg);
 		return 0;
-	      }
 	    }
-	    memset(newp, index & 0xFF, size);
+	    pat_fill(newp, oldsize, size, index);
 
 	    /* Remember region */
 	    trace->blocks[index] = newp;
 	    trace->block_sizes[index] = size;
 	    break;
 
-        case FREE: /* mm_free */
+        case FREE: /* free */
 	    
-	    /* Remove region from list and call student's free function */
+	    /* Make sure that the block, or with -w every block, is intact */
 	    p = trace->blocks[index];
+	    size = trace->block_sizes[index];
+	    if (sweep) {
+		if (!sweep_blocks(trace, tracenum, i))
+		    return 0;
+	    }
+	    else if ((bad = pat_check(p, size, index)) < size) {
+		sprintf(msg, "block %d was overwritten at byte %zu before it "
+			"was freed", index, bad);
+		malloc_error(tracenum, i, msg);
+		return 0;
+	    }
+
+	    /* Remove region from list and call the allocator's free */
 	    remove_range(ranges, p);
-	    mm_free(p);
+	    a->free(p);
+	    trace->blocks[index] = NULL;
+	    break;
+
+	case SCOPE_BEGIN: /* scopes matter only to eval_arena */
+	case SCOPE_END:
 	    break;
 
 	default:
-	    app_error("Nonexistent request type in eval_mm_valid");
+	    app_error("Nonexistent request type in eval_valid");
         }
 
+	/* Optionally have the allocator check its own heap (-k) */
+	if (heapcheck && a->check != NULL && !a->check()) {
+	    malloc_error(tracenum, i, "heap check failed.");
+	    return 0;
+	}
     }
 
+    /* With -w, make sure that the blocks the trace leaves are intact */
+    if (sweep && !sweep_blocks(trace, tracenum, trace->num_ops - 1))
+	return 0;
+    release_blocks(a, trace);
+
     /* As far as we know, this is a valid malloc package */
     return 1;
 }
 
 /* 
- * eval_mm_util - Evaluate the space utilization of the student's package
+ * eval_util - Evaluate the space utilization of an allocator whose heap
+ *   comes from mem_sbrk.
  *   The idea is to remember the high water mark "hwm" of the heap for 
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the 
@@ -701,9 +1358,15 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   package on the trace. Note that our implementation of mem_sbrk() 
  *   doesn't allow the students to decrement the brk pointer, so brk
  *   is always the high water mark of the heap. 
- *   
+ *
+ *   Along the way it averages the payload over the heap size op by op,
+ *   notes when the heap last grew, and with -s samples the heap to
+ *   measure its external fragmentation. At the end it notes how much of
+ *   the heap is resident, which is less than its size if the allocator
+ *   gave free pages back with mem_purge.
  */
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
+static void eval_util(allocator_t *a, trace_t *trace, int tracenum, 
+		      range_t **ranges, stats_t *stats)
 {   
     int i;
     int index;
@@ -712,21 +1375,45 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
     int total_size = 0;
     char *p;
     char *newp, *oldp;
-
-    /* initialize the heap and the mm malloc package */
+    alloc_stats_t st;
+    size_t heapsize, last_heapsize;
+    int last_growth = 0;   /* ops done when the heap last grew */
+    int last_sample = 0;   /* ops done when the heap was last sampled */
+    double util_sum = 0;   /* of payload/heap size after each op */
+    double frag, frag_sum = 0;
+    int nfrags = 0;
+    double ifrag, ifrag_sum = 0; /* internal fragmentation of the samples */
+    int nifrags = 0;
+    double moved = 0;      /* payload bytes reallocs moved */
+    size_t remap_start;    /* mem_remapped() before the trace */
+    size_t purge_start;    /* mem_purged() before the trace */
+
+    /* initialize the heap and the allocator, giving back the pages
+       earlier runs touched, so that what is resident of the heap from
+       here on is this run's doing */
+    mem_purge(mem_heap_lo(), MAX_HEAP);
     mem_reset_brk();
-    if (mm_init() < 0)
-	app_error("mm_init failed in eval_mm_util");
+    rss_base = 0;
+    rss_base = heap_rss();
+    if (a->init() < 0)
+	app_error("init failed in eval_util");
+    remap_start = mem_remapped();
+    purge_start = mem_purged();
+    last_heapsize = mem_heapsize();
+    if (sampling && (frag = sample_heap(a, tracenum, 0, 0, &ifrag)) >= 0) {
+	frag_sum += frag;
+	nfrags++;
+    }
 
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
 
-        case ALLOC: /* mm_alloc */
+        case ALLOC: /* malloc */
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
-		app_error("mm_malloc failed in eval_mm_util");
+	    if ((p = a->malloc(size)) == NULL) 
+		app_error("malloc failed in eval_util");
 	    
 	    /* Remember region and size */
 	    trace->blocks[index] = p;
@@ -741,14 +1428,16 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 		total_size : max_total_size;
 	    break;
 
-	case REALLOC: /* mm_realloc */
+	case REALLOC: /* realloc */
 	    index = trace->ops[i].index;
 	    newsize = trace->ops[i].size;
 	    oldsize = trace->block_sizes[index];
 
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp,newsize)) == NULL)
-		app_error("mm_realloc failed in eval_mm_util");
+	    if ((newp = a->realloc(oldp,newsize)) == NULL)
+		app_error("realloc failed in eval_util");
+	    if (newp != oldp)
+		moved += (newsize < oldsize) ? newsize : oldsize;
 
 	    /* Remember region and size */
 	    trace->blocks[index] = newp;
@@ -763,12 +1452,12 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 		total_size : max_total_size;
 	    break;
 
-        case FREE: /* mm_free */
+        case FREE: /* free */
 	    index = trace->ops[i].index;
 	    size = trace->block_sizes[index];
 	    p = trace->blocks[index];
 	    
-	    mm_free(p);
+	    a->free(p);
 	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
@@ -776,146 +1465,669 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    break;
 
+	case SCOPE_BEGIN: /* scopes matter only to eval_arena */
+	case SCOPE_END:
+	    break;
+
 	default:
-	    app_error("Nonexistent request type in eval_mm_util");
+	    app_error("Nonexistent request type in eval_util");
 
         }
+
+	/* Sample the heap whenever it grows, and every sample_every ops */
+	heapsize = mem_heapsize();
+	if (heapsize > 0)
+	    util_sum += (double)total_size / heapsize;
+	if (heapsize != last_heapsize)
+	    last_growth = i + 1;
+	if (sampling && (heapsize != last_heapsize || 
+			 (sample_every > 0 && (i + 1) % sample_every == 0))) {
+	    if ((frag = sample_heap(a, tracenum, i + 1, total_size, 
+				    &ifrag)) >= 0) {
+		frag_sum += frag;
+		nfrags++;
+	    }
+	    if (ifrag >= 0) {
+		ifrag_sum += ifrag;
+		nifrags++;
+	    }
+	    last_sample = i + 1;
+	}
+	last_heapsize = heapsize;
+    }
+    if (sampling && last_sample < trace->num_ops && 
+	(frag = sample_heap(a, tracenum, trace->num_ops, total_size, 
+			    &ifrag)) >= 0) {
+	frag_sum += frag;
+	nfrags++;
+	if (ifrag >= 0) {
+	    ifrag_sum += ifrag;
+	    nifrags++;
+	}
+    }
+
+    /* Describe the heap the trace left behind, if the allocator can */
+    if (verbose > 1 && a->stats != NULL) {
+	a->stats(&st);
+	printf("%s heap: %zu bytes, %zu free in %zu blocks, largest %zu, "
+	       "%zu dirty, %zu purged. ", a->name, st.heap_size, 
+	       st.free_bytes, st.free_blocks, st.largest_free, 
+	       st.dirty_bytes, st.purged_bytes);
+    }
+
+    stats->util = (double)max_total_size / (double)mem_heapsize();
+    stats->avg_util = trace->num_ops ? util_sum / trace->num_ops : 0;
+    stats->ext_frag = nfrags ? frag_sum / nfrags : -1;
+    stats->int_frag = nifrags ? ifrag_sum / nifrags : -1;
+    stats->last_growth = trace->num_ops ? 
+	(double)last_growth / trace->num_ops : 0;
+    stats->moved_bytes = moved;
+    stats->remap_bytes = mem_remapped() - remap_start;
+    stats->purge_bytes = mem_purged() - purge_start;
+    stats->heap_bytes = mem_heapsize();
+    stats->rss_bytes = heap_rss();
+}
+
+/*
+ * sample_heap - Write a sample of the heap after the first opnum ops of
+ *     a trace to the --series file, if any, and return the heap's external
+ *     fragmentation then: the fraction of its free bytes that lie outside
+ *     the largest free block. Returns -1 if the allocator has no stats hook.
+ *     Sets *int_frag to the internal fragmentation, the fraction of the
+ *     bytes in allocated blocks that are not payload, or to -1 if the
+ *     allocator has no stats hook or no block is allocated.
+ */
+static double sample_heap(allocator_t *a, int tracenum, int opnum, 
+			  int total_size, double *int_frag)
+{
+    alloc_stats_t st;
+    size_t used;
+
+    *int_frag = -1;
+
+    if (a->stats != NULL)
+	a->stats(&st);
+    if (series != NULL) {
+	fprintf(series, "%s,%d,%d,%d,%zu,%zu", a->name, tracenum, opnum, 
+		total_size, mem_heapsize(), heap_rss());
+	if (a->stats != NULL)
+	    fprintf(series, ",%zu,%zu,%zu,%zu\n", st.free_bytes, 
+		    st.largest_free, st.dirty_bytes, st.purged_bytes);
+	else
+	    fprintf(series, ",,,,\n");
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    if (a->stats == NULL)
+	return -1;
+    used = st.heap_size - st.free_bytes;
+    if (total_size > 0 && used >= (size_t)total_size)
+	*int_frag = 1.0 - (double)total_size / used;
+    if (st.free_bytes == 0)
+	return 0;
+    return 1.0 - (double)st.largest_free / st.free_bytes;
+}
+
+/*
+ * heap_rss - returns the number of bytes of the heap that are resident:
+ *     the driver's resident set, from /proc/self/statm, less rss_base.
+ *     Returns 0 if /proc/self/statm cannot be read.
+ */
+static size_t heap_rss(void)
+{
+    FILE *fp;
+    unsigned long pages, resident;
+    size_t bytes = 0;
+
+    if ((fp = fopen("/proc/self/statm", "r")) == NULL)
+	return 0;
+    if (fscanf(fp, "%lu %lu", &pages, &resident) == 2)
+	bytes = (size_t)resident * mem_pagesize();
+    fclose(fp);
+    return (bytes > rss_base) ? bytes - rss_base : 0;
 }
 
 
 /*
- * eval_mm_speed - This is the function that is used by fcyc()
- *    to measure the running time of the mm malloc package.
+ * eval_speed - This is the function that is used by fcyc()
+ *    to measure the running time of an allocator.
  */
-static void eval_mm_speed(void *ptr)
+static void eval_speed(void *ptr)
 {
     int i, index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
+    allocator_t *a = ((speed_t *)ptr)->alloc;
 
-    /* Reset the heap and initialize the mm package */
-    mem_reset_brk();
-    if (mm_init() < 0) 
-	app_error("mm_init failed in eval_mm_speed");
+    /* Reset the heap and initialize the allocator */
+    if (a->flags & ALLOC_MEMLIB)
+	mem_reset_brk();
+    if (a->init() < 0) 
+	app_error("init failed in eval_speed");
 
     /* Interpret each trace request */
     for (i = 0;  i < trace->num_ops;  i++)
         switch (trace->ops[i].type) {
 
-        case ALLOC: /* mm_malloc */
+        case ALLOC: /* malloc */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
-		app_error("mm_malloc error in eval_mm_speed");
+            if ((p = a->malloc(size)) == NULL)
+		app_error("malloc error in eval_speed");
             trace->blocks[index] = p;
             break;
 
-	case REALLOC: /* mm_realloc */
+	case REALLOC: /* realloc */
 	    index = trace->ops[i].index;
             newsize = trace->ops[i].size;
 	    oldp = trace->blocks[index];
-            if ((newp = mm_realloc(oldp,newsize)) == NULL)
-		app_error("mm_realloc error in eval_mm_speed");
+            if ((newp = a->realloc(oldp,newsize)) == NULL)
+		app_error("realloc error in eval_speed");
             trace->blocks[index] = newp;
             break;
 
-        case FREE: /* mm_free */
+        case FREE: /* free */
             index = trace->ops[i].index;
             block = trace->blocks[index];
-            mm_free(block);
+            a->free(block);
+            trace->blocks[index] = NULL;
             break;
 
+	case SCOPE_BEGIN: /* scopes matter only to eval_arena */
+	case SCOPE_END:
+	    break;
+
 	default:
-	    app_error("Nonexistent request type in eval_mm_valid");
+	    app_error("Nonexistent request type in eval_speed");
         }
+
+    release_blocks(a, trace);
 }
 
 /*
- * eval_libc_valid - We run this function to make sure that the
- *    libc malloc can run to completion on the set of traces.
- *    We'll be conservative and terminate if any libc malloc call fails.
- *
+ * eval_latency - Run the trace once more, timing each malloc, free,
+ *    and realloc call on its own and recording the times, less the
+ *    cost ovhd of taking the timestamps, in a histogram per op type.
  */
-static int eval_libc_valid(trace_t *trace, int tracenum)
+static void eval_latency(allocator_t *a, trace_t *trace, lathist_t *hists, 
+			 uint64_t ovhd)
 {
-    int i, newsize;
-    char *p, *newp, *oldp;
+    int i, index, size;
+    char *p, *oldp;
+    uint64_t t0, t1;
+
+    for (i = 0; i < 3; i++)
+	lat_reset(&hists[i]);
+
+    /* Reset the heap and initialize the allocator */
+    if (a->flags & ALLOC_MEMLIB)
+	mem_reset_brk();
+    if (a->init() < 0) 
+	app_error("init failed in eval_latency");
 
     for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
 
+        switch (trace->ops[i].type) {
         case ALLOC: /* malloc */
-	    if ((p = malloc(trace->ops[i].size)) == NULL) {
-		malloc_error(tracenum, i, "libc malloc failed");
-		unix_error("System message");
-	    }
-	    trace->blocks[trace->ops[i].index] = p;
+	    t0 = lat_now();
+	    p = a->malloc(size);
+	    t1 = lat_now();
+	    if (p == NULL)
+		app_error("malloc error in eval_latency");
+	    trace->blocks[index] = p;
 	    break;
 
 	case REALLOC: /* realloc */
-            newsize = trace->ops[i].size;
-	    oldp = trace->blocks[trace->ops[i].index];
-	    if ((newp = realloc(oldp, newsize)) == NULL) {
-		malloc_error(tracenum, i, "libc realloc failed");
-		unix_error("System message");
-	    }
-	    trace->blocks[trace->ops[i].index] = newp;
+	    oldp = trace->blocks[index];
+	    t0 = lat_now();
+	    p = a->realloc(oldp, size);
+	    t1 = lat_now();
+	    if (p == NULL)
+		app_error("realloc error in eval_latency");
+	    trace->blocks[index] = p;
 	    break;
-	    
+
         case FREE: /* free */
-	    free(trace->blocks[trace->ops[i].index]);
+	    p = trace->blocks[index];
+	    t0 = lat_now();
+	    a->free(p);
+	    t1 = lat_now();
+	    trace->blocks[index] = NULL;
 	    break;
 
+	case SCOPE_BEGIN: /* nothing to time */
+	case SCOPE_END:
+	    continue;
+
 	default:
-	    app_error("invalid operation type  in eval_libc_valid");
+	    app_error("Nonexistent request type in eval_latency");
 	}
+
+	t1 -= t0;
+	lat_record(&hists[trace->ops[i].type], (t1 > ovhd) ? t1 - ovhd : 0);
     }
 
+    release_blocks(a, trace);
+}
+
+/*
+ * eval_counters - Count hardware events over PMC_RUNS runs of
+ *     eval_speed, and average them per run
+ */
+static void eval_counters(speed_t *speed, pmc_counts_t *c)
+{
+    int i, k;
+
+    pmc_start();
+    for (k = 0; k < PMC_RUNS; k++)
+	eval_speed(speed);
+    pmc_stop(c);
+    for (i = 0; i < PMC_NUM; i++)
+	c->count[i] /= PMC_RUNS;
+}
+
+/*
+ * eval_scaling - Replay a multi-threaded trace against a thread-safe
+ *     allocator, first once with every block checked, and then timed on
+ *     1, 2, 4, ... up to maxcpus cores, and print the throughput on each
+ *     and its speedup over one core
+ */
+static void eval_scaling(allocator_t *a, trace_t *trace, int tracenum,
+			 int maxcpus)
+{
+    mt_plan_t *plan;
+    char mtmsg[MT_MSGLEN];
+    double secs, best, kops, base = 0;
+    int ncpus, k;
+
+    if ((plan = mt_plan(trace->ops, trace->num_ops, trace->num_ids)) == NULL)
+	unix_error("mt_plan failed in eval_scaling");
+
+    if (mt_replay(plan, a, maxcpus, 1, mtmsg) < 0) {
+	errors++;
+	printf("ERROR [trace %d, multi-threaded]: %s\n", tracenum, mtmsg);
+	mt_free_plan(plan);
+	return;
+    }
+
+    printf("Multi-threaded replay of trace %d (%d threads) by %s malloc:\n",
+	   tracenum, mt_threads(plan), a->name);
+    printf("%5s%10s%9s\n", "cpus", "Kops", "speedup");
+    for (ncpus = 1; ; ncpus = MIN(2*ncpus, maxcpus)) {
+	best = DBL_MAX;
+	for (k = 0; k < MT_RUNS; k++) {
+	    if ((secs = mt_replay(plan, a, ncpus, 0, mtmsg)) < 0) {
+		errors++;
+		printf("ERROR [trace %d, multi-threaded]: %s\n", tracenum, 
+		       mtmsg);
+		mt_free_plan(plan);
+		return;
+	    }
+	    best = MIN(best, secs);
+	}
+	kops = (trace->num_ops/1e3)/best;
+	if (ncpus == 1)
+	    base = kops;
+	printf("%5d%10.0f%8.2fx\n", ncpus, kops, kops/base);
+	if (ncpus == maxcpus)
+	    break;
+    }
+    printf("\n");
+    mt_free_plan(plan);
+}
+
+/*
+ * eval_arena - Check an allocator that has arenas against a trace that
+ *     marks scopes, replaying it with the blocks of each scope allocated
+ *     from an arena of the scope's thread. Freeing such a block does
+ *     nothing until the scope ends and the arena is reset, and realloc
+ *     copies it to a new block of the arena. If the allocator's heap
+ *     comes from mem_sbrk, also measures the space utilization.
+ */
+static int eval_arena(allocator_t *a, trace_t *trace, int tracenum, 
+		      range_t **ranges, stats_t *stats)
+{
+    int i, t;
+    int index, size, oldsize, scope;
+    int total_size = 0, max_total_size = 0;
+    size_t bad;
+    char *p, *oldp;
+    struct mm_arena **arenas = trace->arenas;
+
+    /* Reset the heap and free any records in the range list */
+    if (a->flags & ALLOC_MEMLIB)
+	mem_reset_brk();
+    clear_ranges(ranges);
+    memset(trace->blocks, 0, trace->num_ids * sizeof(char *));
+    memset(arenas, 0, trace->num_threads * sizeof(struct mm_arena *));
+
+    if (a->init() < 0) {
+	malloc_error(tracenum, 0, "init failed.");
+	return 0;
+    }
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	scope = trace->scope[i];
+	t = trace->ops[i].thread;
+
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* malloc, from the scope's arena if in one */
+	    if (scope)
+		p = a->arena_malloc(arenas[scope - 1], size);
+	    else
+		p = a->malloc(size);
+	    if (p == NULL) {
+		malloc_error(tracenum, i, "malloc failed.");
+		return 0;
+	    }
+	    if (add_range(a, ranges, p, size, tracenum, i) == 0)
+		return 0;
+	    pat_fill(p, 0, size, index);
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    total_size += size;
+	    break;
+
+        case REALLOC: /* realloc, or a copy to a new block of the arena */
+	    oldp = trace->blocks[index];
+	    oldsize = trace->block_sizes[index];
+	    if ((bad = pat_check(oldp, oldsize, index)) < oldsize) {
+		sprintf(msg, "block %d was overwritten at byte %zu before "
+			"realloc", index, bad);
+		malloc_error(tracenum, i, msg);
+		return 0;
+	    }
+	    if (scope) {
+		if ((p = a->arena_malloc(arenas[scope - 1], size)) != NULL)
+		    memcpy(p, oldp, MIN(size, oldsize));
+	    }
+	    else
+		p = a->realloc(oldp, size);
+	    if (p == NULL) {
+		malloc_error(tracenum, i, "realloc failed.");
+		return 0;
+	    }
+	    remove_range(ranges, oldp);
+	    if (add_range(a, ranges, p, size, tracenum, i) == 0)
+		return 0;
+	    total_size += size - oldsize;
+	    if (size < oldsize) oldsize = size;
+	    if ((bad = pat_check(p, oldsize, index)) < oldsize) {
+		sprintf(msg, "realloc did not preserve the data from old "
+			"block (byte %zu)", bad);
+		malloc_error(tracenum, i, msg);
+		return 0;
+	    }
+	    pat_fill(p, oldsize, size, index);
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+
+        case FREE: /* free, unless the arena frees it at the scope's end */
+	    p = trace->blocks[index];
+	    size = trace->block_sizes[index];
+	    if ((bad = pat_check(p, size, index)) < size) {
+		sprintf(msg, "block %d was overwritten at byte %zu before it "
+			"was freed", index, bad);
+		malloc_error(tracenum, i, msg);
+		return 0;
+	    }
+	    remove_range(ranges, p);
+	    if (!scope)
+		a->free(p);
+	    trace->blocks[index] = NULL;
+	    total_size -= size;
+	    break;
+
+	case SCOPE_BEGIN: /* each thread's scopes reuse one arena */
+	    if (arenas[t] == NULL && (arenas[t] = a->arena_create()) == NULL) {
+		malloc_error(tracenum, i, "arena_create failed.");
+		return 0;
+	    }
+	    break;
+
+	case SCOPE_END:
+	    a->arena_reset(arenas[t]);
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in eval_arena");
+        }
+	max_total_size = (total_size > max_total_size) ?
+	    total_size : max_total_size;
+
+	/* Optionally have the allocator check its own heap (-k) */
+	if (heapcheck && a->check != NULL && !a->check()) {
+	    malloc_error(tracenum, i, "heap check failed.");
+	    return 0;
+	}
+    }
+
+    for (t = 0; t < trace->num_threads; t++)
+	if (arenas[t] != NULL)
+	    a->arena_destroy(arenas[t]);
+    release_blocks(a, trace);
+
+    if (a->flags & ALLOC_MEMLIB)
+	stats->arena_util = (double)max_total_size / mem_heapsize();
     return 1;
 }
 
-/* 
- * eval_libc_speed - This is the function that is used by fcyc() to
- *    measure the running time of the libc malloc package on the set
- *    of traces.
+/*
+ * eval_arena_speed - The replay of eval_arena, without the checks, for
+ *     fsecs to time
  */
-static void eval_libc_speed(void *ptr)
+static void eval_arena_speed(void *ptr)
 {
-    int i;
-    int index, size, newsize;
-    char *p, *newp, *oldp, *block;
+    int i, t, index, size, scope;
+    char *p, *oldp;
     trace_t *trace = ((speed_t *)ptr)->trace;
+    allocator_t *a = ((speed_t *)ptr)->alloc;
+    struct mm_arena **arenas = trace->arenas;
+
+    /* Reset the heap and initialize the allocator */
+    if (a->flags & ALLOC_MEMLIB)
+	mem_reset_brk();
+    if (a->init() < 0) 
+	app_error("init failed in eval_arena_speed");
+    memset(arenas, 0, trace->num_threads * sizeof(struct mm_arena *));
 
+    /* Interpret each trace request */
     for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	scope = trace->scope[i];
+	t = trace->ops[i].thread;
+
         switch (trace->ops[i].type) {
+
         case ALLOC: /* malloc */
-	    index = trace->ops[i].index;
-	    size = trace->ops[i].size;
-	    if ((p = malloc(size)) == NULL)
-		unix_error("malloc failed in eval_libc_speed");
+	    if (scope)
+		p = a->arena_malloc(arenas[scope - 1], size);
+	    else
+		p = a->malloc(size);
+	    if (p == NULL)
+		app_error("malloc error in eval_arena_speed");
 	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
 	    break;
 
 	case REALLOC: /* realloc */
-	    index = trace->ops[i].index;
-	    newsize = trace->ops[i].size;
 	    oldp = trace->blocks[index];
-	    if ((newp = realloc(oldp, newsize)) == NULL)
-		unix_error("realloc failed in eval_libc_speed\n");
-	    
-	    trace->blocks[index] = newp;
+	    if (scope) {
+		if ((p = a->arena_malloc(arenas[scope - 1], size)) != NULL)
+		    memcpy(p, oldp, MIN(size, trace->block_sizes[index]));
+	    }
+	    else
+		p = a->realloc(oldp, size);
+	    if (p == NULL)
+		app_error("realloc error in eval_arena_speed");
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
 	    break;
-	    
+
         case FREE: /* free */
-	    index = trace->ops[i].index;
-	    block = trace->blocks[index];
-	    free(block);
+	    if (!scope)
+		a->free(trace->blocks[index]);
+	    trace->blocks[index] = NULL;
+	    break;
+
+	case SCOPE_BEGIN:
+	    if (arenas[t] == NULL && (arenas[t] = a->arena_create()) == NULL)
+		app_error("arena_create error in eval_arena_speed");
+	    break;
+
+	case SCOPE_END:
+	    a->arena_reset(arenas[t]);
 	    break;
+
+	default:
+	    app_error("Nonexistent request type in eval_arena_speed");
+        }
+    }
+
+    for (t = 0; t < trace->num_threads; t++)
+	if (arenas[t] != NULL)
+	    a->arena_destroy(arenas[t]);
+    release_blocks(a, trace);
+}
+
+/*
+ * release_blocks - Free the blocks a trace left allocated, unless the
+ *     allocator's heap is simply emptied before the next run. The
+ *     eval_ routines clear the block pointers they free, so that this
+ *     can tell which blocks are still live.
+ */
+static void release_blocks(allocator_t *a, trace_t *trace)
+{
+    int i;
+
+    if (a->flags & ALLOC_MEMLIB)
+	return;
+    for (i = 0; i < trace->num_ids; i++) {
+	if (trace->blocks[i] != NULL) {
+	    a->free(trace->blocks[i]);
+	    trace->blocks[i] = NULL;
+	}
+    }
+}
+
+/*
+ * sweep_blocks - Check that every live block of a trace still holds its
+ *     pattern, and blame the first one that does not on op opnum
+ */
+static int sweep_blocks(trace_t *trace, int tracenum, int opnum)
+{
+    int i;
+    size_t bad;
+
+    for (i = 0; i < trace->num_ids; i++) {
+	if (trace->blocks[i] == NULL)
+	    continue;
+	bad = pat_check(trace->blocks[i], trace->block_sizes[i], i);
+	if (bad < trace->block_sizes[i]) {
+	    sprintf(msg, "block %d was overwritten at byte %zu", i, bad);
+	    malloc_error(tracenum, opnum, msg);
+	    return 0;
 	}
     }
+    return 1;
+}
+
+/*
+ * libc_init - libc malloc needs no initialization
+ */
+static int libc_init(void)
+{
+    return 0;
+}
+
+/*
+ * null_init - Start the null allocator's blocks over from the bottom
+ */
+static int null_init(void)
+{
+    null_brk = (char *)ALIGNMENT;
+    return 0;
+}
+
+/*
+ * null_malloc - Bump the null allocator's break past the block
+ */
+static void *null_malloc(size_t size)
+{
+    char *p = null_brk;
+
+    null_brk += (size + ALIGNMENT-1) & ~(size_t)(ALIGNMENT-1);
+    return p;
+}
+
+/*
+ * null_free - The null allocator never reuses a block
+ */
+static void null_free(void *ptr)
+{
+}
+
+/*
+ * null_realloc - A new block, without copying the old one
+ */
+static void *null_realloc(void *ptr, size_t size)
+{
+    return null_malloc(size);
+}
+
+/*
+ * load_backend - Load the allocator defined by the shared object at path
+ */
+static allocator_t *load_backend(char *path)
+{
+    void *handle;
+    allocator_t *a;
+    char file[MAXLINE], *name, *dot;
+
+    /* dlopen would search the library path for a bare file name */
+    snprintf(file, sizeof(file), "%s%s", strchr(path, '/') ? "" : "./", 
+	     path);
+    if ((handle = dlopen(file, RTLD_NOW | RTLD_LOCAL)) == NULL) {
+	snprintf(msg, sizeof(msg), "Could not load %s: %s", path, dlerror());
+	app_error(msg);
+    }
+    if ((a = (allocator_t *)dlsym(handle, ALLOCATOR_SYM)) == NULL) {
+	snprintf(msg, sizeof(msg), "%s does not define %s", path, 
+		 ALLOCATOR_SYM);
+	app_error(msg);
+    }
+
+    /* 
+     * The driver exports its symbols, so a weak hook that the package
+     * does not define is bound to the driver's own mm package's instead;
+     * the package has no such hook
+     */
+    if (a->check == mm_allocator.check)
+	a->check = NULL;
+    if (a->stats == mm_allocator.stats)
+	a->stats = NULL;
+    if (a->arena_create == mm_allocator.arena_create) {
+	a->arena_create = NULL;
+	a->arena_malloc = NULL;
+	a->arena_reset = NULL;
+	a->arena_destroy = NULL;
+    }
+
+    /* Name an unnamed allocator after its file, less the extension */
+    if (a->name == NULL) {
+	name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+	if ((a->name = strdup(name)) == NULL)
+	    unix_error("strdup failed in load_backend");
+	if ((dot = strrchr(a->name, '.')) != NULL)
+	    *dot = '\0';
+    }
+    return a;
 }
 
 /*************************************
@@ -923,6 +2135,23 @@ static void eval_libc_speed(void *ptr)
  ************************************/
 
 
+/*
+ * getspread - record how noisy the measurement of stats->secs was, and
+ *     show it when asked
+ */
+static void getspread(stats_t *stats)
+{
+    long runs;
+
+    fsecs_spread(stats->secs, &stats->mad, &stats->ci_lo, &stats->ci_hi,
+		 &runs);
+    if (verbose > 1)
+	printf("Median %.3f usecs over %ld runs, MAD %.3f, "
+	       "95%% CI [%.3f, %.3f]\n", 
+	       stats->secs*1e6, runs, stats->mad*1e6,
+	       stats->ci_lo*1e6, stats->ci_hi*1e6);
+}
+
 /*
  * printresults - prints a performance summary for some malloc package
  */
@@ -934,17 +2163,25 @@ static void printresults(int n, stats_t *stats)
     double util = 0;
 
     /* Print the individual results for each trace */
-    printf("%5s%7s %5s%8s%10s%6s\n", 
-	   "trace", " valid", "util", "ops", "secs", "Kops");
+    printf("%5s%7s %5s%8s%10s%6s%7s%s\n", 
+	   "trace", " valid", "util", "ops", "secs", "Kops", "mad",
+	   calibrate ? "  net Kops" : "");
     for (i=0; i < n; i++) {
 	if (stats[i].valid) {
-	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f%6.1f%%", 
 		   i,
 		   "yes",
 		   stats[i].util*100.0,
 		   stats[i].ops,
 		   stats[i].secs,
-		   (stats[i].ops/1e3)/stats[i].secs);
+		   (stats[i].ops/1e3)/stats[i].secs,
+		   stats[i].mad*100.0/stats[i].secs);
+	    if (calibrate && stats[i].secs > stats[i].driver_secs)
+		printf("%10.0f", 
+		       (stats[i].ops/1e3)/(stats[i].secs - stats[i].driver_secs));
+	    else if (calibrate)
+		printf("%10s", "-");
+	    printf("\n");
 	    secs += stats[i].secs;
 	    ops += stats[i].ops;
 	    util += stats[i].util;
@@ -980,6 +2217,205 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printfootprint - prints how the heap of some malloc package evolved
+ *     over each trace
+ */
+static void printfootprint(char *name, int n, stats_t *stats)
+{
+    int i;
+
+    printf("Heap footprint of %s malloc:\n", name);
+    printf("%5s%7s%10s%10s%10s%13s%12s%10s%11s%9s%8s\n", 
+	   "trace", "util", "avg util", "int frag", "ext frag", "last growth",
+	   "moved KB", "remap KB", "purged KB", "heap KB", "RSS KB");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%2d%10s%10s%10s%10s%13s%12s%10s%11s%9s%8s\n", 
+		   i, "-", "-", "-", "-", "-", "-", "-", "-", "-", "-");
+	    continue;
+	}
+	printf("%2d%9.0f%%%9.0f%%", i, 
+	       stats[i].util*100.0, stats[i].avg_util*100.0);
+	if (stats[i].int_frag >= 0)
+	    printf("%9.1f%%", stats[i].int_frag*100.0);
+	else
+	    printf("%10s", "-");
+	if (stats[i].ext_frag >= 0)
+	    printf("%9.1f%%", stats[i].ext_frag*100.0);
+	else
+	    printf("%10s", "-");
+	printf("%12.0f%%", stats[i].last_growth*100.0);
+	printf("%12.0f%10.0f%11.0f%9.0f%8.0f\n", 
+	       stats[i].moved_bytes/1024, stats[i].remap_bytes/1024,
+	       stats[i].purge_bytes/1024, stats[i].heap_bytes/1024, 
+	       stats[i].rss_bytes/1024);
+    }
+}
+
+/*
+ * printarena - prints the throughput and space utilization of the
+ *     allocator on each trace with scopes, with each object freed on
+ *     its own and with the blocks of each scope in an arena (-A)
+ */
+static void printarena(char *name, int n, stats_t *stats)
+{
+    int i;
+
+    printf("Arena-scoped replays of %s malloc:\n", name);
+    printf("%5s%12s%12s%10s%12s\n", 
+	   "trace", "Kops", "arena Kops", "util", "arena util");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid || stats[i].arena_secs <= 0)
+	    continue;
+	printf("%2d%13.0f%12.0f%9.0f%%%11.0f%%\n", i, 
+	       (stats[i].ops/1e3)/stats[i].secs,
+	       (stats[i].ops/1e3)/stats[i].arena_secs,
+	       stats[i].util*100.0, stats[i].arena_util*100.0);
+    }
+}
+
+/*
+ * paged - did the allocator move any realloc'd block by remapping pages,
+ *     or give any free pages back?
+ */
+static int paged(int n, stats_t *stats)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+	if (stats[i].valid && 
+	    (stats[i].remap_bytes > 0 || stats[i].purge_bytes > 0))
+	    return 1;
+    return 0;
+}
+
+/*
+ * printcompare - prints the throughput and space utilization of each
+ *     allocator on each trace side by side
+ */
+static void printcompare(int n, backend_t *backends, int nbackends)
+{
+    int i, b, all_valid;
+    double secs, ops, util;
+    stats_t *st;
+
+    printf("Kops and util of each allocator:\n%5s", "trace");
+    for (b = 0; b < nbackends; b++)
+	printf("%17.16s", backends[b].alloc->name);
+    printf("\n");
+    for (i = 0; i < n; i++) {
+	printf("%2d   ", i);
+	for (b = 0; b < nbackends; b++) {
+	    st = &backends[b].stats[i];
+	    if (!st->valid)
+		printf("%17s", "-");
+	    else if (backends[b].alloc->flags & ALLOC_MEMLIB)
+		printf("%11.0f%5.0f%%", (st->ops/1e3)/st->secs, st->util*100);
+	    else
+		printf("%11.0f%6s", (st->ops/1e3)/st->secs, "-");
+	}
+	printf("\n");
+    }
+
+    /* Totals, for the allocators that ran every trace */
+    printf("%-5s", "Total");
+    for (b = 0; b < nbackends; b++) {
+	secs = ops = util = 0;
+	all_valid = 1;
+	for (i = 0; i < n; i++) {
+	    st = &backends[b].stats[i];
+	    all_valid &= st->valid;
+	    secs += st->secs;
+	    ops += st->ops;
+	    util += st->util;
+	}
+	if (!all_valid)
+	    printf("%17s", "-");
+	else if (backends[b].alloc->flags & ALLOC_MEMLIB)
+	    printf("%11.0f%5.0f%%", (ops/1e3)/secs, (util/n)*100);
+	else
+	    printf("%11.0f%6s", (ops/1e3)/secs, "-");
+    }
+    printf("\n");
+}
+
+/*
+ * printlatency - prints latency percentiles for each op type of a trace
+ */
+static void printlatency(char *name, int tracenum, lathist_t *hists, 
+			 uint64_t ovhd, double ticks_per_ns)
+{
+    static char *names[] = {[ALLOC] = "malloc", [FREE] = "free",
+			    [REALLOC] = "realloc"};
+    static double pcts[] = {0.50, 0.90, 0.99, 0.999};
+    int i, j;
+
+    printf("\nLatency of %s for trace %d "
+	   "(ns, %llu-tick timer overhead subtracted):\n",
+	   name, tracenum, (unsigned long long)ovhd);
+    printf("%-8s%10s%9s%9s%9s%9s%9s\n", 
+	   "op", "count", "p50", "p90", "p99", "p99.9", "max");
+    for (i = 0; i < 3; i++) {
+	if (hists[i].count == 0)
+	    continue;
+	printf("%-8s%10llu", names[i], (unsigned long long)hists[i].count);
+	for (j = 0; j < 4; j++)
+	    printf("%9.0f", lat_percentile(&hists[i], pcts[j]) / ticks_per_ns);
+	printf("%9.0f\n", hists[i].max / ticks_per_ns);
+    }
+}
+
+/*
+ * printcounters - prints the hardware counters of each trace per 1000
+ *     ops, with the instructions per cycle, and with -V per run
+ */
+static void printcounters(char *name, int n, stats_t *stats)
+{
+    int i, j;
+    pmc_counts_t *c;
+
+    printf("Hardware counters of %s per 1000 ops:\n", name);
+    printf("%5s", "trace");
+    for (j = 0; j < PMC_NUM; j++)
+	printf("%10s", pmc_name(j));
+    printf("%6s\n", "IPC");
+    for (i = 0; i < n; i++) {
+	c = &stats[i].pmc;
+	printf("%2d   ", i);
+	for (j = 0; j < PMC_NUM; j++) {
+	    if (stats[i].valid && c->valid[j])
+		printf("%10.1f", c->count[j] * 1e3 / stats[i].ops);
+	    else
+		printf("%10s", "-");
+	}
+	if (stats[i].valid && c->valid[PMC_CYCLES] && c->valid[PMC_INSTRS] &&
+	    c->count[PMC_CYCLES] > 0)
+	    printf("%6.2f\n", c->count[PMC_INSTRS] / c->count[PMC_CYCLES]);
+	else
+	    printf("%6s\n", "-");
+    }
+
+    if (verbose > 1) {
+	printf("\nHardware counters of %s per run of each trace:\n", name);
+	printf("%5s", "trace");
+	for (j = 0; j < PMC_NUM; j++)
+	    printf("%12s", pmc_name(j));
+	printf("\n");
+	for (i = 0; i < n; i++) {
+	    c = &stats[i].pmc;
+	    printf("%2d   ", i);
+	    for (j = 0; j < PMC_NUM; j++) {
+		if (stats[i].valid && c->valid[j])
+		    printf("%12.0f", c->count[j]);
+		else
+		    printf("%12s", "-");
+	    }
+	    printf("\n");
+	}
+    }
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -1012,14 +2448,43 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValLcknwA] [-f <file>] [-t <dir>] "
+	    "[-b <file>] [-s <n>] [-p <n>]\n"
+	    "               [--json <file>] [--csv <file>] "
+	    "[--compare <file>]\n"
+	    "               [--series <file>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-A         Replay traces with scopes with each scope's "
+	    "blocks in an\n\t           arena as well, for allocators "
+	    "that have arenas.\n");
+    fprintf(stderr, "\t-b <file>  Run the allocator in shared object <file> "
+	    "as well\n\t           (or libc malloc, if <file> is libc).\n");
+    fprintf(stderr, "\t-c         Print hardware performance counters.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-k         Have the allocator check its heap after "
+	    "every op.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-L         Print per-op latency percentiles.\n");
+    fprintf(stderr, "\t-n         Print throughput net of the driver's own "
+	    "overhead.\n");
+    fprintf(stderr, "\t-p <n>     Replay multi-threaded traces on 1, 2, 4, "
+	    "... <n> cores\n\t           (0 for all) against thread-safe "
+	    "allocators.\n");
+    fprintf(stderr, "\t-s <n>     Sample the heap each time it grows and "
+	    "every <n> ops\n\t           (0 for growth only), and print its "
+	    "footprint.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
+    fprintf(stderr, "\t-w         Verify every live block before each "
+	    "free and at the end.\n");
+    fprintf(stderr, "\t--json <file>     Write the results to <file> as JSON.\n");
+    fprintf(stderr, "\t--csv <file>      Write the results to <file> as CSV.\n");
+    fprintf(stderr, "\t--compare <file>  Compare with JSON results in <file>;\n"
+	    "\t                  exit with status 2 if anything regressed.\n");
+    fprintf(stderr, "\t--series <file>   Write the heap samples (-s) to "
+	    "<file> as CSV.\n");
 }
@@ -0,0 +1,192 @@
+/*
+ * memlib-sys.c - a version of memlib.c that hands out real memory, for
+ *     running mm.c as the system allocator (see mm-libc.c). 
+ *
+ *     A large range of address space is reserved up front so that the
+ *     heap stays contiguous, as mm.c requires, and pages are committed
+ *     as mem_sbrk grows the heap into it. Nothing here may call malloc,
+ *     since this code runs underneath it.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "memlib.h"
+
+/* Address space to reserve for the heap; halved until mmap succeeds */
+#define SYS_HEAP_RESERVE  ((size_t)1 << 30)  /* 1 GB */
+#define SYS_HEAP_MIN      ((size_t)1 << 24)  /* 16 MB */
+
+/* private variables */
+static char *mem_start_brk;  /* points to first byte of heap */
+static char *mem_brk;        /* points to last byte of heap */
+static char *mem_max_addr;   /* largest legal heap address */ 
+static char *mem_committed;  /* end of the pages made accessible so far */
+static size_t mem_remap_bytes; /* bytes moved by mem_remap so far */
+static size_t mem_purge_bytes; /* bytes given back by mem_purge so far */
+
+/* 
+ * mem_init - reserve the address space for the heap
+ */
+void mem_init(void)
+{
+    size_t reserve;
+    void *p = MAP_FAILED;
+
+    for (reserve = SYS_HEAP_RESERVE; reserve >= SYS_HEAP_MIN; reserve /= 2) {
+	p = mmap(NULL, reserve, PROT_NONE, 
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (p != MAP_FAILED)
+	    break;
+    }
+    if (p == MAP_FAILED) {
+	static const char msg[] = "mem_init: could not reserve the heap\n";
+	write(2, msg, sizeof(msg) - 1);
+	abort();
+    }
+
+    mem_start_brk = p;
+    mem_max_addr = mem_start_brk + reserve;  /* max legal heap address */
+    mem_brk = mem_start_brk;                 /* heap is empty initially */
+    mem_committed = mem_start_brk;
+}
+
+/* 
+ * mem_deinit - give the heap back to the system
+ */
+void mem_deinit(void)
+{
+    munmap(mem_start_brk, mem_max_addr - mem_start_brk);
+}
+
+/*
+ * mem_reset_brk - reset the brk pointer to make an empty heap, 
+ *     discarding the contents of the pages in use
+ */
+void mem_reset_brk()
+{
+    madvise(mem_start_brk, mem_committed - mem_start_brk, MADV_DONTNEED);
+    mem_brk = mem_start_brk;
+}
+
+/* 
+ * mem_sbrk - Extends the heap by incr bytes and returns the start 
+ *    address of the new area, committing pages as needed. The heap 
+ *    cannot be shrunk.
+ */
+void *mem_sbrk(int incr) 
+{
+    char *old_brk = mem_brk;
+    char *new_committed;
+    size_t pagesize = mem_pagesize();
+
+    if ((incr < 0) || (incr > mem_max_addr - mem_brk)) {
+	errno = ENOMEM;
+	return (void *)-1;
+    }
+    if (mem_brk + incr > mem_committed) {
+	new_committed = mem_start_brk + 
+	    ((mem_brk + incr - mem_start_brk + pagesize - 1) & ~(pagesize - 1));
+	if (mprotect(mem_committed, new_committed - mem_committed, 
+		     PROT_READ | PROT_WRITE) < 0) {
+	    errno = ENOMEM;
+	    return (void *)-1;
+	}
+	mem_committed = new_committed;
+    }
+    mem_brk += incr;
+    return (void *)old_brk;
+}
+
+/*
+ * mem_heap_lo - return address of the first heap byte
+ */
+void *mem_heap_lo()
+{
+    return (void *)mem_start_brk;
+}
+
+/* 
+ * mem_heap_hi - return address of last heap byte
+ */
+void *mem_heap_hi()
+{
+    return (void *)(mem_brk - 1);
+}
+
+/*
+ * mem_heapsize() - returns the heap size in bytes
+ */
+size_t mem_heapsize() 
+{
+    return (size_t)(mem_brk - mem_start_brk);
+}
+
+/*
+ * mem_pagesize() - returns the page size of the system
+ */
+size_t mem_pagesize()
+{
+    return (size_t)getpagesize();
+}
+
+/*
+ * mem_remap - move the len bytes of whole pages at src to dst, both in 
+ *    the heap and page-aligned, by remapping the pages rather than 
+ *    copying them. src is left with fresh zeroed pages. Returns 0, or 
+ *    -1 if the pages could not be moved, in which case nothing changed.
+ */
+int mem_remap(void *dst, void *src, size_t len)
+{
+    if (mremap(src, len, len, MREMAP_MAYMOVE | MREMAP_FIXED, dst) 
+	== MAP_FAILED)
+	return -1;
+    if (mmap(src, len, PROT_READ | PROT_WRITE, 
+	     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0)
+	== MAP_FAILED) {
+	static const char msg[] = "mem_remap: could not refill the pages\n";
+	write(2, msg, sizeof(msg) - 1);
+	abort();
+    }
+    mem_remap_bytes += len;
+    return 0;
+}
+
+/*
+ * mem_remapped - returns the number of bytes mem_remap has moved
+ */
+size_t mem_remapped()
+{
+    return mem_remap_bytes;
+}
+
+/*
+ * mem_purge - give the physical memory of the len bytes of whole pages
+ *    at start, in the heap and page-aligned, back to the system. With
+ *    MADV_FREE the kernel takes them only when it runs short of memory,
+ *    so that a program that soon reuses them does not fault them back
+ *    in; their contents are undefined until they are written.
+ */
+void mem_purge(void *start, size_t len)
+{
+#ifdef MADV_FREE
+    if (madvise(start, len, MADV_FREE) == 0) {
+	mem_purge_bytes += len;
+	return;
+    }
+#endif
+    if (madvise(start, len, MADV_DONTNEED) == 0)
+	mem_purge_bytes += len;
+}
+
+/*
+ * mem_purged - returns the number of bytes mem_purge has given back
+ */
+size_t mem_purged()
+{
+    return mem_purge_bytes;
+}
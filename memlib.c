@@ -2,7 +2,12 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ *            The heap is mapped with mmap rather than malloc'd, so that
+ *            mem_remap can move whole pages of it with mremap, and
+ *            mem_purge can give them back with madvise.
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -18,6 +23,8 @@
 static char *mem_start_brk;  /* points to first byte of heap */
 static char *mem_brk;        /* points to last byte of heap */
 static char *mem_max_addr;   /* largest legal heap address */ 
+static size_t mem_remap_bytes; /* bytes moved by mem_remap so far */
+static size_t mem_purge_bytes; /* bytes given back by mem_purge so far */
 
 /* 
  * mem_init - initialize the memory system model
@@ -25,8 +32,10 @@ static char *mem_max_addr;   /* largest legal heap address */
 void mem_init(void)
 {
     /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-        fprintf(stderr, "mem_init_vm: malloc error\n");
+    mem_start_brk = mmap(NULL, MAX_HEAP, PROT_READ | PROT_WRITE, 
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem_start_brk == MAP_FAILED) {
+        fprintf(stderr, "mem_init_vm: mmap error\n");
         exit(1);
     }
 
@@ -39,7 +48,7 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    munmap(mem_start_brk, MAX_HEAP);
 }
 
 /*
@@ -99,3 +108,53 @@ size_t mem_pagesize()
 {
     return (size_t)getpagesize();
 }
+
+/*
+ * mem_remap - move the len bytes of whole pages at src to dst, both in 
+ *    the heap and page-aligned, by remapping the pages rather than 
+ *    copying them. src is left with fresh zeroed pages. Returns 0, or 
+ *    -1 if the pages could not be moved, in which case nothing changed.
+ */
+int mem_remap(void *dst, void *src, size_t len)
+{
+    if (mremap(src, len, len, MREMAP_MAYMOVE | MREMAP_FIXED, dst) 
+	== MAP_FAILED)
+	return -1;
+    if (mmap(src, len, PROT_READ | PROT_WRITE, 
+	     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0)
+	== MAP_FAILED) {
+	fprintf(stderr, "mem_remap: could not refill the pages moved\n");
+	exit(1);
+    }
+    mem_remap_bytes += len;
+    return 0;
+}
+
+/*
+ * mem_remapped - returns the number of bytes mem_remap has moved
+ */
+size_t mem_remapped()
+{
+    return mem_remap_bytes;
+}
+
+/*
+ * mem_purge - give the physical memory of the len bytes of whole pages
+ *    at start, in the heap and page-aligned, back to the system. The 
+ *    pages stay mapped, and read as zeros when next touched. 
+ *    MADV_DONTNEED takes them out of the resident set at once, so that
+ *    the driver sees the effect in /proc/self/statm.
+ */
+void mem_purge(void *start, size_t len)
+{
+    if (madvise(start, len, MADV_DONTNEED) == 0)
+	mem_purge_bytes += len;
+}
+
+/*
+ * mem_purged - returns the number of bytes mem_purge has given back
+ */
+size_t mem_purged()
+{
+    return mem_purge_bytes;
+}
@@ -8,4 +8,8 @@ void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
+int mem_remap(void *dst, void *src, size_t len);
+size_t mem_remapped(void);
+void mem_purge(void *start, size_t len);
+size_t mem_purged(void);
 
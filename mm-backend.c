@@ -0,0 +1,38 @@
+/*
+ * mm-backend.c - Wraps a malloc package with the mm.c interface as an
+ *     allocator that mdriver can load.
+ *
+ * usage: make mm-firstfit.so      (links mm-firstfit.c with this file)
+ *        mdriver -b mm-firstfit.so
+ *
+ * The package gets its heap from the mem_sbrk of the mdriver that loads
+ * it, which exports its symbols for the purpose. The shared object is
+ * linked with -Bsymbolic, so that the package's calls to its own mm_
+ * functions are not bound to those of the mm.c mdriver is linked with.
+ */
+#include "mm.h"
+#include "allocator.h"
+
+#ifndef BACKEND_NAME
+#define BACKEND_NAME NULL
+#endif
+
+/* e.g. -DBACKEND_FLAGS='ALLOC_MEMLIB|ALLOC_THREADSAFE' */
+#ifndef BACKEND_FLAGS
+#define BACKEND_FLAGS ALLOC_MEMLIB
+#endif
+
+/* A package need not have a heap checker, a stats hook or arenas */
+extern int mm_check(void) __attribute__((weak));
+extern void mm_stats(alloc_stats_t *st) __attribute__((weak));
+extern mm_arena_t *mm_arena_create(void) __attribute__((weak));
+extern void *mm_arena_malloc(mm_arena_t *arena, size_t size) 
+    __attribute__((weak));
+extern void mm_arena_reset(mm_arena_t *arena) __attribute__((weak));
+extern void mm_arena_destroy(mm_arena_t *arena) __attribute__((weak));
+
+allocator_t allocator = {
+    BACKEND_NAME, mm_init, mm_malloc, mm_free, mm_realloc,
+    mm_check, mm_stats, BACKEND_FLAGS,
+    mm_arena_create, mm_arena_malloc, mm_arena_reset, mm_arena_destroy
+};
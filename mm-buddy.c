@@ -0,0 +1,410 @@
+/*
+ * mm-buddy.c - Binary buddy allocator.
+ *
+ * Every block is 2^k bytes for an order k from MIN_ORDER to MAX_ORDER,
+ * and lies at an offset from the start of the heap that is a multiple
+ * of its size. A block of order k+1 splits into two buddies of order
+ * k, and the buddy of the block at offset off is the one at off ^ 2^k,
+ * so two free buddies merge back without any search.
+ *
+ * Blocks have no header or footer: the payload is the whole block, so
+ * a request of a power of two bytes wastes nothing. Instead each order
+ * has two bitmaps with a bit per block of that order: one set while
+ * the block is free, one set while it is allocated. mm_free finds the
+ * order of a block by testing its allocated bits from MIN_ORDER up, and
+ * merges it with its buddy while the buddy's free bit is set. The free
+ * blocks of each order are also on a doubly linked list, threaded
+ * through their payloads, so mm_malloc finds one in constant time.
+ *
+ * The heap is only grown as far as it is used. Above the frontier
+ * top, nothing has been handed out yet; a block that no list can
+ * supply is carved there, at the next offset aligned to its size, and
+ * the gap below that offset is put on the lists as free blocks of the
+ * largest orders that fit it. A block whose buddy lies above top does
+ * not merge.
+ *
+ * The bitmaps are static, outside the heap, as are mm.c's list heads.
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include "mm.h"
+#include "memlib.h"
+#include "allocator.h"
+
+/* Team structure */
+team_t team = {
+    "binary buddy",
+    "", "",
+    "", "",
+    "", ""
+};
+
+#define MIN_ORDER   4   /* smallest block, 16 bytes: two list pointers */
+#define MAX_ORDER   25  /* largest block, 32 MB, more than MAX_HEAP */
+#define ORDERS      (MAX_ORDER + 1)
+
+#define MAX(x, y) ((x) > (y)? (x) : (y))
+#define MIN(x, y) ((x) < (y)? (x) : (y))
+
+/* Bits in a bitmap word, the words of order k's bitmap, and those of
+   them that cover the heap up to top */
+#define BITS        (8 * sizeof(unsigned long))
+#define MAP_WORDS(k) ((((size_t)1 << (MAX_ORDER - (k))) + BITS - 1) / BITS)
+#define ALL_WORDS   (2 * MAP_WORDS(MIN_ORDER) + MAX_ORDER)
+#define USED_WORDS(k) MIN((top >> (k)) / BITS + 1, MAP_WORDS(k))
+
+/* Block at offset off from the start of the heap, and back */
+#define BLOCK(off)  (heap_lo + (off))
+#define OFFSET(bp)  ((size_t)((char *)(bp) - heap_lo))
+
+/* Next and previous free blocks of the same order, in a free block */
+#define NEXT_FREE(bp) (((char **)(bp))[0])
+#define PREV_FREE(bp) (((char **)(bp))[1])
+
+/* Global variables */
+static char *heap_lo;            /* start of the heap */
+static size_t top;               /* offset up to which blocks were made */
+static char *free_lists[ORDERS]; /* first free block of each order */
+static unsigned long free_map[ALL_WORDS];  /* bit per free block */
+static unsigned long alloc_map[ALL_WORDS]; /* bit per allocated block */
+static size_t map_start[ORDERS]; /* first word of each order's bitmap */
+
+/* function prototypes for internal helper routines */
+static int order_of(size_t size);
+static int test_bit(unsigned long *map, int k, size_t off);
+static void set_bit(unsigned long *map, int k, size_t off);
+static void clear_bit(unsigned long *map, int k, size_t off);
+static void push_free(size_t off, int k);
+static void remove_free(size_t off, int k);
+static void free_block(size_t off, int k);
+static char *carve(int k);
+
+/*
+ * mm_init - Initialize the memory manager: empty the bitmaps up to
+ *     where the previous heap reached
+ */
+int mm_init(void)
+{
+    int k;
+    size_t start = 0;
+
+    for (k = MIN_ORDER; k <= MAX_ORDER; k++) {
+        map_start[k] = start;
+        memset(&free_map[start], 0, USED_WORDS(k) * sizeof(long));
+        memset(&alloc_map[start], 0, USED_WORDS(k) * sizeof(long));
+        start += MAP_WORDS(k);
+        free_lists[k] = NULL;
+    }
+
+    /* The heap starts page-aligned, so blocks are aligned to their size */
+    if ((heap_lo = mem_sbrk(0)) == (void *)-1)
+        return -1;
+    top = 0;
+    return 0;
+}
+
+/*
+ * mm_malloc - Allocate a block of the smallest order that holds size
+ *     bytes, splitting the smallest free block that is large enough,
+ *     or else carving one from the top of the heap
+ */
+void *mm_malloc(size_t size)
+{
+    int k, j;
+    char *bp;
+
+    if (size == 0 || (k = order_of(size)) < 0)
+        return NULL;
+
+    /* The smallest order with a free block */
+    for (j = k; j <= MAX_ORDER && free_lists[j] == NULL; j++)
+        ;
+    if (j > MAX_ORDER) {
+        if ((bp = carve(k)) == NULL)
+            return NULL;
+    } else {
+        bp = free_lists[j];
+        remove_free(OFFSET(bp), j);
+
+        /* Split it, freeing the upper halves */
+        while (j > k) {
+            j--;
+            push_free(OFFSET(bp) + ((size_t)1 << j), j);
+        }
+    }
+    set_bit(alloc_map, k, OFFSET(bp));
+    return bp;
+}
+
+/*
+ * mm_free - Free a block, and merge it with its buddy for as long as
+ *     that is free
+ */
+void mm_free(void *bp)
+{
+    size_t off = OFFSET(bp);
+    int k = MIN_ORDER;
+
+    /* Its order is the one whose allocated bit is set */
+    while (!test_bit(alloc_map, k, off))
+        k++;
+    clear_bit(alloc_map, k, off);
+    free_block(off, k);
+}
+
+/*
+ * mm_realloc - Keep the block if it is still large enough. Otherwise
+ *     grow it in place if it is aligned to the order it needs and its
+ *     upper buddies on the way there are free, or lie above top, where
+ *     the heap can grow; and failing that, move it.
+ */
+void *mm_realloc(void *ptr, size_t size)
+{
+    size_t off = OFFSET(ptr);
+    size_t end;
+    void *newp;
+    int k = MIN_ORDER;
+    int want, j;
+
+    if (size == 0 || (want = order_of(size)) < 0)
+        return NULL;
+    while (!test_bit(alloc_map, k, off))
+        k++;
+    if (want <= k)
+        return ptr;
+
+    if ((off & (((size_t)1 << want) - 1)) == 0) {
+        for (j = k; j < want && off + ((size_t)1 << j) < top; j++)
+            if (!test_bit(free_map, j, off + ((size_t)1 << j)))
+                break;
+        end = off + ((size_t)1 << want);
+        if ((j == want || off + ((size_t)1 << j) >= top) &&
+            (end <= top || mem_sbrk(end - top) != (void *)-1)) {
+            clear_bit(alloc_map, k, off);
+            for (; k < j; k++)
+                remove_free(off + ((size_t)1 << k), k);
+            top = MAX(top, end);
+            set_bit(alloc_map, want, off);
+            return ptr;
+        }
+    }
+
+    if ((newp = mm_malloc(size)) == NULL)
+        return NULL;
+    memcpy(newp, ptr, (size_t)1 << k);
+    mm_free(ptr);
+    return newp;
+}
+
+/*
+ * mm_memalign - Blocks are aligned to their size, so one of at least
+ *     alignment bytes is aligned to it, up to the heap's page alignment
+ */
+void *mm_memalign(size_t alignment, size_t size)
+{
+    if (alignment > mem_pagesize())
+        return NULL;
+    return mm_malloc(MAX(size, alignment));
+}
+
+/*
+ * mm_usable_size - The whole block is payload
+ */
+size_t mm_usable_size(void *ptr)
+{
+    size_t off = OFFSET(ptr);
+    int k = MIN_ORDER;
+
+    while (!test_bit(alloc_map, k, off))
+        k++;
+    return (size_t)1 << k;
+}
+
+/*
+ * mm_check - Check that every block on a list is free in the bitmaps,
+ *     of its list's order, aligned to it and below top, that its buddy
+ *     is not free too, and that the bitmaps hold no other free blocks.
+ *     Returns nonzero if and only if the heap is consistent.
+ */
+int mm_check(void)
+{
+    char *bp;
+    size_t off, listed = 0, mapped = 0, i;
+    int k;
+    int ok = 1;
+
+    for (k = MIN_ORDER; k <= MAX_ORDER; k++) {
+        for (bp = free_lists[k]; bp != NULL; bp = NEXT_FREE(bp)) {
+            off = OFFSET(bp);
+            if (off >= top || (off & (((size_t)1 << k) - 1)) != 0) {
+                printf("mm_check: block %p on list %d is misplaced\n", bp, k);
+                return 0;
+            }
+            if (++listed > top >> MIN_ORDER) {
+                printf("mm_check: list %d has a cycle\n", k);
+                return 0;
+            }
+            if (!test_bit(free_map, k, off) || test_bit(alloc_map, k, off)) {
+                printf("mm_check: block %p on list %d is not free\n", bp, k);
+                ok = 0;
+            }
+            if (k < MAX_ORDER &&
+                test_bit(free_map, k, off ^ ((size_t)1 << k))) {
+                printf("mm_check: block %p and its buddy are both free\n",
+                       bp);
+                ok = 0;
+            }
+            if (NEXT_FREE(bp) != NULL && PREV_FREE(NEXT_FREE(bp)) != bp) {
+                printf("mm_check: block after %p on list %d does not "
+                       "link back\n", bp, k);
+                ok = 0;
+            }
+        }
+        for (i = 0; i < USED_WORDS(k); i++)
+            mapped += __builtin_popcountl(free_map[map_start[k] + i]);
+    }
+    if (listed != mapped) {
+        printf("mm_check: %zu free blocks in the bitmaps but %zu listed\n",
+               mapped, listed);
+        ok = 0;
+    }
+    return ok;
+}
+
+/*
+ * mm_stats - Describe the heap: its size, and the number, total size
+ *     and largest size of its free blocks. Nothing is ever purged, so
+ *     the whole pages of the free blocks, but the first with the list
+ *     links, are all dirty.
+ */
+void mm_stats(alloc_stats_t *st)
+{
+    char *bp;
+    int k;
+    size_t page = mem_pagesize();
+
+    st->heap_size = mem_heapsize();
+    st->free_bytes = st->free_blocks = st->largest_free = 0;
+    st->dirty_bytes = st->purged_bytes = 0;
+    for (k = MIN_ORDER; k <= MAX_ORDER; k++)
+        for (bp = free_lists[k]; bp != NULL; bp = NEXT_FREE(bp)) {
+            st->free_bytes += (size_t)1 << k;
+            st->free_blocks++;
+            st->largest_free = (size_t)1 << k;
+            if (((size_t)1 << k) > page)
+                st->dirty_bytes += ((size_t)1 << k) - page;
+        }
+}
+
+/*
+ * order_of - The smallest order of a block that holds size bytes, or -1
+ *     if even the largest does not
+ */
+static int order_of(size_t size)
+{
+    int k;
+
+    if (size <= ((size_t)1 << MIN_ORDER))
+        return MIN_ORDER;
+    k = 8 * sizeof(long) - __builtin_clzl(size - 1);
+    return (k <= MAX_ORDER) ? k : -1;
+}
+
+/*
+ * test_bit, set_bit, clear_bit - The bit of the block of order k at
+ *     offset off in one of the bitmaps
+ */
+static int test_bit(unsigned long *map, int k, size_t off)
+{
+    size_t i = off >> k;
+
+    return (map[map_start[k] + i / BITS] >> (i % BITS)) & 1;
+}
+
+static void set_bit(unsigned long *map, int k, size_t off)
+{
+    size_t i = off >> k;
+
+    map[map_start[k] + i / BITS] |= 1UL << (i % BITS);
+}
+
+static void clear_bit(unsigned long *map, int k, size_t off)
+{
+    size_t i = off >> k;
+
+    map[map_start[k] + i / BITS] &= ~(1UL << (i % BITS));
+}
+
+/*
+ * push_free - Put the block of order k at offset off on its list
+ */
+static void push_free(size_t off, int k)
+{
+    char *bp = BLOCK(off);
+
+    NEXT_FREE(bp) = free_lists[k];
+    PREV_FREE(bp) = NULL;
+    if (free_lists[k] != NULL)
+        PREV_FREE(free_lists[k]) = bp;
+    free_lists[k] = bp;
+    set_bit(free_map, k, off);
+}
+
+/*
+ * remove_free - Take the free block of order k at offset off off its list
+ */
+static void remove_free(size_t off, int k)
+{
+    char *bp = BLOCK(off);
+
+    if (PREV_FREE(bp) != NULL)
+        NEXT_FREE(PREV_FREE(bp)) = NEXT_FREE(bp);
+    else
+        free_lists[k] = NEXT_FREE(bp);
+    if (NEXT_FREE(bp) != NULL)
+        PREV_FREE(NEXT_FREE(bp)) = PREV_FREE(bp);
+    clear_bit(free_map, k, off);
+}
+
+/*
+ * free_block - Free the block of order k at offset off, merged with its
+ *     buddy for as long as that is free
+ */
+static void free_block(size_t off, int k)
+{
+    size_t buddy;
+
+    for (; k < MAX_ORDER; k++) {
+        buddy = off ^ ((size_t)1 << k);
+        if (buddy >= top || !test_bit(free_map, k, buddy))
+            break;
+        remove_free(buddy, k);
+        off &= ~((size_t)1 << k);
+    }
+    push_free(off, k);
+}
+
+/*
+ * carve - Make a block of order k at the first offset at or above top
+ *     that is aligned to its size, growing the heap over it, and free
+ *     the gap below it in blocks as large as their alignment allows
+ */
+static char *carve(int k)
+{
+    size_t size = (size_t)1 << k;
+    size_t off = (top + size - 1) & ~(size - 1);
+    size_t gap;
+
+    if (off + size > ((size_t)1 << MAX_ORDER) ||
+        mem_sbrk(off + size - top) == (void *)-1)
+        return NULL;
+    while (top < off) {
+        gap = top & -top;    /* the largest order top is aligned to */
+        top += gap;
+        free_block(top - gap, __builtin_ctzl(gap));
+    }
+    top += size;
+    return BLOCK(off);
+}
@@ -0,0 +1,307 @@
+/*
+ * mm-libc.c - The standard C allocation interface on top of mm.c, so
+ *     that mm.c can replace the system malloc of unmodified programs.
+ *
+ * usage: make libmm.so
+ *        LD_PRELOAD=./libmm.so <program>
+ *
+ * Linked with memlib-sys.c, which gives mm.c real memory in place of
+ * the driver's simulated heap. mm.c itself is not thread-safe, so every
+ * call is serialized by a single lock, which is also held across fork
+ * so that the child inherits a consistent heap.
+ *
+ * Every entry point that libc could otherwise satisfy from its own heap
+ * (memalign, valloc and pvalloc included) is replaced, since any such
+ * block would later reach our free.
+ *
+ * The allocations can be sampled by the heap profiler in heapprof.c,
+ * which MMPROF_OUT turns on; see there.
+ *
+ * When mm.c is built with -DMM_PURGE_MIN, MMDECAY_MS=n has the large
+ * free blocks purged once they have been free for about n ms, rather
+ * than at once, by a thread that calls mm_decay every n/4 ms. With
+ * MMDECAY_THREAD=0 there is no thread, and free calls mm_decay instead.
+ * A child of fork has no such thread either, so it does the same.
+ *
+ * MMISOLATE=n gives the blocks of up to n bytes cache lines of their
+ * own, so that no two of them share one, and MMISOLATE=lo-hi those of
+ * lo to hi bytes (see mm_isolate_config).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "heapprof.h"
+
+/* Global variables */
+static pthread_mutex_t mm_lock = PTHREAD_MUTEX_INITIALIZER;
+static int initialized = 0;   /* has the heap been set up? */
+static long decay_ms = 0;     /* MMDECAY_MS */
+static int decay_thread = 0;  /* is a thread of ours calling mm_decay? */
+
+/* function prototypes for internal helper routines */
+static void init_atfork(void) __attribute__((constructor));
+static void lock_heap(void);
+static void unlock_heap(void);
+static void child_atfork(void);
+static void *decay_main(void *arg);
+static void isolate_env(char *spec);
+static void *aligned_malloc(size_t alignment, size_t size);
+
+void *malloc(size_t size)
+{
+    void *p;
+
+    lock_heap();
+    p = mm_malloc(size ? size : 1);
+    unlock_heap();
+    if (p == NULL)
+	errno = ENOMEM;
+    else
+	PROF_MALLOC(p, size);
+    return p;
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL)
+	return;
+    PROF_FREE(ptr);
+    lock_heap();
+    mm_free(ptr);
+    unlock_heap();
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *p;
+
+    if (ptr == NULL)
+	return malloc(size);
+    if (size == 0) {
+	free(ptr);
+	return NULL;
+    }
+    /* The sample goes first, before the block can be freed and reused;
+       if realloc then fails, the block stays live but unsampled */
+    PROF_FREE(ptr);
+    lock_heap();
+    p = mm_realloc(ptr, size);
+    unlock_heap();
+    if (p == NULL)
+	errno = ENOMEM;
+    else
+	PROF_MALLOC(p, size);
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    if (size != 0 && nmemb > SIZE_MAX / size) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    if ((p = malloc(nmemb * size)) != NULL)
+	memset(p, 0, nmemb * size);
+    return p;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *p;
+
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0)
+	return EINVAL;
+    if ((p = aligned_malloc(alignment, size)) == NULL)
+	return ENOMEM;
+    *memptr = p;
+    return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+	errno = EINVAL;
+	return NULL;
+    }
+    return aligned_malloc(alignment, size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    size_t align = sizeof(void *);
+
+    /* As glibc's does, take any alignment, rounded up to a power of two */
+    if (alignment > SIZE_MAX / 2 + 1) {
+	errno = EINVAL;
+	return NULL;
+    }
+    while (align < alignment)
+	align <<= 1;
+    return aligned_malloc(align, size);
+}
+
+void *valloc(size_t size)
+{
+    return aligned_malloc(mem_pagesize(), size);
+}
+
+void *pvalloc(size_t size)
+{
+    size_t pagesize = mem_pagesize();
+
+    /* Rounding up to a page must not wrap around to a small size */
+    if (size > SIZE_MAX - (pagesize - 1)) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    return aligned_malloc(pagesize, (size + pagesize - 1) & ~(pagesize - 1));
+}
+
+size_t malloc_usable_size(void *ptr)
+{
+    size_t size;
+
+    if (ptr == NULL)
+	return 0;
+    lock_heap();
+    size = mm_usable_size(ptr);
+    unlock_heap();
+    return size;
+}
+
+/**************************
+ * Internal helper routines
+ **************************/
+
+/*
+ * aligned_malloc - Allocate size bytes aligned to alignment, a power
+ *     of two, or return NULL with errno set
+ */
+static void *aligned_malloc(size_t alignment, size_t size)
+{
+    void *p;
+
+    lock_heap();
+    p = mm_memalign(alignment, size ? size : 1);
+    unlock_heap();
+    if (p == NULL)
+	errno = ENOMEM;
+    else
+	PROF_MALLOC(p, size);
+    return p;
+}
+
+/*
+ * lock_heap - Take the heap lock, setting up the heap on first use
+ */
+static void lock_heap(void)
+{
+    pthread_mutex_lock(&mm_lock);
+    if (!initialized) {
+	mem_init();
+	if (getenv("MMDECAY_MS") != NULL) {
+	    decay_ms = atol(getenv("MMDECAY_MS"));
+	    decay_thread = decay_ms > 0 && (getenv("MMDECAY_THREAD") == NULL
+					    || atoi(getenv("MMDECAY_THREAD")));
+	    mm_decay_config(decay_ms, decay_thread);
+	}
+	if (getenv("MMISOLATE") != NULL)
+	    isolate_env(getenv("MMISOLATE"));
+	if (mm_init() < 0) {
+	    static const char msg[] = "mm-libc: mm_init failed\n";
+	    write(2, msg, sizeof(msg) - 1);
+	    abort();
+	}
+	initialized = 1;
+    }
+}
+
+/*
+ * unlock_heap - Release the heap lock
+ */
+static void unlock_heap(void)
+{
+    pthread_mutex_unlock(&mm_lock);
+}
+
+/*
+ * init_atfork - Hold the heap lock across fork, so that no other thread
+ *     can be halfway through an operation when the child is created.
+ *     Then start the decay thread, if there is to be one.
+ */
+static void init_atfork(void)
+{
+    pthread_t tid;
+
+    pthread_atfork(lock_heap, unlock_heap, child_atfork);
+    if (getenv("MMDECAY_MS") == NULL)
+	return;
+
+    lock_heap();    /* reads MMDECAY_MS */
+    unlock_heap();
+    if (decay_thread && pthread_create(&tid, NULL, decay_main, NULL) != 0) {
+	lock_heap();
+	decay_thread = 0;
+	mm_decay_config(decay_ms, 0);
+	unlock_heap();
+    }
+}
+
+/*
+ * child_atfork - Release the heap lock in the child of fork, which has
+ *     no decay thread, so that free calls mm_decay from now on
+ */
+static void child_atfork(void)
+{
+    if (decay_thread) {
+	decay_thread = 0;
+	mm_decay_config(decay_ms, 0);
+    }
+    unlock_heap();
+}
+
+/*
+ * decay_main - Body of the decay thread: purges what is due every
+ *     decay_ms/4 ms, but no more often than every ms
+ */
+static void *decay_main(void *arg)
+{
+    long period = decay_ms / 4 > 0 ? decay_ms / 4 : 1;
+    struct timespec ts = { period / 1000, (period % 1000) * 1000000 };
+
+    pthread_detach(pthread_self());
+    for (;;) {
+	nanosleep(&ts, NULL);
+	lock_heap();
+	mm_decay();
+	unlock_heap();
+    }
+    return arg;
+}
+
+/*
+ * isolate_env - Isolate the block sizes given by MMISOLATE, "max" or
+ *     "min-max"
+ */
+static void isolate_env(char *spec)
+{
+    char *end;
+    size_t min = 1, max;
+
+    max = strtoul(spec, &end, 0);
+    if (*end == '-') {
+	min = max;
+	max = strtoul(end + 1, NULL, 0);
+    }
+    mm_isolate_config(min, max);
+}
@@ -25,6 +25,35 @@
  *
  * |BLK size | pointer to next | pointer to prev | payload | BLK size|
  *
+ * A freed block of a small size is not coalesced at once, but kept on
+ * a fast bin of blocks of its size, still marked allocated, from which
+ * mm_malloc takes it back as it is. The bins are emptied onto the lists
+ * when one overflows, or when no list has a fit.
+ *
+ * Optionally, a large free block gives the whole pages inside it back
+ * to the system with madvise, keeping only the pages at its ends, which
+ * hold its header, links and footer. It is marked purged, so that when
+ * it merges with a neighbour only the pages not purged yet are. That is
+ * done as soon as it is freed, or else once it has stayed free for a
+ * while: the blocks not purged yet are kept on a dirty list in the order
+ * they were freed, and mm_decay purges the oldest of them, either called
+ * from mm_free now and then or from a thread of the caller's.
+ *
+ * Requests of chosen sizes can be given cache lines of their own, so
+ * that blocks handed to different threads never share one: the block is
+ * over-allocated, and the parts in front of and behind the lines its
+ * payload spans are freed.
+ *
+ * Blocks that die together can be allocated from an arena instead,
+ * which carves them out of large blocks of its own and frees those all
+ * at once when it is reset.
+ *
+ * Compiled with -DMM_THREADS, the package is thread-safe: each segregated
+ * list has its own lock, and growing the heap has another. A block is
+ * marked free only while it is on a list, under that list's lock, so a
+ * thread that frees a block can claim its free neighbours by taking
+ * their lists' locks one at a time. See the end of the file.
+ *
  * NOTE TO STUDENTS: Replace this header comment with your own header
  * comment that gives a high level description of your solution.
  *
@@ -34,9 +63,15 @@
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
+#include <limits.h>
 
 #include "mm.h"
 #include "memlib.h"
+#include "allocator.h"
+#ifdef MM_THREADS
+#include <pthread.h>
+#endif
 
 /*********************************************************
  * NOTE TO STUDENTS: Before you do anything else, please
@@ -88,8 +123,104 @@ team_t team = {
 #define OVERHEAD    8       /* overhead of header and footer(bytes) */
 #define MIN_BSIZE   16      /* minimum size of block */
 
-#define LISTS     20      /* Number of segregated lists */
+/*
+ * Each power of two has 1 << MM_SUB_BITS segregated lists of equal
+ * ranges of sizes, up to 2^MM_POWERS; the last list also holds all the
+ * larger blocks. Both can be set with -D. Alternatively, the size
+ * classes made from traces by sizetune are compiled in, with
+ * -DMM_SIZE_CLASSES='"sizeclass.h"'
+ */
+#ifdef MM_SIZE_CLASSES
+#include MM_SIZE_CLASSES  /* defines LISTS and LIST_LIMITS */
+#if SIZE_CLASS_DSIZE != DSIZE
+#error "The size classes were made for another DSIZE"
+#endif
+#define FIT_ABOVE 0
+#else
+#ifndef MM_SUB_BITS
+#define MM_SUB_BITS 0     /* log2 of the lists per power of two */
+#endif
+#ifndef MM_POWERS
+#define MM_POWERS  20     /* powers of two with lists of their own */
+#endif
+#if (1 << MM_SUB_BITS) > MIN_BSIZE
+#error "MM_SUB_BITS splits the smallest blocks too finely"
+#endif
+#define LISTS     (MM_POWERS << MM_SUB_BITS) /* Number of segregated lists */
+#define FIT_ABOVE (MM_SUB_BITS > 0) /* see mm_malloc */
+#endif
 #define BUFFER  (1<<7)    /* Reallocation buffer */
+#define REMAP_MIN (1<<20) /* Realloc remaps rather than copies from here */
+
+/*
+ * Requests of more than MAX_REQUEST bytes are refused before any
+ * overhead or rounding is added to them, which could otherwise wrap
+ * around to a small size. mem_sbrk, which takes an int, could never make
+ * room for them anyway.
+ */
+#define MAX_REQUEST ((size_t)INT_MAX / 2)
+
+/*
+ * Freed blocks of up to MM_FAST_MAX bytes go on a fast bin of their
+ * exact size, at most FAST_LEN to a bin, still marked allocated, and
+ * are only freed for real when a bin overflows or the heap would grow.
+ * -DMM_FAST_MAX=0 turns them off; the thread-safe variant has none.
+ */
+#ifndef MM_FAST_MAX
+#define MM_FAST_MAX 64
+#endif
+#define FAST_BINS (MM_FAST_MAX / DSIZE + 1) /* Bin of each block size */
+#define FAST_LEN  64      /* Most blocks on a fast bin */
+
+/*
+ * An arena bump-allocates its blocks from chunks of ARENA_CHUNK bytes
+ * that it gets from mm_malloc, and frees them all at once when it is
+ * reset, keeping the first ARENA_KEEP chunks for reuse. A block of more
+ * than ARENA_LARGE bytes gets a chunk of its own instead.
+ */
+#define ARENA_CHUNK (1<<12)
+#define ARENA_LARGE (ARENA_CHUNK / 4)
+#define ARENA_KEEP  16
+
+/*
+ * With -DMM_PURGE_MIN=n, free blocks of n bytes or more have their
+ * interior pages purged. Every page of them touched again when they are
+ * reused then faults, so it is off (0) by default. They are purged as
+ * soon as they are freed unless -DMM_DECAY_MS (or mm_decay_config) sets
+ * a decay time, after which half of those still free are purged every
+ * so often (see mm_decay). The thread-safe variant always purges at once.
+ */
+#ifndef MM_PURGE_MIN
+#define MM_PURGE_MIN 0
+#endif
+#if MM_PURGE_MIN > 0 && MM_PURGE_MIN < 4096
+#error "MM_PURGE_MIN must be 0 or at least a page"
+#endif
+#ifndef MM_DECAY_MS
+#define MM_DECAY_MS 0
+#endif
+#define DECAY_TICKS 64    /* Frees between looks at the clock by mm_free */
+
+/*
+ * Requests of MM_ISOLATE_MIN to MM_ISOLATE_MAX bytes (none by default),
+ * or of the sizes set by mm_isolate_config, get MM_LINE-byte cache lines
+ * of their own: the payload starts a line, and nothing else, not even
+ * its header or footer, lies in the lines it spans. Blocks that threads
+ * are given that way cannot falsely share a line, at the cost of up to
+ * a line or so more per block.
+ */
+#ifndef MM_LINE
+#define MM_LINE 64
+#endif
+#if (MM_LINE & (MM_LINE - 1)) != 0 || MM_LINE < DSIZE
+#error "MM_LINE must be a power of two of at least DSIZE"
+#endif
+#ifndef MM_ISOLATE_MIN
+#define MM_ISOLATE_MIN 1
+#endif
+#ifndef MM_ISOLATE_MAX
+#define MM_ISOLATE_MAX 0
+#endif
 
 #define MAX(x, y) ((x) > (y) ? (x) : (y)) /* Maximum of two numbers */
 #define MIN(x, y) ((x) < (y) ? (x) : (y)) /* Minimum of two numbers */
@@ -114,6 +245,19 @@ team_t team = {
 #define SET_TAG(p)   (*(size_t *)(p) = GET(p) | 0x2)
 #define UNSET_TAG(p) (*(size_t *)(p) = GET(p) & ~0x2)
 
+/* Whether a free block's interior pages are purged; PUT clears it */
+#define PURGED         0x4
+#define GET_PURGED(p)  (GET(p) & PURGED)
+#define SET_PURGED(p)  (*(size_t *)(p) = GET(p) | PURGED)
+
+/* Round address p up or down to a page boundary */
+#define PAGE_UP(p, page)   \
+  ((char *)(((size_t)(p) + (page) - 1) & ~((page) - 1)))
+#define PAGE_DOWN(p, page) ((char *)((size_t)(p) & ~((page) - 1)))
+
+/* Round size up to whole cache lines */
+#define LINE_UP(size) (((size) + MM_LINE - 1) & ~(size_t)(MM_LINE - 1))
+
 /* Given block bp bp, compute address of its header and footer */
 #define HDRP(bp)       ((char *)(bp) - WSIZE)  
 #define FTRP(bp)       ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
@@ -130,20 +274,101 @@ team_t team = {
 #define NEXT_FREEP(bp) (*(char **)(bp))
 #define PREV_FREEP(bp) (*(char **)(NEXT_BP(bp)))
 
+/* A large free block's neighbours on the dirty list, when it was put
+   there (ms), and the range of it whose pages are not purged yet, the
+   rest having been purged neighbours it merged with; they follow its
+   list links, before its whole pages */
+#define DIRTY_NEXT(bp)  (*(char **)((char *)(bp) + 2 * WSIZE))
+#define DIRTY_PREV(bp)  (*(char **)((char *)(bp) + 3 * WSIZE))
+#define DIRTY_STAMP(bp) (*(size_t *)((char *)(bp) + 4 * WSIZE))
+#define DIRTY_LO(bp)    (*(char **)((char *)(bp) + 5 * WSIZE))
+#define DIRTY_HI(bp)    (*(char **)((char *)(bp) + 6 * WSIZE))
+#define FREE_LINKS      (7 * WSIZE)
+
+/* Is free block bp one that waits on the dirty list to be purged? */
+#define ON_DIRTY(bp) (MM_PURGE_MIN > 0 && decay_ms > 0 && \
+                      GET_SIZE(HDRP(bp)) >= MM_PURGE_MIN && \
+                      !GET_PURGED(HDRP(bp)))
+
 #define LINE_OFFSET   4 /* Line offset for referencing trace files */
 
+/* Next chunk of an arena, in the first word of the chunk */
+#define CHUNK_NEXT(c) (*(char **)(c))
+
+/* An arena: its chunks, and the free part of the one in use */
+struct mm_arena {
+  char *chunks;     /* chunks of ARENA_CHUNK bytes, in the order of use */
+  char *cur;        /* the one blocks are being taken from, if any */
+  char *large;      /* chunks of a single large block each */
+  char *next;       /* first free byte of cur */
+  char *end;        /* end of cur */
+};
+
 /* Global variables */
 static char *heap_listp;  /* pointer to prologue block */  
 static void *sgrlists[LISTS];  /* pointer to free list */
+#ifdef MM_SIZE_CLASSES
+/* Largest block size on each list but the last */
+static const size_t list_limits[LISTS - 1] = LIST_LIMITS;
+#endif
+static void *fastbins[FAST_BINS]; /* LIFO stacks of freed small blocks */
+static int fastlens[FAST_BINS];   /* Number of blocks on each */
+static char *dirty_head;  /* Free blocks not purged yet, oldest first */
+static char *dirty_tail;
+static long decay_ms;     /* Their decay time; 0 purges at once */
+static long decay_conf = MM_DECAY_MS; /* decay_ms from the next mm_init */
+static int decay_sync = 1;  /* Does mm_free call mm_decay? */
+static int decay_ticks;     /* Frees until it looks at the clock */
+static size_t last_decay;   /* When mm_decay last purged (ms) */
+static size_t isolate_min = MM_ISOLATE_MIN; /* Requests given lines of */
+static size_t isolate_max = MM_ISOLATE_MAX; /* their own */
 
 /* function prototypes for internal helper routines */
+#ifndef MM_THREADS
 static void *extend_heap(size_t size);
 static void *coalesce(void *bp);
 static void place(void *bp, size_t asize);
+static void *find_fit(size_t asize);
+static void *free_block(void *bp);
+static void *consolidate(int bin, size_t asize);
+static void dirty_limit(void *bp, char *dirty_lo, char *dirty_hi);
+static char *dirty_join(void *bp, int high);
+#endif
+static inline void *alloc_block(size_t size) __attribute__((always_inline));
 static void insert_block(void *bp, size_t size);
 static void delete_block(void *bp);
+static void *line_malloc(size_t size);
+static void *trim_lead(char *bp, char *new_BP);
+static void trim_tail(char *bp, size_t asize);
+static void *move_block(void *bp, size_t size, size_t copy);
+static void purge_block(void *bp, char *dirty_lo, char *dirty_hi);
+static void dirty_append(void *bp);
+static void dirty_unlink(void *bp);
+static char *dirty_bound(void *bp, int high);
+static size_t dirty_size(void *bp);
+static size_t decay_clock(void);
+
+static int list_index(size_t size);
+
+#ifdef MM_THREADS
+/* A lock for each segregated list, on a cache line of its own */
+typedef union {
+  pthread_mutex_t lock;
+  char pad[64];
+} list_lock_t;
 
-//static void mm_check(char caller, void *bp, int size);
+static list_lock_t list_locks[LISTS] __attribute__((aligned(64)));
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define LOCK_LIST(list)    pthread_mutex_lock(&list_locks[list].lock)
+#define TRYLOCK_LIST(list) (pthread_mutex_trylock(&list_locks[list].lock) == 0)
+#define UNLOCK_LIST(list)  pthread_mutex_unlock(&list_locks[list].lock)
+
+static void *grow_heap(size_t size);
+static void claim_block(void *bp);
+static void release_block(void *bp);
+static void split_block(void *bp, size_t asize);
+#endif
 
 /* 
  * mm_init - Initialize the memory manager 
@@ -152,11 +377,26 @@ static void delete_block(void *bp);
 int mm_init(void)
 {
   int list;         
+#ifdef MM_THREADS
+  void *bp;
+#endif
   
-  /* initialize sgrlists to null */
+  /* initialize sgrlists and the fast bins to null */
+  for (list = 0; list < FAST_BINS; list++) {
+    fastbins[list] = NULL;
+    fastlens[list] = 0;
+  }
   for (list = 0; list < LISTS; list++) {
     sgrlists[list] = NULL;
+#ifdef MM_THREADS
+    pthread_mutex_init(&list_locks[list].lock, NULL);
+#endif
   }
+  dirty_head = dirty_tail = NULL;
+#ifndef MM_THREADS
+  decay_ms = decay_conf;
+#endif
+  decay_ticks = 0;
 
   /* create the initial empty heap */
   if ((long)(heap_listp = mem_sbrk(4 * WSIZE)) == -1)
@@ -169,23 +409,30 @@ int mm_init(void)
   heap_listp += DSIZE;
   
   /* Extend the empty heap */
+#ifdef MM_THREADS
+  if ((bp = grow_heap(CHUNKSIZE)) == NULL)
+    return -1;
+  release_block(bp);
+#else
   if (extend_heap(CHUNKSIZE/WSIZE) == NULL)
     return -1;
+#endif
 
   return 0;
 }
 /* $end mminit */
 
-/* 
- * mm_malloc - Allocate a block with at least size bytes of payload 
+#ifndef MM_THREADS
+/*
+ * alloc_block - Allocate a block with at least size bytes of payload
  */
 /* $begin mmmalloc */
-void *mm_malloc(size_t size)
+static void *alloc_block(size_t size)
 {
   size_t asize;      /* Adjusted block size */
   size_t extendsize; /* Amount to extend heap if no fit */
   void *bp = NULL;  
-  int list = 0;      /* List counter */      
+  int bin;           /* Fast bin of asize */
   
   /* Ignore spurious requests */
   if (size <= 0) {
@@ -199,29 +446,22 @@ void *mm_malloc(size_t size)
   else {
     asize = DSIZE * ((size + (DSIZE) + (DSIZE-1)) / DSIZE);
   }
-  
-  /* Search the sgrlists for a fit */
-  size = asize;
-  while (list < LISTS) {
-    
-    if (((size <= 1) && (sgrlists[list] != NULL)) || (list == LISTS - 1))  {
-      bp = sgrlists[list];
-      
-      while ((bp != NULL) && ((asize > GET_SIZE(HDRP(bp))) || (GET_TAG(HDRP(bp)))))
-      {
-        bp = NEXT_FREEP(bp);
-      }
-      if (bp != NULL)
-      {
-        break;
-      }
-    }
-    
-    size >>= 1;
+
+  /* Reuse the block freed last of exactly asize, as it is */
+  bin = asize / DSIZE;
+  if (asize <= MM_FAST_MAX && fastbins[bin] != NULL) {
+    bp = fastbins[bin];
+    fastbins[bin] = NEXT_FREEP(bp);
+    fastlens[bin]--;
+    return bp;
   }
+
+  /* Search the lists, or else free the fast bins' blocks for one */
+  if ((bp = find_fit(asize)) == NULL)
+    bp = consolidate(-1, asize);
   
   /* No fit found. Get more memory and place the block */
-  if (ptr == NULL) {
+  if (bp == NULL) {
     extendsize = MAX(asize,CHUNKSIZE);
     if ((bp = extend_heap(extendsize/WSIZE)) == NULL) {
       return NULL;
@@ -233,34 +473,150 @@ void *mm_malloc(size_t size)
 /* $end mmmalloc */
 
 /* 
- * mm_free - Free a block 
+ * find_fit - Find a free block of at least asize bytes, or return NULL
+ */
+static void *find_fit(size_t asize)
+{
+  void *bp;
+  int list;          /* List counter */      
+  int first;         /* List of asize */
+
+  /* 
+   * Search the sgrlists for a fit, from the list of asize up. When
+   * the lists are finer than the powers of two (FIT_ABOVE), every
+   * block on the lists above asize's own is big enough, so unless the
+   * head of its own list fits, the head of the first list above that
+   * is not empty is taken rather than walk its own past the blocks
+   * that are too small. Its own is walked if all those are empty.
+   */
+  first = list_index(asize);
+  bp = sgrlists[first];
+  if ((bp != NULL) && ((asize > GET_SIZE(HDRP(bp))) || (GET_TAG(HDRP(bp))))) {
+    bp = NULL;
+    for (list = first + 1; FIT_ABOVE && (bp == NULL) && (list < LISTS); 
+         list++) {
+      bp = sgrlists[list];
+      while ((bp != NULL) && (GET_TAG(HDRP(bp))))
+        bp = NEXT_FREEP(bp);
+    }
+  }
+  for (list = first; bp == NULL && list < LISTS; list++) {
+    bp = sgrlists[list];
+      
+    while ((bp != NULL) && ((asize > GET_SIZE(HDRP(bp))) || (GET_TAG(HDRP(bp)))))
+    {
+      bp = NEXT_FREEP(bp);
+    }
+  }
+  return bp;
+}
+
+/* 
+ * mm_free - Free a block, or put it on its fast bin if it is small,
+ *           emptying the bin first if it is full. Every DECAY_TICKS
+ *           frees it runs mm_decay, unless another thread does.
  */
 /* $begin mmfree */
 void mm_free(void *bp)
 {
   size_t size = GET_SIZE(HDRP(bp));
+  int bin = size / DSIZE;
+
+  /* Purge the blocks that are due now and then, if nobody else does */
+  if (MM_PURGE_MIN > 0 && dirty_head != NULL && decay_sync && 
+      --decay_ticks < 0) {
+    decay_ticks = DECAY_TICKS;
+    mm_decay();
+  }
+
+  if (size <= MM_FAST_MAX) {
+    UNSET_TAG(HDRP(NEXT_BLKP(bp)));
+    if (fastlens[bin] == FAST_LEN)
+      consolidate(bin, 0);
+    SET_BP(PREV_BP(bp), fastbins[bin]);
+    fastbins[bin] = bp;
+    fastlens[bin]++;
+    return;
+  }
+  free_block(bp);
+}
+/* $end mmfree */
+
+/*
+ * free_block - Mark a block free, put it on its list and coalesce it.
+ *              Returns the block it ended up in.
+ */
+static void *free_block(void *bp)
+{
+  size_t size = GET_SIZE(HDRP(bp));
+  char *prev_ftr = (char *)bp - DSIZE; /* Footer of the block before */
+  char *next = NEXT_BLKP(bp);          /* Block after */
+  size_t prev_purged = GET_PURGED(prev_ftr);
+  size_t next_purged = GET_PURGED(HDRP(next));
+  size_t page;
 
-  UNSET_TAG(HDRP(NEXT_BLKP(bp)));
+  UNSET_TAG(HDRP(next));
 
   PUT(HDRP(bp), PACK(size, 0));
   PUT(FTRP(bp), PACK(size, 0));
 
   insert_block(bp, size);
-  coalesce(bp);
+  bp = coalesce(bp);
+
+  /* Purge it, skipping the pages of the purged neighbours it took in,
+     unless it waits on the dirty list for mm_decay instead */
+  if (MM_PURGE_MIN > 0 && decay_ms == 0 && 
+      GET_SIZE(HDRP(bp)) >= MM_PURGE_MIN) {
+    page = mem_pagesize();
+    purge_block(bp, prev_purged ? PAGE_DOWN(prev_ftr, page) : (char *)bp,
+                next_purged ? PAGE_UP(next + FREE_LINKS, page) : FTRP(bp));
+    SET_PURGED(HDRP(bp));
+    SET_PURGED(FTRP(bp));
+  }
+  return bp;
+}
+
+/*
+ * consolidate - Free the blocks on fast bin bin, or on all of them if
+ *               bin is -1, for real. Returns a free block of at least
+ *               asize bytes that they coalesced into, and that is not
+ *               tagged, or NULL if none. A fit that a later merge
+ *               absorbs is dropped, the merged block taking its place
+ *               if it can.
+ */
+static void *consolidate(int bin, size_t asize)
+{
+  void *bp;
+  void *fit = NULL;
+  int i;
+
+  for (i = (bin < 0) ? 0 : bin; i < ((bin < 0) ? FAST_BINS : bin + 1); i++) {
+    while ((bp = fastbins[i]) != NULL) {
+      fastbins[i] = NEXT_FREEP(bp);
+      bp = free_block(bp);
+      if ((char *)fit >= (char *)bp &&
+          (char *)fit < (char *)bp + GET_SIZE(HDRP(bp)))
+        fit = NULL;
+      if (GET_SIZE(HDRP(bp)) >= asize && !GET_TAG(HDRP(bp)))
+        fit = bp;
+    }
+    fastlens[i] = 0;
+  }
+  return fit;
 }
-/* $end mmfree */
 
 
 void *mm_realloc(void *bp, size_t size)
 {
   void *new_BP = bp;    /* Pointer to be returned */
+  void *next_BP;          /* Block following the old block */
   size_t new_size = size; /* Size of new block */
   int remainder;          /* Adequacy of block sizes */
   int extendsize;         /* Size of heap extension */
   int block_buffer;       /* Size of block buffer */
   
   /* Filter invalid block size */
-  if (size == 0)
+  if (size == 0 || size > MAX_REQUEST)
     return NULL;
   
   /* Adjust block size to include boundary tag and alignment requirements */
@@ -278,27 +634,45 @@ void *mm_realloc(void *bp, size_t size)
   
   /* Allocate more space if overhead falls below the minimum */
   if (block_buffer < 0) {
+    next_BP = NEXT_BLKP(bp);
+    remainder = -1;
+
     /* Check if next block is a free block or the epilogue block */
-    if (!GET_ALLOC(HDRP(NEXT_BLKP(bp))) || !GET_SIZE(HDRP(NEXT_BLKP(bp)))) {
-      remainder = GET_SIZE(HDRP(bp)) + GET_SIZE(HDRP(NEXT_BLKP(bp))) - new_size;
-      if (remainder < 0) {
+    if (!GET_ALLOC(HDRP(next_BP)) || !GET_SIZE(HDRP(next_BP))) {
+      remainder = GET_SIZE(HDRP(bp)) + GET_SIZE(HDRP(next_BP)) - new_size;
+
+      /* The heap can only grow into the block if nothing follows it */
+      if (remainder < 0 && 
+          (!GET_SIZE(HDRP(next_BP)) || !GET_SIZE(HDRP(NEXT_BLKP(next_BP))))) {
+        /* Let the extension coalesce with the free block we absorb */
+        UNSET_TAG(HDRP(next_BP));
         extendsize = MAX(-remainder, CHUNKSIZE);
-        if (extend_heap(extendsize) == NULL)
+        if (extend_heap(extendsize/WSIZE) == NULL)
           return NULL;
         remainder += extendsize;
       }
-      
+    }
+
+    if (remainder >= 0) {
       delete_block(NEXT_BLKP(bp));
       
       // Do not split block
       PUT_NOTAG(HDRP(bp), PACK(new_size + remainder, 1)); /* Block header */
       PUT_NOTAG(FTRP(bp), PACK(new_size + remainder, 1)); /* Block footer */
     } else {
-      new_BP = mm_malloc(new_size - DSIZE);
-      //line_count--;
-      memmove(new_BP, bp, MIN(size, new_size));
-      mm_free(bp);
-      //line_count--;
+      if (MIN(size, GET_SIZE(HDRP(bp)) - DSIZE) >= REMAP_MIN) {
+        new_BP = move_block(bp, new_size - DSIZE, 
+                            MIN(size, GET_SIZE(HDRP(bp)) - DSIZE));
+        if (new_BP == NULL)
+          return NULL;
+      } else {
+        if ((new_BP = mm_malloc(new_size - DSIZE)) == NULL)
+          return NULL;
+        //line_count--;
+        memmove(new_BP, bp, MIN(size, GET_SIZE(HDRP(bp)) - DSIZE));
+        mm_free(bp);
+        //line_count--;
+      }
     }
     block_buffer = GET_SIZE(HDRP(new_BP)) - new_size;
   }  
@@ -318,7 +692,650 @@ void *mm_realloc(void *bp, size_t size)
   /* Return reallocated block */
   return new_BP;
 }
+#endif /* MM_THREADS */
+
+/*
+ * mm_malloc - Allocate a block with at least size bytes of payload,
+ *             on cache lines of its own if size is one of those to be
+ *             isolated. alloc_block is inlined, so that the test is all
+ *             the other requests pay for.
+ */
+void *mm_malloc(size_t size)
+{
+  if (size > MAX_REQUEST)
+    return NULL;
+  if (size <= isolate_max && size >= isolate_min)
+    return line_malloc(size);
+  return alloc_block(size);
+}
+
+/*
+ * mm_isolate_config - Give the blocks of min to max bytes cache lines of
+ *                     their own from now on, or none if min > max. The
+ *                     blocks that mm_realloc moves are only isolated if
+ *                     their new size is.
+ */
+void mm_isolate_config(size_t min, size_t max)
+{
+  isolate_min = MAX(min, 1);
+  isolate_max = max;
+}
+
+/*
+ * mm_memalign - Allocate a block whose payload is aligned to alignment,
+ *               a power of two. Over-allocates, then gives the part in
+ *               front of the aligned payload back as a free block.
+ */
+void *mm_memalign(size_t alignment, size_t size)
+{
+  char *bp;           /* Block returned by mm_malloc */
+  char *aligned_BP;   /* Aligned block carved out of it */
+
+  if (alignment <= DSIZE)
+    return mm_malloc(size);
+  if (alignment > MAX_REQUEST || size > MAX_REQUEST)
+    return NULL;
+
+  /* Leave room for an aligned payload behind a minimum sized block */
+  if ((bp = mm_malloc(size + alignment + MIN_BSIZE)) == NULL)
+    return NULL;
+  if (((size_t)bp & (alignment - 1)) == 0)
+    return bp;
+  
+  aligned_BP = (char *)(((size_t)bp + MIN_BSIZE + alignment - 1) & 
+                        ~(alignment - 1));
+  return trim_lead(bp, aligned_BP);
+}
+
+/*
+ * trim_lead - Split allocated block bp in front of payload new_BP, at
+ *             least a minimum sized block into it, and free the front
+ */
+static void *trim_lead(char *bp, char *new_BP)
+{
+  size_t bp_size = GET_SIZE(HDRP(bp)); /* Size of the whole block */
+  size_t lead = new_BP - bp;           /* Size of the leading block */
+
+  PUT_NOTAG(HDRP(new_BP), PACK(bp_size - lead, 1));
+  PUT_NOTAG(FTRP(new_BP), PACK(bp_size - lead, 1));
+  PUT(HDRP(bp), PACK(lead, 1));
+  PUT_NOTAG(FTRP(bp), PACK(lead, 1));
+  mm_free(bp);
+  
+  return new_BP;
+}
+
+/*
+ * trim_tail - Shrink allocated block bp to asize bytes, if at least a
+ *             minimum sized block is left over, and free that
+ */
+static void trim_tail(char *bp, size_t asize)
+{
+  size_t bp_size = GET_SIZE(HDRP(bp)); /* Size of the whole block */
+
+  if (bp_size - asize < MIN_BSIZE)
+    return;
+  PUT(HDRP(bp), PACK(asize, 1));
+  PUT_NOTAG(FTRP(bp), PACK(asize, 1));
+  PUT_NOTAG(HDRP(NEXT_BLKP(bp)), PACK(bp_size - asize, 1));
+  PUT_NOTAG(FTRP(NEXT_BLKP(bp)), PACK(bp_size - asize, 1));
+  mm_free(NEXT_BLKP(bp));
+}
+
+/*
+ * line_malloc - Allocate a block whose payload of size bytes starts a
+ *               cache line and has the lines it spans to itself: its
+ *               header lies in the line before, and its footer and the
+ *               next block in the line after. Over-allocates, then
+ *               frees the parts in front of and behind those lines.
+ */
+static void *line_malloc(size_t size)
+{
+  size_t lsize = LINE_UP(size); /* The payload, in whole lines */
+  char *bp;                     /* Block returned by alloc_block */
+
+  /* Leave room for a line-aligned payload behind a minimum sized block */
+  if ((bp = alloc_block(lsize + MM_LINE + MIN_BSIZE)) == NULL)
+    return NULL;
+  if (((size_t)bp & (MM_LINE - 1)) != 0)
+    bp = trim_lead(bp, (char *)(((size_t)bp + MIN_BSIZE + MM_LINE - 1) &
+                                ~(size_t)(MM_LINE - 1)));
+  trim_tail(bp, lsize + DSIZE);
+  return bp;
+}
+
+/*
+ * move_block - Move the first copy bytes of bp's payload to a new block
+ *              of size bytes, and free bp. The new payload starts at the
+ *              same offset into a page as bp's, so the whole pages in
+ *              between move by mem_remap rather than by copying. The
+ *              new block is over-allocated for that, and the parts in
+ *              front of and behind it are freed.
+ */
+static void *move_block(void *bp, size_t size, size_t copy)
+{
+  size_t page = mem_pagesize();
+  char *new_BP;       /* Block returned by mm_malloc, then its payload */
+  char *lo, *hi;      /* Whole pages of the payload to copy */
+  size_t offset;      /* From the block to the payload */
+
+  /* Leave room for a payload behind a minimum sized block */
+  if ((new_BP = mm_malloc(size + page + MIN_BSIZE)) == NULL)
+    return NULL;
+  offset = ((size_t)bp - (size_t)new_BP) & (page - 1);
+  if (offset > 0) {
+    if (offset < MIN_BSIZE)
+      offset += page;
+    new_BP = trim_lead(new_BP, new_BP + offset);
+  }
+  trim_tail(new_BP, DSIZE * ((size + (DSIZE) + (DSIZE-1)) / DSIZE));
+
+  lo = (char *)(((size_t)bp + page - 1) & ~(page - 1));
+  hi = (char *)(((size_t)bp + copy) & ~(page - 1));
+  if (hi > lo && mem_remap(new_BP + (lo - (char *)bp), lo, hi - lo) == 0) {
+    memcpy(new_BP, bp, lo - (char *)bp);
+    memcpy(new_BP + (hi - (char *)bp), hi, (char *)bp + copy - hi);
+  } else {
+    memcpy(new_BP, bp, copy);
+  }
+  mm_free(bp);
+  
+  return new_BP;
+}
+
+/*
+ * purge_block - Give the whole pages inside free block bp back to the
+ *               system, but only those from dirty_lo to dirty_hi, the
+ *               others being purged already. The partial pages at its
+ *               ends, with its header, links and footer, stay.
+ */
+static void purge_block(void *bp, char *dirty_lo, char *dirty_hi)
+{
+  size_t page = mem_pagesize();
+  char *lo = MAX(PAGE_UP((char *)bp + FREE_LINKS, page), dirty_lo);
+  char *hi = MIN(PAGE_DOWN(FTRP(bp), page), dirty_hi);
+
+  if (hi > lo)
+    mem_purge(lo, hi - lo);
+}
+
+/*
+ * mm_decay_config - Set how long a large free block stays dirty before
+ *                   mm_decay may purge it: decay_ms > 0, or 0 to purge
+ *                   it as soon as it is freed, or < 0 never to. That
+ *                   takes effect at the next mm_init. Unless background
+ *                   is nonzero, mm_free calls mm_decay itself; a caller
+ *                   with a thread of its own to call it should say so.
+ */
+void mm_decay_config(long decay_ms, int background)
+{
+  decay_conf = decay_ms;
+  decay_sync = !background;
+}
+
+/*
+ * mm_decay - Purge the dirty blocks that are due. Once every decay_ms,
+ *            half the bytes of the blocks that have been free for at
+ *            least decay_ms are purged, the oldest first, so that a
+ *            dirty block that is not reused is purged after decay_ms or
+ *            so, and the dirty bytes left behind halve every decay_ms
+ *            after that. Does nothing if the last time was more recent.
+ */
+void mm_decay(void)
+{
+  size_t now;
+  size_t due = 0;         /* Bytes of the blocks old enough to purge */
+  size_t purged = 0;
+  char *bp;
+
+  if (dirty_head == NULL || 
+      (now = decay_clock()) - last_decay < (size_t)decay_ms)
+    return;
+  last_decay = now;
+
+  for (bp = dirty_head; 
+       bp != NULL && now - DIRTY_STAMP(bp) >= (size_t)decay_ms;
+       bp = DIRTY_NEXT(bp))
+    due += dirty_size(bp);
+  while (purged < (due + 1) / 2) {
+    bp = dirty_head;
+    purged += dirty_size(bp);
+    dirty_unlink(bp);
+    purge_block(bp, DIRTY_LO(bp), DIRTY_HI(bp));
+    SET_PURGED(HDRP(bp));
+    SET_PURGED(FTRP(bp));
+  }
+}
+
+/*
+ * dirty_append - Put free block bp at the tail of the dirty list, with
+ *                none of it purged
+ */
+static void dirty_append(void *bp)
+{
+  DIRTY_STAMP(bp) = decay_clock();
+  DIRTY_LO(bp) = bp;
+  DIRTY_HI(bp) = FTRP(bp);
+  DIRTY_NEXT(bp) = NULL;
+  DIRTY_PREV(bp) = dirty_tail;
+  if (dirty_tail != NULL)
+    DIRTY_NEXT(dirty_tail) = bp;
+  else
+    dirty_head = bp;
+  dirty_tail = bp;
+}
+
+/*
+ * dirty_unlink - Take free block bp off the dirty list
+ */
+static void dirty_unlink(void *bp)
+{
+  if (DIRTY_PREV(bp) != NULL)
+    DIRTY_NEXT(DIRTY_PREV(bp)) = DIRTY_NEXT(bp);
+  else
+    dirty_head = DIRTY_NEXT(bp);
+  if (DIRTY_NEXT(bp) != NULL)
+    DIRTY_PREV(DIRTY_NEXT(bp)) = DIRTY_PREV(bp);
+  else
+    dirty_tail = DIRTY_PREV(bp);
+}
+
+#ifndef MM_THREADS
+/*
+ * dirty_limit - Narrow the pages of dirty block bp not purged yet to
+ *               those within it from dirty_lo to dirty_hi, and if no
+ *               whole page is left, take it off the dirty list as purged
+ */
+static void dirty_limit(void *bp, char *dirty_lo, char *dirty_hi)
+{
+  DIRTY_LO(bp) = MAX(dirty_lo, (char *)bp);
+  DIRTY_HI(bp) = MIN(dirty_hi, FTRP(bp));
+  if (dirty_size(bp) == 0) {
+    dirty_unlink(bp);
+    SET_PURGED(HDRP(bp));
+    SET_PURGED(FTRP(bp));
+  }
+}
+
+/*
+ * dirty_join - Return dirty_bound(bp, high) of free block bp, which is
+ *              merging with the block after it (or, if high, before
+ *              it). A merged block has only one range not purged yet, so
+ *              if bp's does not reach that side of it, it is purged now.
+ */
+static char *dirty_join(void *bp, int high)
+{
+  size_t page = mem_pagesize();
+  char *lo = PAGE_UP((char *)bp + FREE_LINKS, page); /* Its whole pages */
+  char *hi = PAGE_DOWN(FTRP(bp), page);
+
+  if (ON_DIRTY(bp) && (high ? DIRTY_LO(bp) > lo : DIRTY_HI(bp) < hi)) {
+    purge_block(bp, DIRTY_LO(bp), DIRTY_HI(bp));
+    return high ? lo : hi;
+  }
+  return dirty_bound(bp, high);
+}
+#endif /* MM_THREADS */
+
+/*
+ * dirty_bound - Return the lowest (or, if high, the highest) address in
+ *               free block bp whose page may not be purged yet
+ */
+static char *dirty_bound(void *bp, int high)
+{
+  size_t page = mem_pagesize();
+
+  if (GET_PURGED(HDRP(bp)))
+    return high ? PAGE_UP((char *)bp + FREE_LINKS, page)
+                : PAGE_DOWN(FTRP(bp), page);
+  if (ON_DIRTY(bp))
+    return high ? DIRTY_HI(bp) : DIRTY_LO(bp);
+  return high ? FTRP(bp) : (char *)bp;
+}
+
+/*
+ * dirty_size - Return the bytes of the whole pages inside free block bp
+ *              that are not purged yet
+ */
+static size_t dirty_size(void *bp)
+{
+  size_t page = mem_pagesize();
+  char *lo = MAX(PAGE_UP((char *)bp + FREE_LINKS, page), dirty_bound(bp, 0));
+  char *hi = MIN(PAGE_DOWN(FTRP(bp), page), dirty_bound(bp, 1));
+
+  return (hi > lo) ? hi - lo : 0;
+}
+
+/*
+ * decay_clock - Return the time in ms, from an arbitrary start
+ */
+static size_t decay_clock(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (size_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * mm_usable_size - Return the number of payload bytes in an allocated
+ *                  block, which may exceed the size requested for it.
+ */
+size_t mm_usable_size(void *bp)
+{
+  return GET_SIZE(HDRP(bp)) - DSIZE;
+}
+
+/*
+ * mm_arena_create - Make an empty arena, whose blocks are all freed
+ *                   at once by mm_arena_reset
+ */
+mm_arena_t *mm_arena_create(void)
+{
+  mm_arena_t *arena;
+
+  if ((arena = mm_malloc(sizeof(mm_arena_t))) == NULL)
+    return NULL;
+  memset(arena, 0, sizeof(mm_arena_t));
+  return arena;
+}
+
+/*
+ * mm_arena_malloc - Allocate a block of at least size bytes from arena,
+ *                   by bumping a pointer through its current chunk
+ */
+void *mm_arena_malloc(mm_arena_t *arena, size_t size)
+{
+  char *chunk;
+
+  if (size <= 0)
+    return NULL;
+  size = (size + DSIZE - 1) & ~(DSIZE - 1);
+  if (size <= (size_t)(arena->end - arena->next)) {
+    arena->next += size;
+    return arena->next - size;
+  }
+
+  /* A large block gets a chunk of its own, freed at the next reset */
+  if (size > ARENA_LARGE) {
+    if ((chunk = mm_malloc(size + DSIZE)) == NULL)
+      return NULL;
+    CHUNK_NEXT(chunk) = arena->large;
+    arena->large = chunk;
+    return chunk + DSIZE;
+  }
+
+  /* Go on to the next chunk, which may be one kept from before a reset */
+  chunk = (arena->cur != NULL) ? CHUNK_NEXT(arena->cur) : arena->chunks;
+  if (chunk == NULL) {
+    if ((chunk = mm_malloc(ARENA_CHUNK)) == NULL)
+      return NULL;
+    CHUNK_NEXT(chunk) = NULL;
+    if (arena->cur != NULL)
+      CHUNK_NEXT(arena->cur) = chunk;
+    else
+      arena->chunks = chunk;
+  }
+  arena->cur = chunk;
+  arena->next = chunk + DSIZE + size;
+  arena->end = chunk + mm_usable_size(chunk);
+  return chunk + DSIZE;
+}
+
+/*
+ * mm_arena_reset - Free every block of arena at once. Up to ARENA_KEEP
+ *                  chunks are kept, to be reused by the blocks to come;
+ *                  the others go back to the heap.
+ */
+void mm_arena_reset(mm_arena_t *arena)
+{
+  char *chunk, *next;
+  int kept;
+
+  for (chunk = arena->large; chunk != NULL; chunk = next) {
+    next = CHUNK_NEXT(chunk);
+    mm_free(chunk);
+  }
+  arena->large = NULL;
+
+  for (chunk = arena->chunks, kept = 1; chunk != NULL && kept < ARENA_KEEP; 
+       chunk = CHUNK_NEXT(chunk), kept++)
+    ;
+  if (chunk != NULL) {
+    next = CHUNK_NEXT(chunk);
+    CHUNK_NEXT(chunk) = NULL;
+    for (chunk = next; chunk != NULL; chunk = next) {
+      next = CHUNK_NEXT(chunk);
+      mm_free(chunk);
+    }
+  }
+  arena->cur = NULL;
+  arena->next = arena->end = NULL;
+}
+
+/*
+ * mm_arena_destroy - Free arena with all its blocks and chunks
+ */
+void mm_arena_destroy(mm_arena_t *arena)
+{
+  char *chunk, *next;
+
+  mm_arena_reset(arena);
+  for (chunk = arena->chunks; chunk != NULL; chunk = next) {
+    next = CHUNK_NEXT(chunk);
+    mm_free(chunk);
+  }
+  mm_free(arena);
+}
+
+/*
+ * mm_check - Check the heap for consistency. Returns nonzero if and only
+ *            if the heap is consistent, and prints what is wrong if not.
+ *            It checks that:
+ *            - every block is aligned, a multiple of DSIZE of at least
+ *              MIN_BSIZE, lies within the heap, and has a footer that
+ *              agrees with its header; only free blocks are purged
+ *            - the epilogue sits at the very end of the heap
+ *            - every block on a segregated list is free, lies within the
+ *              heap, is on the list its size selects, and is linked back
+ *              to by the block after it
+ *            - the lists hold exactly as many blocks as the heap has
+ *              free blocks, so no free block is lost
+ *            - the dirty list holds exactly the large free blocks that
+ *              are not purged, linked both ways, and the range of each
+ *              not purged yet lies within it
+ *            - every block on a fast bin is allocated, lies within the
+ *              heap and has the bin's size, and the bin holds as many
+ *              blocks as it counts
+ *            Adjacent free blocks are not an error: a block tagged for
+ *            realloc is deliberately kept apart from its free neighbour.
+ */
+int mm_check(void)
+{
+  char *bp;               /* Block being checked */
+  size_t size;            /* Its size */
+  size_t heap_free = 0;   /* Free blocks found walking the heap */
+  size_t list_free = 0;   /* Free blocks found walking the lists */
+  int list;               /* List counter */
+  int n;                  /* Blocks found on a fast bin or dirty list */
+  int ok = 1;
+
+  /* Walk the heap in address order */
+  for (bp = NEXT_BLKP(heap_listp); (size = GET_SIZE(HDRP(bp))) > 0;
+       bp = NEXT_BLKP(bp)) {
+    if ((size_t)bp % DSIZE != 0 || size % DSIZE != 0 || size < MIN_BSIZE) {
+      printf("mm_check: block %p is misaligned or has bad size %zu\n",
+             bp, size);
+      return 0;
+    }
+    if (FTRP(bp) + WSIZE > (char *)mem_heap_hi()) {
+      printf("mm_check: block %p runs past the end of the heap\n", bp);
+      return 0;
+    }
+    if (GET_SIZE(FTRP(bp)) != size ||
+        GET_ALLOC(FTRP(bp)) != GET_ALLOC(HDRP(bp)) ||
+        GET_PURGED(FTRP(bp)) != GET_PURGED(HDRP(bp))) {
+      printf("mm_check: header and footer of block %p disagree\n", bp);
+      ok = 0;
+    }
+    if (GET_ALLOC(HDRP(bp)) && GET_PURGED(HDRP(bp))) {
+      printf("mm_check: allocated block %p is marked purged\n", bp);
+      ok = 0;
+    }
+    if (!GET_ALLOC(HDRP(bp)))
+      heap_free++;
+  }
+  if (HDRP(bp) + WSIZE != (char *)mem_heap_hi() + 1) {
+    printf("mm_check: epilogue %p is not at the end of the heap\n", bp);
+    ok = 0;
+  }
+
+  /* Walk each segregated list */
+  for (list = 0; list < LISTS; list++) {
+    if (sgrlists[list] != NULL && PREV_FREEP(sgrlists[list]) != NULL) {
+      printf("mm_check: head of list %d has a previous block\n", list);
+      ok = 0;
+    }
+    for (bp = sgrlists[list]; bp != NULL; bp = NEXT_FREEP(bp)) {
+      if (bp < (char *)mem_heap_lo() || bp > (char *)mem_heap_hi()) {
+        printf("mm_check: list %d points outside the heap at %p\n",
+               list, bp);
+        return 0;
+      }
+      if (++list_free > heap_free) {
+        printf("mm_check: list %d holds more blocks than are free\n", list);
+        return 0;
+      }
+      if (GET_ALLOC(HDRP(bp))) {
+        printf("mm_check: allocated block %p is on list %d\n", bp, list);
+        ok = 0;
+      }
+      if (list_index(GET_SIZE(HDRP(bp))) != list) {
+        printf("mm_check: block %p of size %zu is on list %d\n",
+               bp, (size_t)GET_SIZE(HDRP(bp)), list);
+        ok = 0;
+      }
+      if (NEXT_FREEP(bp) != NULL && PREV_FREEP(NEXT_FREEP(bp)) != bp) {
+        printf("mm_check: block after %p on list %d does not link back\n",
+               bp, list);
+        ok = 0;
+      }
+    }
+  }
+  if (list_free != heap_free) {
+    printf("mm_check: %zu free blocks in the heap but %zu on the lists\n",
+           heap_free, list_free);
+    ok = 0;
+  }
+
+  /* Walk the dirty list */
+  n = 0;
+  for (bp = dirty_head; bp != NULL; bp = DIRTY_NEXT(bp)) {
+    if (bp < (char *)mem_heap_lo() || bp > (char *)mem_heap_hi()) {
+      printf("mm_check: dirty list points outside the heap at %p\n", bp);
+      return 0;
+    }
+    if ((size_t)++n > heap_free) {
+      printf("mm_check: dirty list holds more blocks than are free\n");
+      return 0;
+    }
+    if (GET_ALLOC(HDRP(bp)) || !ON_DIRTY(bp)) {
+      printf("mm_check: block %p on the dirty list is allocated, small "
+             "or purged\n", bp);
+      ok = 0;
+    }
+    else if (DIRTY_LO(bp) < bp || DIRTY_HI(bp) > FTRP(bp)) {
+      printf("mm_check: dirty range of block %p runs out of it\n", bp);
+      ok = 0;
+    }
+    if ((DIRTY_NEXT(bp) != NULL) ? DIRTY_PREV(DIRTY_NEXT(bp)) != bp : 
+        dirty_tail != bp) {
+      printf("mm_check: block after %p on the dirty list does not link "
+             "back\n", bp);
+      ok = 0;
+    }
+  }
+  for (bp = NEXT_BLKP(heap_listp); GET_SIZE(HDRP(bp)) > 0; 
+       bp = NEXT_BLKP(bp))
+    if (!GET_ALLOC(HDRP(bp)) && ON_DIRTY(bp))
+      n--;
+  if (n != 0) {
+    printf("mm_check: %d more blocks on the dirty list than are dirty\n", n);
+    ok = 0;
+  }
+
+  /* Walk each fast bin */
+  for (list = 0; list < FAST_BINS; list++) {
+    n = 0;
+    for (bp = fastbins[list]; bp != NULL; bp = NEXT_FREEP(bp)) {
+      if (bp < (char *)mem_heap_lo() || bp > (char *)mem_heap_hi()) {
+        printf("mm_check: fast bin %d points outside the heap at %p\n",
+               list, bp);
+        return 0;
+      }
+      if (++n > fastlens[list]) {
+        printf("mm_check: fast bin %d holds more than its %d blocks\n",
+               list, fastlens[list]);
+        return 0;
+      }
+      if (!GET_ALLOC(HDRP(bp)) || GET_SIZE(HDRP(bp)) != list * DSIZE) {
+        printf("mm_check: block %p on fast bin %d is free or of size %zu\n",
+               bp, list, (size_t)GET_SIZE(HDRP(bp)));
+        ok = 0;
+      }
+    }
+    if (n != fastlens[list]) {
+      printf("mm_check: fast bin %d holds %d blocks but counts %d\n",
+             list, n, fastlens[list]);
+      ok = 0;
+    }
+  }
+
+  return ok;
+}
+
+/*
+ * mm_stats - Describe the heap: its size, the number, total size and
+ *            largest size of its free blocks, and how many bytes of
+ *            whole pages in those are purged, and how many not
+ */
+void mm_stats(alloc_stats_t *st)
+{
+  char *bp;
+  size_t size;
+  size_t page = mem_pagesize();
+  char *lo, *hi;          /* Whole pages of a free block */
+  int bin;
 
+  st->heap_size = mem_heapsize();
+  st->free_bytes = st->free_blocks = st->largest_free = 0;
+  st->dirty_bytes = st->purged_bytes = 0;
+  for (bp = NEXT_BLKP(heap_listp); (size = GET_SIZE(HDRP(bp))) > 0;
+       bp = NEXT_BLKP(bp)) {
+    if (GET_ALLOC(HDRP(bp)))
+      continue;
+    st->free_bytes += size;
+    st->free_blocks++;
+    st->largest_free = MAX(st->largest_free, size);
+    lo = PAGE_UP(bp + FREE_LINKS, page);
+    hi = PAGE_DOWN(FTRP(bp), page);
+    if (hi > lo) {
+      st->dirty_bytes += dirty_size(bp);
+      st->purged_bytes += (hi - lo) - dirty_size(bp);
+    }
+  }
+
+  /* The blocks on the fast bins are free, though marked allocated */
+  for (bin = 0; bin < FAST_BINS; bin++) {
+    if (fastlens[bin] == 0)
+      continue;
+    st->free_bytes += fastlens[bin] * bin * DSIZE;
+    st->free_blocks += fastlens[bin];
+    st->largest_free = MAX(st->largest_free, (size_t)bin * DSIZE);
+  }
+}
+
+#ifndef MM_THREADS
  /* 
   * extend_heap - Extend heap with free block and return its block pointer
   */
@@ -348,58 +1365,25 @@ static void *extend_heap(size_t words)
   insert_block(bp, size);
   return coalesce(bp);
 }
-  /*
-   * insert_block - boundary tag coalescing. Return ptr to coalesced block
+#endif /* MM_THREADS */
+
+/*
+ * insert_block - Put a free block on the head of its segregated list
  */
 static void insert_block(void *bp, size_t size) {
-  int list = 0;
-  void *search_BP = bp;
-  void *insert_BP = NULL;
-  
-  /* Select segregated list */
-  while ((list < LISTS - 1) && (size > 1)) {
-    size >>= 1;
-    list++;
-  }
+  int list = list_index(size);
   
-  /* Select location on list to insert pointer while keeping list
-     organized by byte size in ascending order. */
-  search_BP = sgrlists[list];
-  while ((search_BP != NULL) && (size > GET_SIZE(HDRP(search_BP)))) {
-    insert_BP = search_BP;
-    search_BP = NEXT_FREEP(search_BP);
+  SET_BP(PREV_BP(bp), sgrlists[list]);
+  if (sgrlists[list] != NULL) {
+    SET_BP(NEXT_BP(sgrlists[list]), bp);
   }
+  SET_BP(NEXT_BP(bp), NULL);
   
-  /* Set previous and next */
-  if (search_BP != NULL) {
-    if (insert_BP != NULL) {
-      SET_BP(PREV_BP(bp), search_BP); 
-      SET_BP(NEXT_BP(search_BP), bp);
-      SET_BP(NEXT_BP(bp), insert_BP);
-      SET_BP(PREV_BP(insert_BP), bp);
-    } else {
-      SET_BP(PREV_BP(bp), search_BP); 
-      SET_BP(NEXT_BP(search_BP), bp);
-      SET_BP(NEXT_BP(bp), NULL);
-      
-      /* Add block to appropriate list */
-      sgrlists[list] = bp;
-    }
-  } else {
-    if (insert_BP != NULL) {
-      SET_BP(PREV_BP(bp), NULL);
-      SET_BP(NEXT_BP(bp), insert_BP);
-      SET_BP(PREV_BP(insert_BP), bp);
-    } else {
-      SET_BP(PREV_BP(bp), NULL);
-      SET_BP(NEXT_BP(bp), NULL);
-      
-      /* Add block to appropriate list */
-      sgrlists[list] = bp;
-    }
-  }
+  /* Add block to appropriate list */
+  sgrlists[list] = bp;
 
-  return;
+  if (ON_DIRTY(bp))
+    dirty_append(bp);
 }
 
 /*
@@ -408,14 +1392,7 @@ static void insert_block(void *bp, size_t size) {
  *              or reset the list head.
  */
 static void delete_block(void *bp) {
-  int list = 0;
-  size_t size = GET_SIZE(HDRP(bp));
-  
-  /* Select segregated list */
-  while ((list < LISTS - 1) && (size > 1)) {
-    size >>= 1;
-    list++;
-  }
+  int list = list_index(GET_SIZE(HDRP(bp)));
   
   if (NEXT_FREEP(bp) != NULL) {
     if (PREV_FREEP(bp) != NULL) {
@@ -432,10 +1409,13 @@ static void delete_block(void *bp) {
       sgrlists[list] = NULL;
     }
   }
-  
+
+  if (ON_DIRTY(bp))
+    dirty_unlink(bp);
   return;
 }
 
+#ifndef MM_THREADS
 /*
  * coalesce - Coalesce adjacent free blocks. Sort the new free block into the
  *            appropriate list.
@@ -445,6 +1425,7 @@ static void *coalesce(void *bp)
   size_t prev_alloc = GET_ALLOC(HDRP(PREV_BLKP(bp)));
   size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
   size_t size = GET_SIZE(HDRP(bp));
+  char *dirty_lo = NULL, *dirty_hi = NULL; /* Not purged in merged block */
   
   /* Return if previous and next blocks are allocated */
   if (prev_alloc && next_alloc) {
@@ -454,7 +1435,16 @@ static void *coalesce(void *bp)
   /* Do not coalesce with previous block if it is tagged */
   if (GET_TAG(HDRP(PREV_BLKP(bp))))
     prev_alloc = 1;
+  if (prev_alloc && next_alloc) {
+    return bp;
+  }
   
+  /* The pages purged at the ends of the parts stay so */
+  if (MM_PURGE_MIN > 0) {
+    dirty_lo = prev_alloc ? dirty_bound(bp, 0) : dirty_join(PREV_BLKP(bp), 0);
+    dirty_hi = next_alloc ? dirty_bound(bp, 1) : dirty_join(NEXT_BLKP(bp), 1);
+  }
+
   /* Remove old block from list */
   delete_block(bp);
   
@@ -481,10 +1471,47 @@ static void *coalesce(void *bp)
   
   /* Adjust segregated linked lists */
   insert_block(bp, size);
+  if (ON_DIRTY(bp))
+    dirty_limit(bp, dirty_lo, dirty_hi);
   
   return bp;
 }
+#endif /* MM_THREADS */
 
+/*
+ * list_index - Return the segregated list that holds blocks of size bytes
+ */
+static int list_index(size_t size)
+{
+#ifdef MM_SIZE_CLASSES
+  int lo = 0, hi = LISTS - 1;
+
+  /* The first list whose limit the size is within */
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+
+    if (size <= list_limits[mid])
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return lo;
+#else
+  int log;          /* floor(log2(size)) */
+  size_t list;
+
+  if (size <= 1)
+    return 0;
+  log = 8 * sizeof(long) - 1 - __builtin_clzl(size);
+
+  /* The power of two, then which of its sub-ranges */
+  list = ((size_t)log << MM_SUB_BITS) |
+    ((size >> (log - MM_SUB_BITS)) & ((1 << MM_SUB_BITS) - 1));
+  return MIN(list, LISTS - 1);
+#endif
+}
+
+#ifndef MM_THREADS
 /*
  * place - Set headers and footers for newly allocated blocks. Split blocks
  *         if enough space is remaining.
@@ -493,17 +1520,24 @@ static void place(void *bp, size_t asize)
 {
   size_t bp_size = GET_SIZE(HDRP(bp));
   size_t remainder = bp_size - asize;
+  size_t purged = GET_PURGED(HDRP(bp));
+  char *dirty_lo = ON_DIRTY(bp) ? DIRTY_LO(bp) : NULL;
+  char *dirty_hi = ON_DIRTY(bp) ? DIRTY_HI(bp) : NULL;
+  char *rest;
   
   /* Remove block from list */
   delete_block(bp);
   
   if (remainder >= MIN_BSIZE) {
-    /* Split block */
+    /* Split block. The remainder's interior pages lie within bp's */
     PUT(HDRP(bp), PACK(asize, 1)); /* Block header */
     PUT(FTRP(bp), PACK(asize, 1)); /* Block footer */
-    PUT_NOTAG(HDRP(NEXT_BLKP(bp)), PACK(remainder, 0)); /* Next header */
-    PUT_NOTAG(FTRP(NEXT_BLKP(bp)), PACK(remainder, 0)); /* Next footer */  
-    insert_block(NEXT_BLKP(bp), remainder);
+    rest = NEXT_BLKP(bp);
+    PUT_NOTAG(HDRP(rest), PACK(remainder, 0) | purged);
+    PUT_NOTAG(FTRP(rest), PACK(remainder, 0) | purged);
+    insert_block(rest, remainder);
+    if (ON_DIRTY(rest) && dirty_lo != NULL)
+      dirty_limit(rest, dirty_lo, dirty_hi);
   } else {
     /* Do not split block */
     PUT(HDRP(bp), PACK(bp_size, 1)); /* Block header */
@@ -511,3 +1545,284 @@ static void place(void *bp, size_t asize)
   }
   return;
 }
+#endif /* MM_THREADS */
+
+#ifdef MM_THREADS
+/*
+ * The thread-safe variant (-DMM_THREADS)
+ *
+ * Each list is guarded by its own lock, and a block is marked free (in
+ * its header and footer) only while it is on the list of its size,
+ * under that list's lock. Taking a block off a list marks it allocated
+ * again, under the same lock. Hence a thread that holds a list's lock
+ * and reads a header or footer of a free block of a size on that list
+ * knows that the block really is on it.
+ *
+ * An allocated block belongs to the thread that holds it, and nobody
+ * else changes it; its neighbours only ever see that it is allocated.
+ * To free it, its owner claims its free neighbours, one list lock at a
+ * time, merges them into it while it is still marked allocated, and
+ * only then puts the result on a list. The neighbours' locks are merely
+ * tried: if one is busy, that neighbour is simply not merged, so two
+ * free blocks may be left side by side. No thread ever waits for a lock
+ * while it holds another, except the heap lock, which is taken before
+ * any list's, so there is no deadlock.
+ *
+ * mm_malloc likewise only tries the lock of each list it looks at, and
+ * moves on to the next list if it is busy; it waits for the busy ones
+ * only if no other list had a fit. Blocks are not tagged for realloc,
+ * which instead grows a block into the free block after it, or at the
+ * end of the heap, before it resorts to moving it.
+ *
+ * mm_check and mm_stats must not run while other threads use the heap.
+ */
+
+/*
+ * alloc_block - Allocate a block with at least size bytes of payload
+ */
+static void *alloc_block(size_t size)
+{
+  size_t asize;            /* Adjusted block size */
+  void *bp = NULL;
+  int list;                /* List counter */
+  int busy[LISTS];         /* Lists skipped because they were locked */
+  int nbusy = 0;
+  int i;
+
+  /* Ignore spurious requests */
+  if (size <= 0)
+    return NULL;
+
+  /* Adjust block size to include overhead and alignment reqs. */
+  if (size <= DSIZE)
+    asize = 2*DSIZE;
+  else
+    asize = DSIZE * ((size + (DSIZE) + (DSIZE-1)) / DSIZE);
+
+  /* Search the lists that are free for a fit, then the busy ones */
+  for (list = list_index(asize); list < LISTS && bp == NULL; list++) {
+    if (sgrlists[list] == NULL)
+      continue;
+    if (!TRYLOCK_LIST(list)) {
+      busy[nbusy++] = list;
+      continue;
+    }
+    for (bp = sgrlists[list]; bp != NULL && asize > GET_SIZE(HDRP(bp));
+         bp = NEXT_FREEP(bp))
+      ;
+    if (bp != NULL)
+      claim_block(bp);
+    UNLOCK_LIST(list);
+  }
+  for (i = 0; i < nbusy && bp == NULL; i++) {
+    LOCK_LIST(busy[i]);
+    for (bp = sgrlists[busy[i]]; bp != NULL && asize > GET_SIZE(HDRP(bp));
+         bp = NEXT_FREEP(bp))
+      ;
+    if (bp != NULL)
+      claim_block(bp);
+    UNLOCK_LIST(busy[i]);
+  }
+
+  /* No fit found. Get more memory */
+  if (bp == NULL && (bp = grow_heap(MAX(asize, CHUNKSIZE))) == NULL)
+    return NULL;
+
+  split_block(bp, asize);
+  return bp;
+}
+
+/* 
+ * mm_free - Free a block, merging it with the free blocks next to it
+ *           whose lists are not busy
+ */
+void mm_free(void *bp)
+{
+  size_t size = GET_SIZE(HDRP(bp));
+  size_t word;             /* Neighbour's header or footer */
+  char *prev_ftr = NULL;   /* Footer of the previous, if merged and purged */
+  char *next = NULL;       /* Next block, if merged and purged */
+  size_t page;
+  int list;
+
+  /* Claim the next block if it is free */
+  word = GET(HDRP(NEXT_BLKP(bp)));
+  if (!(word & 0x1)) {
+    list = list_index(word & ~0x7);
+    if (TRYLOCK_LIST(list)) {
+      if (GET(HDRP(NEXT_BLKP(bp))) == word) {
+        if (word & PURGED)
+          next = NEXT_BLKP(bp);
+        claim_block(NEXT_BLKP(bp));
+        size += word & ~0x7;
+      }
+      UNLOCK_LIST(list);
+    }
+  }
+
+  /* And the previous one */
+  word = GET((char *)bp - DSIZE);
+  if (!(word & 0x1)) {
+    list = list_index(word & ~0x7);
+    if (TRYLOCK_LIST(list)) {
+      if (GET((char *)bp - DSIZE) == word) {
+        if (word & PURGED)
+          prev_ftr = (char *)bp - DSIZE;
+        bp = PREV_BLKP(bp);
+        claim_block(bp);
+        size += word & ~0x7;
+      }
+      UNLOCK_LIST(list);
+    }
+  }
+
+  PUT_NOTAG(HDRP(bp), PACK(size, 1));
+  PUT_NOTAG(FTRP(bp), PACK(size, 1));
+
+  /* Purge it while it is still ours, for release_block to mark */
+  if (MM_PURGE_MIN > 0 && size >= MM_PURGE_MIN) {
+    page = mem_pagesize();
+    purge_block(bp, prev_ftr ? PAGE_DOWN(prev_ftr, page) : (char *)bp,
+                next ? PAGE_UP(next + FREE_LINKS, page) : FTRP(bp));
+    SET_PURGED(HDRP(bp));
+  }
+  release_block(bp);
+}
+
+/*
+ * mm_realloc - Grow a block in place into the free block after it, or
+ *              the end of the heap, or else move it
+ */
+void *mm_realloc(void *bp, size_t size)
+{
+  size_t old_size = GET_SIZE(HDRP(bp));
+  size_t new_size;         /* Size of new block */
+  size_t word;             /* Next block's header */
+  size_t extendsize;       /* Size of heap extension */
+  char *next_BP;           /* Block following the old block */
+  void *new_BP;
+  int list;
+
+  /* Filter invalid block size */
+  if (size == 0 || size > MAX_REQUEST)
+    return NULL;
+
+  /* Adjust block size to include overhead and the realloc buffer */
+  if (size <= DSIZE)
+    new_size = 2 * DSIZE;
+  else
+    new_size = DSIZE * ((size + (DSIZE) + (DSIZE - 1)) / DSIZE);
+  new_size += BUFFER;
+  if (new_size <= old_size)
+    return bp;
+
+  /* Absorb the next block if it is free and big enough */
+  next_BP = NEXT_BLKP(bp);
+  word = GET(HDRP(next_BP));
+  if (!(word & 0x1) && old_size + (word & ~0x7) >= new_size) {
+    list = list_index(word & ~0x7);
+    LOCK_LIST(list);
+    if (GET(HDRP(next_BP)) == word) {
+      claim_block(next_BP);
+      PUT_NOTAG(HDRP(bp), PACK(old_size + (word & ~0x7), 1));
+      PUT_NOTAG(FTRP(bp), PACK(old_size + (word & ~0x7), 1));
+      UNLOCK_LIST(list);
+      return bp;
+    }
+    UNLOCK_LIST(list);
+  }
+
+  /* Or grow the heap under it if it is the last block */
+  if (word == PACK(0, 1)) {
+    pthread_mutex_lock(&heap_lock);
+    extendsize = MAX(new_size - old_size, CHUNKSIZE);
+    if (GET(HDRP(next_BP)) == PACK(0, 1) && 
+        (long)mem_sbrk(extendsize) != -1) {
+      PUT_NOTAG(HDRP(bp), PACK(old_size + extendsize, 1));
+      PUT_NOTAG(FTRP(bp), PACK(old_size + extendsize, 1));
+      PUT_NOTAG(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* new epilogue */
+      pthread_mutex_unlock(&heap_lock);
+      return bp;
+    }
+    pthread_mutex_unlock(&heap_lock);
+  }
+
+  /* Otherwise move it */
+  if (MIN(size, old_size - DSIZE) >= REMAP_MIN)
+    return move_block(bp, new_size - DSIZE, MIN(size, old_size - DSIZE));
+  if ((new_BP = mm_malloc(new_size - DSIZE)) == NULL)
+    return NULL;
+  memcpy(new_BP, bp, MIN(size, old_size - DSIZE));
+  mm_free(bp);
+  return new_BP;
+}
+
+/*
+ * grow_heap - Extend the heap by size bytes, and return the new space
+ *             as an allocated block
+ */
+static void *grow_heap(size_t size)
+{
+  void *bp;
+
+  pthread_mutex_lock(&heap_lock);
+  if ((long)(bp = mem_sbrk(size)) == -1) {
+    pthread_mutex_unlock(&heap_lock);
+    return NULL;
+  }
+
+  /* The block takes the old epilogue's place */
+  PUT_NOTAG(HDRP(bp), PACK(size, 1));
+  PUT_NOTAG(FTRP(bp), PACK(size, 1));
+  PUT_NOTAG(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* new epilogue header */
+  pthread_mutex_unlock(&heap_lock);
+  return bp;
+}
+
+/*
+ * claim_block - Take a free block off its list and mark it allocated.
+ *               The caller holds the list's lock.
+ */
+static void claim_block(void *bp)
+{
+  size_t size = GET_SIZE(HDRP(bp));
+
+  delete_block(bp);
+  PUT_NOTAG(HDRP(bp), PACK(size, 1));
+  PUT_NOTAG(FTRP(bp), PACK(size, 1));
+}
+
+/*
+ * release_block - Put an allocated block on its list and mark it free,
+ *                 and purged if its header says so
+ */
+static void release_block(void *bp)
+{
+  size_t size = GET_SIZE(HDRP(bp));
+  size_t purged = GET_PURGED(HDRP(bp));
+  int list = list_index(size);
+
+  LOCK_LIST(list);
+  insert_block(bp, size);
+  PUT_NOTAG(HDRP(bp), PACK(size, 0) | purged);
+  PUT_NOTAG(FTRP(bp), PACK(size, 0) | purged);
+  UNLOCK_LIST(list);
+}
+
+/*
+ * split_block - Cut an allocated block down to asize bytes, if enough
+ *               is left over to free
+ */
+static void split_block(void *bp, size_t asize)
+{
+  size_t remainder = GET_SIZE(HDRP(bp)) - asize;
+
+  if (remainder < MIN_BSIZE)
+    return;
+  PUT_NOTAG(HDRP(bp), PACK(asize, 1));
+  PUT_NOTAG(FTRP(bp), PACK(asize, 1));
+  PUT_NOTAG(HDRP(NEXT_BLKP(bp)), PACK(remainder, 1));
+  PUT_NOTAG(FTRP(NEXT_BLKP(bp)), PACK(remainder, 1));
+  mm_free(NEXT_BLKP(bp));
+}
+#endif /* MM_THREADS */
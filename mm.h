@@ -4,6 +4,22 @@ extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
+extern void *mm_memalign(size_t alignment, size_t size);
+extern size_t mm_usable_size(void *ptr);
+
+/* Arenas of blocks that are all freed at once */
+typedef struct mm_arena mm_arena_t;
+extern mm_arena_t *mm_arena_create(void);
+extern void *mm_arena_malloc(mm_arena_t *arena, size_t size);
+extern void mm_arena_reset(mm_arena_t *arena);
+extern void mm_arena_destroy(mm_arena_t *arena);
+
+/* Purging of large free blocks when they have been free for a while */
+extern void mm_decay_config(long decay_ms, int background);
+extern void mm_decay(void);
+
+/* Cache lines of their own for the blocks of min to max bytes */
+extern void mm_isolate_config(size_t min, size_t max);
 
 
 /* 
@@ -0,0 +1,608 @@
+/*
+ * mmrecord.c - LD_PRELOAD library that records the malloc traffic of an
+ *     unmodified program as a .rep trace that mdriver can replay.
+ *
+ * usage: make libmmrecord.so
+ *        MMRECORD_OUT=app.rep LD_PRELOAD=./libmmrecord.so <program>
+ *
+ * malloc, free, realloc, calloc and posix_memalign are interposed and
+ * forwarded to the next definition (normally libc's). Every pointer
+ * handed out is mapped to a dense trace id; ids of freed blocks are
+ * reused, so num_ids is the peak number of live blocks rather than the
+ * total number of allocations.
+ *
+ * To keep the overhead low, each thread appends its ops to its own
+ * buffer, and the pointer map is split into independently locked
+ * shards. Every op is stamped with a global sequence number taken while
+ * the pointer's shard is locked, which orders the ops of one block
+ * consistently with the real calls. Full buffers are appended to an
+ * unlinked spool file; when the program exits, the spool is sorted by
+ * sequence number and written out as a .rep file (whose header records
+ * num_ids and num_ops), followed by a free for every block still live.
+ * Each op is tagged with the thread that made it, the threads being
+ * numbered in the order they first call the allocator.
+ *
+ * Limitations: posix_memalign is replayed as a plain malloc, memory
+ * obtained before the library initialized is not recorded, and
+ * programs that end with _exit or a signal leave no trace. A "%p" in
+ * MMRECORD_OUT is replaced by the process id (default mmrecord.%p.rep),
+ * so that programs that exec each other record separate traces; forked
+ * children do not record.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+#define MAXLINE   1024       /* max string size */
+#define TBUF      8192       /* ops buffered per thread */
+#define SHARDS    64         /* independently locked pointer map shards */
+#define SHARD_MIN 4096       /* initial slots per shard */
+#define BOOTSTRAP (64*1024)  /* bytes for allocations made during dlsym */
+
+/* One recorded op and its global sequence number */
+typedef struct {
+    uint64_t seq;
+    traceop_t op;
+} rec_t;
+
+/* A thread's pending ops */
+typedef struct tbuf_t {
+    int n;
+    int thread;              /* number of the thread it belongs to */
+    struct tbuf_t *next;     /* list of all buffers, for the final flush */
+    rec_t recs[TBUF];
+} tbuf_t;
+
+/* A slot in a shard of the pointer map; ptr == NULL marks an empty slot */
+typedef struct {
+    void *ptr;
+    int id;
+} slot_t;
+
+/* An open-addressed, linearly probed hash table with its own lock */
+typedef struct {
+    volatile int lock;
+    int used;
+    int cap;                 /* power of two */
+    slot_t *slots;
+} shard_t;
+
+/* The real allocator functions */
+static void *(*real_malloc)(size_t);
+static void (*real_free)(void *);
+static void *(*real_realloc)(void *, size_t);
+static void *(*real_calloc)(size_t, size_t);
+static int (*real_posix_memalign)(void **, size_t, size_t);
+
+/* Global variables */
+static volatile int recording = 0;   /* set once initialized */
+static volatile int initializing = 0;
+static char outfile[MAXLINE];        /* where the trace is written */
+static int spool_fd = -1;            /* unlinked file of flushed ops */
+static uint64_t seq = 0;             /* next sequence number */
+static shard_t shards[SHARDS];       /* pointer -> id map */
+static volatile int id_lock = 0;     /* protects the id free list */
+static int *free_ids;                /* ids of freed blocks, for reuse */
+static int num_free_ids = 0, free_ids_cap = 0;
+static int num_ids = 0;              /* ids handed out so far */
+static pthread_mutex_t spool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t tbuf_key;
+static tbuf_t *all_tbufs = NULL;     /* all thread buffers (under spool_lock) */
+static int num_threads = 0;          /* threads seen so far (under spool_lock) */
+
+static char bootstrap[BOOTSTRAP] __attribute__((aligned(16)));
+static size_t bootstrap_used = 0;
+
+static __thread tbuf_t *my_tbuf;     /* this thread's buffer */
+static __thread int busy;            /* set while inside the recorder */
+
+/* function prototypes for internal helper routines */
+static void init(void) __attribute__((constructor));
+static void finish(void) __attribute__((destructor));
+static void *bootstrap_alloc(size_t size);
+static void record(int type, int id, size_t size, uint64_t s);
+static void flush_tbuf(tbuf_t *b);
+static void tbuf_exit(void *b);
+static void on_fork_child(void);
+static int track(void *ptr, uint64_t *s);
+static int untrack(void *ptr, uint64_t *s);
+static void retrack(void *ptr, int id, uint64_t *s);
+static void release_id(int id);
+static int cmp_rec(const void *a, const void *b);
+static void *map_pages(size_t bytes);
+
+#define MIN(x, y) ((x) < (y) ? (x) : (y)) /* Minimum of two numbers */
+
+#define LOCK(l)   while (__atomic_test_and_set(&(l), __ATOMIC_ACQUIRE))
+#define UNLOCK(l) __atomic_clear(&(l), __ATOMIC_RELEASE)
+
+/* Hash a pointer to a shard and a starting slot */
+#define HASH(p)   ((uint32_t)(((uintptr_t)(p) >> 3) * 2654435761u))
+#define SHARD(p)  (&shards[HASH(p) >> 26])
+
+/*********************
+ * Interposed routines
+ *********************/
+
+void *malloc(size_t size)
+{
+    void *p;
+    uint64_t s;
+    int id;
+
+    if (!recording || busy) {
+	init();
+	if (real_malloc == NULL)
+	    return bootstrap_alloc(size);
+	return real_malloc(size);
+    }
+    busy = 1;
+    if ((p = real_malloc(size)) != NULL) {
+	id = track(p, &s);
+	record(ALLOC, id, size, s);
+    }
+    busy = 0;
+    return p;
+}
+
+void free(void *ptr)
+{
+    uint64_t s;
+    int id;
+
+    if ((char *)ptr >= bootstrap && (char *)ptr < bootstrap + BOOTSTRAP)
+	return;
+    if (!recording || busy || ptr == NULL) {
+	init();
+	real_free(ptr);
+	return;
+    }
+    busy = 1;
+    if ((id = untrack(ptr, &s)) >= 0) {
+	record(FREE, id, 0, s);
+	release_id(id);
+    }
+    real_free(ptr);
+    busy = 0;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *p;
+    uint64_t s;
+    int id;
+
+    if (ptr == NULL)
+	return malloc(size);
+    if ((char *)ptr >= bootstrap && (char *)ptr < bootstrap + BOOTSTRAP) {
+	if ((p = malloc(size)) != NULL)
+	    memcpy(p, ptr, MIN(size, bootstrap + BOOTSTRAP - (char *)ptr));
+	return p;
+    }
+    if (!recording || busy) {
+	init();
+	return real_realloc(ptr, size);
+    }
+
+    busy = 1;
+    if ((id = untrack(ptr, &s)) < 0) {
+	/* Not ours to record */
+	p = real_realloc(ptr, size);
+    }
+    else if (size == 0) {
+	/* libc frees the block */
+	record(FREE, id, 0, s);
+	release_id(id);
+	p = real_realloc(ptr, size);
+    }
+    else if ((p = real_realloc(ptr, size)) == NULL) {
+	/* The old block is still live */
+	retrack(ptr, id, NULL);
+    }
+    else {
+	retrack(p, id, &s);
+	record(REALLOC, id, size, s);
+    }
+    busy = 0;
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+    uint64_t s;
+    int id;
+
+    if (!recording || busy) {
+	init();
+	/* dlsym itself calls calloc while we are looking up the real one */
+	if (real_calloc == NULL)
+	    return bootstrap_alloc(nmemb * size);
+	return real_calloc(nmemb, size);
+    }
+
+    busy = 1;
+    if ((p = real_calloc(nmemb, size)) != NULL) {
+	id = track(p, &s);
+	record(ALLOC, id, nmemb * size, s);
+    }
+    busy = 0;
+    return p;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    uint64_t s;
+    int id, rc;
+
+    if (!recording || busy) {
+	init();
+	return real_posix_memalign(memptr, alignment, size);
+    }
+    busy = 1;
+    if ((rc = real_posix_memalign(memptr, alignment, size)) == 0) {
+	id = track(*memptr, &s);
+	record(ALLOC, id, size, s);
+    }
+    busy = 0;
+    return rc;
+}
+
+/**************************
+ * Internal helper routines
+ **************************/
+
+/*
+ * init - Look up the real allocator and open the spool. Runs as a
+ *     constructor, but is also safe to call on every unrecorded call in
+ *     case another library allocates first; only the first call does
+ *     any work.
+ */
+static void init(void)
+{
+    char path[MAXLINE + 8];
+    char *spec, *pct;
+    int i;
+
+    if (recording || initializing)
+	return;
+    initializing = 1;
+    busy = 1;
+
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+
+    /* Expand %p in the output file name to the process id */
+    if ((spec = getenv("MMRECORD_OUT")) == NULL)
+	spec = "mmrecord.%p.rep";
+    if ((pct = strstr(spec, "%p")) != NULL)
+	snprintf(outfile, MAXLINE, "%.*s%d%s", (int)(pct - spec), spec,
+		 (int)getpid(), pct + 2);
+    else
+	snprintf(outfile, MAXLINE, "%s", spec);
+
+    snprintf(path, sizeof(path), "%s.spool", outfile);
+    if ((spool_fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0) {
+	fprintf(stderr, "mmrecord: could not create %s: %s\n",
+		path, strerror(errno));
+	busy = 0;
+	return;
+    }
+    unlink(path);
+
+    for (i = 0; i < SHARDS; i++) {
+	shards[i].cap = SHARD_MIN;
+	shards[i].slots = map_pages(SHARD_MIN * sizeof(slot_t));
+    }
+    pthread_key_create(&tbuf_key, tbuf_exit);
+    pthread_atfork(NULL, NULL, on_fork_child);
+
+    busy = 0;
+    recording = 1;
+}
+
+/*
+ * bootstrap_alloc - Hand out zeroed memory from a static buffer while
+ *     the real allocator is still being looked up. It is never freed.
+ */
+static void *bootstrap_alloc(size_t size)
+{
+    void *p;
+
+    size = (size + 15) & ~(size_t)15;
+    if (bootstrap_used + size > BOOTSTRAP)
+	return NULL;
+    p = bootstrap + bootstrap_used;
+    bootstrap_used += size;
+    return p;
+}
+
+/*
+ * finish - At exit, flush every thread's buffer and turn the spool
+ *     into a .rep trace
+ */
+static void finish(void)
+{
+    FILE *out;
+    struct stat st;
+    rec_t *recs;
+    tbuf_t *b;
+    long n, i;
+    int j, live = 0;
+
+    if (!recording)
+	return;
+    busy = 1;
+    recording = 0;
+
+    pthread_mutex_lock(&spool_lock);
+    for (b = all_tbufs; b != NULL; b = b->next) {
+	write(spool_fd, b->recs, b->n * sizeof(rec_t));
+	b->n = 0;
+    }
+    pthread_mutex_unlock(&spool_lock);
+
+    for (j = 0; j < SHARDS; j++)
+	live += shards[j].used;
+
+    if ((out = fopen(outfile, "w")) == NULL) {
+	fprintf(stderr, "mmrecord: could not create %s: %s\n",
+		outfile, strerror(errno));
+	return;
+    }
+    fstat(spool_fd, &st);
+    n = st.st_size / sizeof(rec_t);
+    fprintf(out, "%d\n%d\n%ld\n%d\n", 20000, num_ids, n + live, 1);
+
+    if (n > 0) {
+	recs = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		    spool_fd, 0);
+	if (recs == MAP_FAILED) {
+	    fprintf(stderr, "mmrecord: mmap failed: %s\n", strerror(errno));
+	    fclose(out);
+	    return;
+	}
+	qsort(recs, n, sizeof(rec_t), cmp_rec);
+	for (i = 0; i < n; i++) {
+	    if (recs[i].op.thread != 0)
+		fprintf(out, "%d:", recs[i].op.thread);
+	    if (recs[i].op.type == FREE)
+		fprintf(out, "f %d\n", recs[i].op.index);
+	    else
+		fprintf(out, "%c %d %d\n", (recs[i].op.type == ALLOC) ? 'a' : 'r',
+			recs[i].op.index, recs[i].op.size);
+	}
+	munmap(recs, st.st_size);
+    }
+
+    /* Free whatever the program never freed, so the trace is balanced */
+    for (j = 0; j < SHARDS; j++)
+	for (i = 0; i < shards[j].cap; i++)
+	    if (shards[j].slots[i].ptr != NULL)
+		fprintf(out, "f %d\n", shards[j].slots[i].id);
+    fclose(out);
+    close(spool_fd);
+}
+
+/*
+ * record - Append an op to this thread's buffer
+ */
+static void record(int type, int id, size_t size, uint64_t s)
+{
+    tbuf_t *b = my_tbuf;
+    rec_t *r;
+
+    if (b == NULL) {
+	b = my_tbuf = map_pages(sizeof(tbuf_t));
+	pthread_setspecific(tbuf_key, b);
+	pthread_mutex_lock(&spool_lock);
+	b->next = all_tbufs;
+	all_tbufs = b;
+	b->thread = num_threads++;
+	pthread_mutex_unlock(&spool_lock);
+    }
+
+    r = &b->recs[b->n++];
+    r->seq = s;
+    r->op.type = type;
+    r->op.index = id;
+    r->op.thread = b->thread % TRACE_MAX_THREADS;
+    /* The driver wants sizes in (0, INT_MAX] */
+    r->op.size = (size == 0) ? 1 : (size > INT32_MAX) ? INT32_MAX : size;
+
+    if (b->n == TBUF)
+	flush_tbuf(b);
+}
+
+/*
+ * flush_tbuf - Append a thread's buffered ops to the spool
+ */
+static void flush_tbuf(tbuf_t *b)
+{
+    pthread_mutex_lock(&spool_lock);
+    if (recording &&
+	write(spool_fd, b->recs, b->n * sizeof(rec_t)) != b->n * sizeof(rec_t))
+	fprintf(stderr, "mmrecord: spool write failed: %s\n", strerror(errno));
+    b->n = 0;
+    pthread_mutex_unlock(&spool_lock);
+}
+
+/*
+ * tbuf_exit - Flush a thread's buffer when the thread exits. The buffer
+ *     itself stays on all_tbufs, empty, since other threads may be
+ *     walking the list.
+ */
+static void tbuf_exit(void *b)
+{
+    flush_tbuf((tbuf_t *)b);
+}
+
+/*
+ * on_fork_child - A forked child must not write into the parent's spool
+ */
+static void on_fork_child(void)
+{
+    recording = 0;
+}
+
+/*
+ * track - Give ptr a fresh id, add it to the pointer map and take a
+ *     sequence number for the alloc
+ */
+static int track(void *ptr, uint64_t *s)
+{
+    int id;
+
+    LOCK(id_lock);
+    if (num_free_ids > 0)
+	id = free_ids[--num_free_ids];
+    else
+	id = num_ids++;
+    UNLOCK(id_lock);
+
+    retrack(ptr, id, s);
+    return id;
+}
+
+/*
+ * retrack - Map ptr to an existing id. If s is not NULL, also take a
+ *     sequence number while the shard is locked, which orders this op
+ *     before any later op on the block.
+ */
+static void retrack(void *ptr, int id, uint64_t *s)
+{
+    shard_t *sh = SHARD(ptr);
+    slot_t *old;
+    uint32_t i, j, mask;
+    int oldcap;
+
+    LOCK(sh->lock);
+
+    /* Keep the load factor under 1/2 */
+    if (2 * (sh->used + 1) > sh->cap) {
+	old = sh->slots;
+	oldcap = sh->cap;
+	sh->cap *= 2;
+	sh->slots = map_pages(sh->cap * sizeof(slot_t));
+	mask = sh->cap - 1;
+	for (i = 0; i < oldcap; i++) {
+	    if (old[i].ptr == NULL)
+		continue;
+	    for (j = HASH(old[i].ptr) & mask; sh->slots[j].ptr != NULL;
+		 j = (j + 1) & mask)
+		;
+	    sh->slots[j] = old[i];
+	}
+	munmap(old, oldcap * sizeof(slot_t));
+    }
+
+    mask = sh->cap - 1;
+    for (i = HASH(ptr) & mask; sh->slots[i].ptr != NULL; i = (i + 1) & mask)
+	;
+    sh->slots[i].ptr = ptr;
+    sh->slots[i].id = id;
+    sh->used++;
+
+    if (s != NULL)
+	*s = __atomic_fetch_add(&seq, 1, __ATOMIC_RELAXED);
+    UNLOCK(sh->lock);
+}
+
+/*
+ * untrack - Remove ptr from the pointer map and take a sequence number
+ *     for the op that releases it. Returns ptr's id, or -1 if ptr was
+ *     never recorded.
+ */
+static int untrack(void *ptr, uint64_t *s)
+{
+    shard_t *sh = SHARD(ptr);
+    uint32_t i, j, k, mask;
+    int id;
+
+    LOCK(sh->lock);
+    mask = sh->cap - 1;
+    for (i = HASH(ptr) & mask; sh->slots[i].ptr != ptr; i = (i + 1) & mask) {
+	if (sh->slots[i].ptr == NULL) {
+	    UNLOCK(sh->lock);
+	    return -1;
+	}
+    }
+    id = sh->slots[i].id;
+    sh->used--;
+
+    /* Backward-shift deletion keeps probe sequences unbroken */
+    for (j = (i + 1) & mask; sh->slots[j].ptr != NULL; j = (j + 1) & mask) {
+	k = HASH(sh->slots[j].ptr) & mask;
+	if (((j - k) & mask) >= ((j - i) & mask)) {
+	    sh->slots[i] = sh->slots[j];
+	    i = j;
+	}
+    }
+    sh->slots[i].ptr = NULL;
+
+    *s = __atomic_fetch_add(&seq, 1, __ATOMIC_RELAXED);
+    UNLOCK(sh->lock);
+    return id;
+}
+
+/*
+ * release_id - Recycle the id of a freed block. Called after the free
+ *     took its sequence number, so the id's next alloc comes later.
+ */
+static void release_id(int id)
+{
+    int *old;
+
+    LOCK(id_lock);
+    if (num_free_ids == free_ids_cap) {
+	old = free_ids;
+	free_ids_cap = free_ids_cap ? 2 * free_ids_cap : 4096;
+	free_ids = map_pages(free_ids_cap * sizeof(int));
+	if (old != NULL) {
+	    memcpy(free_ids, old, num_free_ids * sizeof(int));
+	    munmap(old, num_free_ids * sizeof(int));
+	}
+    }
+    free_ids[num_free_ids++] = id;
+    UNLOCK(id_lock);
+}
+
+/*
+ * cmp_rec - Order spooled ops by sequence number
+ */
+static int cmp_rec(const void *a, const void *b)
+{
+    uint64_t x = ((const rec_t *)a)->seq, y = ((const rec_t *)b)->seq;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * map_pages - Get zeroed memory for the recorder's own tables without
+ *     going through the allocator being recorded
+ */
+static void *map_pages(size_t bytes)
+{
+    void *p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (p == MAP_FAILED) {
+	fprintf(stderr, "mmrecord: mmap failed: %s\n", strerror(errno));
+	abort();
+    }
+    return p;
+}
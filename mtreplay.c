@@ -0,0 +1,348 @@
+/*
+ * mtreplay.c - Multi-threaded trace replay
+ *
+ * Each thread of the trace gets a worker, pinned to a core, that makes
+ * that thread's requests in trace order. A block may be allocated by
+ * one thread and freed by another, so every op carries its position
+ * among the ops on its block, and a worker waits until the ops before
+ * it on the block have completed. Since every worker makes its ops in
+ * trace order, the earliest op not yet made can always go ahead, and
+ * the replay cannot deadlock.
+ *
+ * The workers all wait at a barrier before their first op, so that the
+ * time to create them is not counted.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "mtreplay.h"
+#include "memlib.h"
+#include "config.h"
+#include "pattern.h"
+
+#define SPINS 100   /* polls for a block's turn before yielding the core */
+
+struct mt_plan_t {
+    traceop_t *ops;
+    int num_ops;
+    int num_ids;
+    int nthreads;
+    int *nstream;    /* number of ops of each thread... */
+    int **stream;    /* ...and their indices into ops, in trace order */
+    int *seq;        /* of each op, the number of earlier ops on its block */
+};
+
+/* What the workers of one replay share */
+typedef struct {
+    mt_plan_t *plan;
+    allocator_t *a;
+    int check;                /* fill and verify the blocks */
+    char **blocks;            /* payload of each block id... */
+    int *sizes;               /* ...and its size */
+    int *done;                /* number of ops completed on each block */
+    pthread_barrier_t start;
+    int failed;               /* set by the first worker to fail... */
+    char *msg;                /* ...which says why here */
+} replay_t;
+
+/* One worker */
+typedef struct {
+    replay_t *r;
+    int thread;               /* the trace thread it replays */
+    int cpu;                  /* the core it runs on */
+} worker_t;
+
+static void *worker(void *arg);
+static void fail(replay_t *r, int opnum, char *what);
+
+/*
+ * mt_plan - Split the ops of a trace into one stream per thread
+ */
+mt_plan_t *mt_plan(traceop_t *ops, int num_ops, int num_ids)
+{
+    mt_plan_t *p;
+    int *count;
+    int i, t;
+
+    if ((p = calloc(1, sizeof(mt_plan_t))) == NULL)
+	return NULL;
+    p->ops = ops;
+    p->num_ops = num_ops;
+    p->num_ids = num_ids;
+    for (i = 0; i < num_ops; i++)
+	if (ops[i].thread >= p->nthreads)
+	    p->nthreads = ops[i].thread + 1;
+
+    p->nstream = calloc(p->nthreads, sizeof(int));
+    p->stream = calloc(p->nthreads, sizeof(int *));
+    p->seq = malloc(num_ops * sizeof(int));
+    count = calloc(num_ids, sizeof(int));
+    if (p->nstream == NULL || p->stream == NULL || p->seq == NULL ||
+	count == NULL) {
+	free(count);
+	mt_free_plan(p);
+	return NULL;
+    }
+
+    /* Scopes mean nothing to the replay, so their ops are left out */
+    for (i = 0; i < num_ops; i++) {
+	if (ops[i].type >= SCOPE_BEGIN)
+	    continue;
+	p->nstream[ops[i].thread]++;
+	p->seq[i] = count[ops[i].index]++;
+    }
+    free(count);
+    for (t = 0; t < p->nthreads; t++) {
+	p->stream[t] = malloc((p->nstream[t] + 1) * sizeof(int));
+	if (p->stream[t] == NULL) {
+	    mt_free_plan(p);
+	    return NULL;
+	}
+	p->nstream[t] = 0;
+    }
+    for (i = 0; i < num_ops; i++) {
+	t = ops[i].thread;
+	if (ops[i].type < SCOPE_BEGIN)
+	    p->stream[t][p->nstream[t]++] = i;
+    }
+    return p;
+}
+
+/*
+ * mt_free_plan - Free a plan made by mt_plan
+ */
+void mt_free_plan(mt_plan_t *p)
+{
+    int t;
+
+    if (p->stream != NULL)
+	for (t = 0; t < p->nthreads; t++)
+	    free(p->stream[t]);
+    free(p->stream);
+    free(p->nstream);
+    free(p->seq);
+    free(p);
+}
+
+/*
+ * mt_threads - Number of threads in the trace
+ */
+int mt_threads(mt_plan_t *p)
+{
+    return p->nthreads;
+}
+
+/*
+ * mt_cpus - Number of cores this process may run on
+ */
+int mt_cpus(void)
+{
+    cpu_set_t set;
+
+    if (sched_getaffinity(0, sizeof(set), &set) < 0)
+	return 1;
+    return CPU_COUNT(&set);
+}
+
+/*
+ * mt_replay - Replay the trace with the workers spread over ncpus cores
+ */
+double mt_replay(mt_plan_t *p, allocator_t *a, int ncpus, int check,
+		 char *msg)
+{
+    replay_t r;
+    worker_t *w;
+    pthread_t *tids;
+    cpu_set_t set;
+    struct timespec t0, t1;
+    int cpus[CPU_SETSIZE];
+    int i, t, n, rc;
+
+    /* The cores we may run on, of which we use the first ncpus */
+    CPU_ZERO(&set);
+    sched_getaffinity(0, sizeof(set), &set);
+    for (i = n = 0; i < CPU_SETSIZE && n < ncpus; i++)
+	if (CPU_ISSET(i, &set))
+	    cpus[n++] = i;
+    if (n == 0)
+	cpus[n++] = 0;
+
+    if (a->flags & ALLOC_MEMLIB)
+	mem_reset_brk();
+    if (a->init() < 0) {
+	snprintf(msg, MT_MSGLEN, "init failed");
+	return -1;
+    }
+
+    memset(&r, 0, sizeof(r));
+    r.plan = p;
+    r.a = a;
+    r.check = check;
+    r.msg = msg;
+    r.blocks = calloc(p->num_ids, sizeof(char *));
+    r.sizes = calloc(p->num_ids, sizeof(int));
+    r.done = calloc(p->num_ids, sizeof(int));
+    w = calloc(p->nthreads, sizeof(worker_t));
+    tids = calloc(p->nthreads, sizeof(pthread_t));
+    if (r.blocks == NULL || r.sizes == NULL || r.done == NULL ||
+	w == NULL || tids == NULL) {
+	fprintf(stderr, "calloc failed in mt_replay\n");
+	exit(1);
+    }
+
+    pthread_barrier_init(&r.start, NULL, p->nthreads + 1);
+    for (t = 0; t < p->nthreads; t++) {
+	w[t].r = &r;
+	w[t].thread = t;
+	w[t].cpu = cpus[t % n];
+	if ((rc = pthread_create(&tids[t], NULL, worker, &w[t])) != 0) {
+	    fprintf(stderr, "pthread_create failed in mt_replay: %s\n",
+		    strerror(rc));
+	    exit(1);
+	}
+    }
+    pthread_barrier_wait(&r.start);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (t = 0; t < p->nthreads; t++)
+	pthread_join(tids[t], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    pthread_barrier_destroy(&r.start);
+
+    if (!r.failed && check && a->check != NULL && !a->check())
+	fail(&r, -1, "the heap is inconsistent after the replay");
+
+    /* Give back what the trace left; a memlib heap is simply reset */
+    if (!(a->flags & ALLOC_MEMLIB))
+	for (i = 0; i < p->num_ids; i++)
+	    if (r.blocks[i] != NULL)
+		a->free(r.blocks[i]);
+
+    free(r.blocks);
+    free(r.sizes);
+    free(r.done);
+    free(w);
+    free(tids);
+    if (r.failed)
+	return -1;
+    return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+}
+
+/*
+ * worker - Make the requests of one trace thread
+ */
+static void *worker(void *arg)
+{
+    worker_t *w = (worker_t *)arg;
+    replay_t *r = w->r;
+    mt_plan_t *p = r->plan;
+    allocator_t *a = r->a;
+    traceop_t *op;
+    cpu_set_t set;
+    char *newp;
+    int k, i, id, spins, oldsize;
+
+    CPU_ZERO(&set);
+    CPU_SET(w->cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    pthread_barrier_wait(&r->start);
+
+    for (k = 0; k < p->nstream[w->thread]; k++) {
+	i = p->stream[w->thread][k];
+	op = &p->ops[i];
+	id = op->index;
+
+	/* Wait for the earlier ops on this block, made by other threads */
+	for (spins = 0;
+	     __atomic_load_n(&r->done[id], __ATOMIC_ACQUIRE) != p->seq[i];
+	     spins++) {
+	    if (__atomic_load_n(&r->failed, __ATOMIC_RELAXED))
+		return NULL;
+	    if (spins >= SPINS)
+		sched_yield();
+	}
+
+	switch (op->type) {
+	case ALLOC:
+	    if ((newp = a->malloc(op->size)) == NULL) {
+		fail(r, i, "malloc failed");
+		return NULL;
+	    }
+	    if (r->check) {
+		if ((uintptr_t)newp % ALIGNMENT != 0) {
+		    fail(r, i, "malloc returned a misaligned block");
+		    return NULL;
+		}
+		pat_fill(newp, 0, op->size, id);
+	    }
+	    r->blocks[id] = newp;
+	    r->sizes[id] = op->size;
+	    break;
+
+	case REALLOC:
+	    oldsize = r->sizes[id];
+	    if (r->check && pat_check(r->blocks[id], oldsize, id) < oldsize) {
+		fail(r, i, "a block was overwritten before realloc");
+		return NULL;
+	    }
+	    if ((newp = a->realloc(r->blocks[id], op->size)) == NULL) {
+		fail(r, i, "realloc failed");
+		return NULL;
+	    }
+	    if (r->check) {
+		if ((uintptr_t)newp % ALIGNMENT != 0) {
+		    fail(r, i, "realloc returned a misaligned block");
+		    return NULL;
+		}
+		if (op->size < oldsize)
+		    oldsize = op->size;
+		if (pat_check(newp, oldsize, id) < oldsize) {
+		    fail(r, i, "realloc did not preserve the old data");
+		    return NULL;
+		}
+		pat_fill(newp, oldsize, op->size, id);
+	    }
+	    r->blocks[id] = newp;
+	    r->sizes[id] = op->size;
+	    break;
+
+	case FREE:
+	    if (r->check &&
+		pat_check(r->blocks[id], r->sizes[id], id) < r->sizes[id]) {
+		fail(r, i, "a block was overwritten before it was freed");
+		return NULL;
+	    }
+	    a->free(r->blocks[id]);
+	    r->blocks[id] = NULL;
+	    break;
+
+	case SCOPE_BEGIN: /* mt_plan leaves them out */
+	case SCOPE_END:
+	    break;
+	}
+
+	/* Let the next op on the block go ahead */
+	__atomic_store_n(&r->done[id], p->seq[i] + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+/*
+ * fail - Stop the replay, saying what went wrong at op opnum (or after
+ *     the replay, if opnum < 0) unless some other worker already did
+ */
+static void fail(replay_t *r, int opnum, char *what)
+{
+    if (__atomic_exchange_n(&r->failed, 1, __ATOMIC_ACQ_REL))
+	return;
+    if (opnum < 0)
+	snprintf(r->msg, MT_MSGLEN, "%s", what);
+    else
+	snprintf(r->msg, MT_MSGLEN, "op %d, thread %d: %s", opnum,
+		 r->plan->ops[opnum].thread, what);
+}
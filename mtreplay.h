@@ -0,0 +1,37 @@
+/*
+ * mtreplay.h - Replay of a multi-threaded trace with one worker thread
+ *     per thread of the trace, used by mdriver to measure how the
+ *     throughput of a thread-safe allocator scales with the cores it
+ *     runs on.
+ */
+#ifndef __MTREPLAY_H_
+#define __MTREPLAY_H_
+
+#include "trace.h"
+#include "allocator.h"
+
+#define MT_MSGLEN 256  /* room mt_replay needs to describe a failure */
+
+/* How a trace is split up among the workers */
+typedef struct mt_plan_t mt_plan_t;
+
+/* Split the ops of a trace into one stream per thread */
+mt_plan_t *mt_plan(traceop_t *ops, int num_ops, int num_ids);
+void mt_free_plan(mt_plan_t *plan);
+
+/* Number of threads in the trace, and of cores we may run on */
+int mt_threads(mt_plan_t *plan);
+int mt_cpus(void);
+
+/*
+ * Replay the trace against allocator a with the workers spread over
+ * the first ncpus cores, and return the seconds from the moment they
+ * all start to the moment the last one finishes. If check is set, the
+ * workers also fill every block and verify its contents when it is
+ * reallocated or freed. Returns -1, having described the problem in
+ * msg (MT_MSGLEN bytes), if the allocator fails or a check does.
+ */
+double mt_replay(mt_plan_t *plan, allocator_t *a, int ncpus, int check,
+		 char *msg);
+
+#endif /* __MTREPLAY_H_ */
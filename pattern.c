@@ -0,0 +1,112 @@
+/*
+ * pattern.c - Block fill pattern and its check; see pattern.h
+ */
+#include <stdint.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "pattern.h"
+
+#define PAT_STEP 0x9e3779b97f4a7c15ULL /* odd, so low bytes cycle too */
+
+/* function prototypes for internal helper routines */
+static uint64_t seed(int id);
+
+/*
+ * pat_fill - Fill bytes off to size-1 of a payload with its pattern:
+ *     the odd bytes of a first partial word, then whole words, then
+ *     the bytes of a last partial word
+ */
+void pat_fill(char *p, size_t off, size_t size, int id)
+{
+    uint64_t w = seed(id) + (uint64_t)(off / 8) * PAT_STEP;
+    size_t i = off & ~(size_t)7;
+    char buf[8];
+    size_t j;
+
+    if (off >= size)
+	return;
+    if (i < off) {
+	memcpy(buf, &w, 8);
+	for (j = off - i; j < 8 && i + j < size; j++)
+	    p[i + j] = buf[j];
+	i += 8;
+	w += PAT_STEP;
+    }
+
+#ifdef __SSE2__
+    {
+	__m128i e = _mm_set_epi64x(w + PAT_STEP, w);
+	__m128i step = _mm_set1_epi64x(2 * PAT_STEP);
+
+	for (; i + 16 <= size; i += 16, w += 2 * PAT_STEP) {
+	    _mm_storeu_si128((__m128i *)(p + i), e);
+	    e = _mm_add_epi64(e, step);
+	}
+    }
+#endif
+    for (; i + 8 <= size; i += 8, w += PAT_STEP)
+	memcpy(p + i, &w, 8);
+
+    if (i < size) {
+	memcpy(buf, &w, 8);
+	for (j = 0; i + j < size; j++)
+	    p[i + j] = buf[j];
+    }
+}
+
+/*
+ * pat_check - Compare a payload with its pattern a vector or a word at
+ *     a time, and find the first bad byte within the first bad word
+ */
+size_t pat_check(const char *p, size_t size, int id)
+{
+    uint64_t w = seed(id);
+    uint64_t v;
+    size_t i = 0;
+    char buf[8];
+    size_t j;
+
+#ifdef __SSE2__
+    {
+	__m128i e = _mm_set_epi64x(w + PAT_STEP, w);
+	__m128i step = _mm_set1_epi64x(2 * PAT_STEP);
+	__m128i x;
+
+	for (; i + 16 <= size; i += 16, w += 2 * PAT_STEP) {
+	    x = _mm_loadu_si128((const __m128i *)(p + i));
+	    if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, e)) != 0xffff)
+		break;
+	    e = _mm_add_epi64(e, step);
+	}
+    }
+#endif
+    for (; i + 8 <= size; i += 8, w += PAT_STEP) {
+	memcpy(&v, p + i, 8);
+	if (v != w)
+	    break;
+    }
+
+    /* At most one bad word, or the partial last word, is left */
+    for (; i < size; i += 8, w += PAT_STEP) {
+	memcpy(buf, &w, 8);
+	for (j = 0; j < 8 && i + j < size; j++)
+	    if (p[i + j] != buf[j])
+		return i + j;
+    }
+    return size;
+}
+
+/*
+ * seed - The first word of block id's pattern (the splitmix64 finalizer)
+ */
+static uint64_t seed(int id)
+{
+    uint64_t z = (uint64_t)id * PAT_STEP + PAT_STEP;
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
@@ -0,0 +1,30 @@
+/*
+ * pattern.h - The bytes mdriver fills every block with, and a fast check
+ *     that they are still there.
+ *
+ * Byte i of the payload of block id is byte i%8, in host byte order, of
+ * the 64-bit word seed(id) + (i/8)*PAT_STEP, where seed is a hash of the
+ * id. So a block holds different bytes at different offsets, and other
+ * bytes than every other block: data that realloc copies to the wrong
+ * offset, a neighbour's payload, or a header or list pointer that the
+ * allocator writes into a live block all fail the check, where a fill
+ * with the low byte of the id would often miss them.
+ *
+ * The words are compared 16 bytes at a time with SSE2 where the
+ * compiler targets it, and a word at a time elsewhere.
+ */
+#ifndef __PATTERN_H_
+#define __PATTERN_H_
+
+#include <stddef.h>
+
+/* Fill bytes off to size-1 of block id's payload p with its pattern */
+void pat_fill(char *p, size_t off, size_t size, int id);
+
+/*
+ * Offset of the first of the size bytes of p that is not block id's
+ * pattern, or size if they all are
+ */
+size_t pat_check(const char *p, size_t size, int id);
+
+#endif /* __PATTERN_H_ */
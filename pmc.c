@@ -0,0 +1,128 @@
+/*
+ * pmc.c - Hardware performance counters via perf_event_open(2)
+ *
+ * The counters count user-mode events of the calling thread only, which
+ * is all an unprivileged process may count when perf_event_paranoid is
+ * 2, the usual default. If the kernel has no perf events, or forbids
+ * them altogether, pmc_open simply returns 0.
+ *
+ * Six counters do not always fit on the CPU at once. The kernel then
+ * time-slices them, and pmc_stop scales each count by the fraction of
+ * the time it was actually on the CPU.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "pmc.h"
+
+#define CACHE_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct {
+    char *name;
+    uint32_t type;
+    uint64_t config;
+} events[PMC_NUM] = {
+    [PMC_CYCLES]    = {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    [PMC_INSTRS]    = {"instrs", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    [PMC_L1D_MISS]  = {"L1D-miss", PERF_TYPE_HW_CACHE,
+		       CACHE_MISS(PERF_COUNT_HW_CACHE_L1D)},
+    [PMC_LLC_MISS]  = {"LLC-miss", PERF_TYPE_HW_CACHE,
+		       CACHE_MISS(PERF_COUNT_HW_CACHE_LL)},
+    [PMC_DTLB_MISS] = {"dTLB-miss", PERF_TYPE_HW_CACHE,
+		       CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB)},
+    [PMC_BR_MISS]   = {"br-miss", PERF_TYPE_HARDWARE,
+		       PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+/* Global variables */
+static int fds[PMC_NUM] = {-1, -1, -1, -1, -1, -1};
+
+/*
+ * pmc_open - Open the counters for this thread
+ */
+int pmc_open(void)
+{
+    struct perf_event_attr attr;
+    int i, n = 0;
+
+    for (i = 0; i < PMC_NUM; i++) {
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = events[i].type;
+	attr.config = events[i].config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+	    PERF_FORMAT_TOTAL_TIME_RUNNING;
+	fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	if (fds[i] >= 0)
+	    n++;
+    }
+    return n;
+}
+
+/*
+ * pmc_name - Short name of counter i
+ */
+const char *pmc_name(int i)
+{
+    return events[i].name;
+}
+
+/*
+ * pmc_start - Zero and start the open counters
+ */
+void pmc_start(void)
+{
+    int i;
+
+    for (i = 0; i < PMC_NUM; i++) {
+	if (fds[i] < 0)
+	    continue;
+	ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+	ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+/*
+ * pmc_stop - Stop the counters and read them into *c
+ */
+void pmc_stop(pmc_counts_t *c)
+{
+    uint64_t buf[3];   /* value, time enabled, time running */
+    int i;
+
+    for (i = 0; i < PMC_NUM; i++)
+	if (fds[i] >= 0)
+	    ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+    for (i = 0; i < PMC_NUM; i++) {
+	c->valid[i] = 0;
+	c->count[i] = 0;
+	if (fds[i] < 0 || read(fds[i], buf, sizeof(buf)) != sizeof(buf) ||
+	    buf[2] == 0)
+	    continue;
+	c->valid[i] = 1;
+	c->count[i] = (double)buf[0] * buf[1] / buf[2];
+    }
+}
+
+/*
+ * pmc_close - Close the counters
+ */
+void pmc_close(void)
+{
+    int i;
+
+    for (i = 0; i < PMC_NUM; i++) {
+	if (fds[i] >= 0)
+	    close(fds[i]);
+	fds[i] = -1;
+    }
+}
@@ -0,0 +1,38 @@
+/*
+ * pmc.h - Hardware performance counters via perf_event_open(2), used by
+ *     mdriver to explain where the time of a trace goes.
+ *
+ * Each counter is opened on its own, so one the CPU or the kernel does
+ * not provide (or does not let us use) leaves the others working.
+ */
+#ifndef __PMC_H_
+#define __PMC_H_
+
+#include <stdint.h>
+
+enum {
+    PMC_CYCLES, PMC_INSTRS, PMC_L1D_MISS, PMC_LLC_MISS, PMC_DTLB_MISS,
+    PMC_BR_MISS, PMC_NUM
+};
+
+typedef struct {
+    int valid[PMC_NUM];      /* was counter i counting? */
+    double count[PMC_NUM];   /* its count, scaled up if it was multiplexed */
+} pmc_counts_t;
+
+/* Open the counters for this thread. Return how many could be opened */
+int pmc_open(void);
+
+/* Short name of counter i */
+const char *pmc_name(int i);
+
+/* Zero and start the open counters */
+void pmc_start(void);
+
+/* Stop the counters and read them into *c */
+void pmc_stop(pmc_counts_t *c);
+
+/* Close the counters */
+void pmc_close(void);
+
+#endif /* __PMC_H_ */
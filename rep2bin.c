@@ -0,0 +1,138 @@
+/*
+ * rep2bin.c - Convert a text .rep trace into the binary trace format
+ *     described in trace.h, which mdriver can mmap and replay in place.
+ *
+ * usage: rep2bin <in.rep> <out.bin>
+ *
+ * The ops are streamed to the output as they are parsed, so converting
+ * a trace takes constant memory no matter how long it is.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "trace.h"
+
+#define MAXLINE  1024 /* max string size */
+#define OPBUF    4096 /* ops buffered between writes */
+
+static void app_error(char *msg);
+static void unix_error(char *msg);
+
+int main(int argc, char **argv)
+{
+    FILE *in, *out;
+    tracehdr_t hdr;
+    traceop_t buf[OPBUF];
+    char type[MAXLINE];
+    char msg[MAXLINE];
+    unsigned index, size;
+    int optype, thread;
+    long max_index = -1;
+    long op_index = 0;
+    int n = 0;
+
+    if (argc != 3) {
+	fprintf(stderr, "usage: %s <in.rep> <out.bin>\n", argv[0]);
+	exit(1);
+    }
+    if ((in = fopen(argv[1], "r")) == NULL) {
+	sprintf(msg, "Could not open %s", argv[1]);
+	unix_error(msg);
+    }
+    if ((out = fopen(argv[2], "w")) == NULL) {
+	sprintf(msg, "Could not create %s", argv[2]);
+	unix_error(msg);
+    }
+
+    /* Read the .rep header; the binary header is rewritten at the end */
+    memset(&hdr, 0, sizeof(hdr));
+    if (fscanf(in, "%d %d %d %d", &hdr.sugg_heapsize, &hdr.num_ids,
+	       &hdr.num_ops, &hdr.weight) != 4)
+	app_error("Malformed trace header");
+    hdr.magic = TRACE_MAGIC;
+    hdr.version = TRACE_VERSION;
+    hdr.oplen = sizeof(traceop_t);
+    hdr.checksum = TRACE_CKSUM_INIT;
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1)
+	unix_error("fwrite failed");
+
+    /* Convert every request line, flushing the buffer as it fills */
+    memset(buf, 0, sizeof(buf));
+    while (fscanf(in, "%s", type) != EOF) {
+	optype = trace_optype(type, &thread);
+	switch (optype) {
+	case 'a':
+	case 'r':
+	    if (fscanf(in, "%u %u", &index, &size) != 2)
+		app_error("Malformed alloc/realloc line");
+	    buf[n].type = (optype == 'a') ? ALLOC : REALLOC;
+	    buf[n].size = size;
+	    break;
+	case 'f':
+	    if (fscanf(in, "%u", &index) != 1)
+		app_error("Malformed free line");
+	    buf[n].type = FREE;
+	    buf[n].size = 0;
+	    break;
+	case 'b':
+	case 'e':
+	    index = 0;
+	    buf[n].type = (optype == 'b') ? SCOPE_BEGIN : SCOPE_END;
+	    buf[n].size = 0;
+	    break;
+	default:
+	    snprintf(msg, sizeof(msg), "Bogus request (%.64s) in tracefile %s",
+		     type, argv[1]);
+	    app_error(msg);
+	}
+	buf[n].index = index;
+	buf[n].thread = thread;
+	max_index = ((long)index > max_index) ? (long)index : max_index;
+	op_index++;
+
+	if (++n == OPBUF) {
+	    hdr.checksum = trace_checksum(hdr.checksum, buf, n);
+	    if (fwrite(buf, sizeof(traceop_t), n, out) != n)
+		unix_error("fwrite failed");
+	    n = 0;
+	}
+    }
+    hdr.checksum = trace_checksum(hdr.checksum, buf, n);
+    if (fwrite(buf, sizeof(traceop_t), n, out) != n)
+	unix_error("fwrite failed");
+    fclose(in);
+
+    /* Same consistency checks that read_trace makes on .rep files */
+    if (max_index != hdr.num_ids - 1 || op_index != hdr.num_ops) {
+	sprintf(msg, "Header says %d ids and %d ops, but found %ld and %ld",
+		hdr.num_ids, hdr.num_ops, max_index + 1, op_index);
+	app_error(msg);
+    }
+
+    rewind(out);
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1)
+	unix_error("fwrite failed");
+    if (fclose(out) != 0)
+	unix_error("fclose failed");
+    return 0;
+}
+
+/* 
+ * app_error - Report an arbitrary application error
+ */
+static void app_error(char *msg) 
+{
+    fprintf(stderr, "%s\n", msg);
+    exit(1);
+}
+
+/* 
+ * unix_error - Report a Unix-style error
+ */
+static void unix_error(char *msg) 
+{
+    fprintf(stderr, "%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
@@ -0,0 +1,543 @@
+/*
+ * report.c - Machine-readable mdriver results, and baseline comparison
+ *
+ * report_json writes every stats_t field of every trace, for each
+ * allocator that was run, together with the driver's configuration and
+ * the git revision it was built from:
+ *
+ *   { "revision": ..., "config": { ... },
+ *     "allocators": [ { "name": "mm", "perfidx": ..., "traces": [
+ *         { "name": ..., "valid": ..., "ops": ..., "secs": ..., ... },
+ *         ... ] }, ... ] }
+ *
+ * report_compare reads such a file back with a small JSON parser, and
+ * matches allocators and traces by name. A trace's throughput counts as
+ * a regression only if it dropped by more than NOISE_K standard
+ * deviations of the run-to-run noise, estimated from the MADs of both
+ * runs; utilization does not depend on timing, so any drop beyond
+ * UTIL_EPS counts.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "report.h"
+#include "mm.h"
+#include "config.h"
+
+#ifndef REVISION
+#define REVISION "unknown"
+#endif
+#ifndef BUILD_CFLAGS
+#define BUILD_CFLAGS ""
+#endif
+
+#if USE_FCYC
+#define TIMER "fcyc"
+#elif USE_ITIMER
+#define TIMER "itimer"
+#elif USE_GETTOD
+#define TIMER "gettod"
+#elif USE_RTIMER
+#define TIMER "rtimer"
+#endif
+
+#define MAD_SIGMA  1.4826  /* MAD to standard deviation, for normal noise */
+#define NOISE_K    3.0     /* regressions must exceed this many sigmas */
+#define MIN_NOISE  0.01    /* and at least a 1% drop in throughput */
+#define UTIL_EPS   0.001   /* utilization drops beyond this are regressions */
+
+/* A node of a parsed JSON document */
+typedef struct jnode {
+    enum {J_NULL, J_BOOL, J_NUM, J_STR, J_ARR, J_OBJ} type;
+    double num;              /* J_NUM and J_BOOL value */
+    char *str;               /* J_STR value */
+    char *key;               /* member name, for the members of a J_OBJ */
+    struct jnode *child;     /* first element or member */
+    struct jnode *next;      /* next sibling */
+} jnode_t;
+
+/* function prototypes for internal helper routines */
+static void json_string(FILE *fp, const char *s);
+static void json_number(FILE *fp, int valid, double x);
+static void csv_number(FILE *fp, int valid, double x);
+static jnode_t *json_parse(const char **p);
+static char *json_parse_string(const char **p);
+static void json_free(jnode_t *n);
+static jnode_t *json_get(jnode_t *obj, const char *key);
+static double json_num(jnode_t *obj, const char *key, double dflt);
+static jnode_t *json_find(jnode_t *arr, const char *name);
+
+/*
+ * report_json - Write the results to file as JSON
+ */
+int report_json(char *file, result_t *res, int nres)
+{
+    FILE *fp;
+    stats_t *st;
+    int i, j, k;
+
+    if ((fp = fopen(file, "w")) == NULL)
+	return -1;
+
+    fprintf(fp, "{\n  \"revision\": ");
+    json_string(fp, REVISION);
+    fprintf(fp, ",\n  \"config\": {\n    \"team\": ");
+    json_string(fp, team.teamname);
+    fprintf(fp, ",\n    \"timer\": \"%s\",\n", TIMER);
+    fprintf(fp, "    \"cflags\": ");
+    json_string(fp, BUILD_CFLAGS);
+    fprintf(fp, ",\n    \"alignment\": %d,\n", ALIGNMENT);
+    fprintf(fp, "    \"max_heap\": %d,\n", MAX_HEAP);
+    fprintf(fp, "    \"word_size\": %d,\n", (int)sizeof(void *));
+    fprintf(fp, "    \"util_weight\": %g,\n", UTIL_WEIGHT);
+    fprintf(fp, "    \"avg_libc_thruput\": %g\n  },\n", AVG_LIBC_THRUPUT);
+
+    fprintf(fp, "  \"allocators\": [");
+    for (i = 0; i < nres; i++) {
+	fprintf(fp, "%s\n    {\n      \"name\": ", i ? "," : "");
+	json_string(fp, res[i].name);
+	fprintf(fp, ",\n      \"perfidx\": ");
+	json_number(fp, res[i].perfidx >= 0, res[i].perfidx);
+	fprintf(fp, ",\n      \"traces\": [");
+	for (j = 0; j < res[i].n; j++) {
+	    st = &res[i].stats[j];
+	    fprintf(fp, "%s\n        {\"name\": ", j ? "," : "");
+	    json_string(fp, res[i].tracefiles[j]);
+	    fprintf(fp, ", \"valid\": %d, \"ops\": %.0f", st->valid, st->ops);
+	    fprintf(fp, ",\n         \"secs\": ");
+	    json_number(fp, st->valid, st->secs);
+	    fprintf(fp, ", \"mad\": ");
+	    json_number(fp, st->valid, st->mad);
+	    fprintf(fp, ", \"ci_lo\": ");
+	    json_number(fp, st->valid, st->ci_lo);
+	    fprintf(fp, ", \"ci_hi\": ");
+	    json_number(fp, st->valid, st->ci_hi);
+	    fprintf(fp, ", \"driver_secs\": ");
+	    json_number(fp, st->valid && st->driver_secs > 0, st->driver_secs);
+	    fprintf(fp, ",\n         \"kops\": ");
+	    json_number(fp, st->valid && st->secs > 0,
+			(st->ops/1e3)/st->secs);
+	    fprintf(fp, ", \"net_kops\": ");
+	    json_number(fp, st->valid && st->driver_secs > 0 &&
+			st->secs > st->driver_secs,
+			(st->ops/1e3)/(st->secs - st->driver_secs));
+	    fprintf(fp, ", \"util\": ");
+	    json_number(fp, st->valid, st->util);
+	    fprintf(fp, ", \"avg_util\": ");
+	    json_number(fp, st->valid, st->avg_util);
+	    fprintf(fp, ", \"int_frag\": ");
+	    json_number(fp, st->valid && st->int_frag >= 0, st->int_frag);
+	    fprintf(fp, ", \"ext_frag\": ");
+	    json_number(fp, st->valid && st->ext_frag >= 0, st->ext_frag);
+	    fprintf(fp, ", \"last_growth\": ");
+	    json_number(fp, st->valid, st->last_growth);
+	    fprintf(fp, ", \"moved_bytes\": ");
+	    json_number(fp, st->valid, st->moved_bytes);
+	    fprintf(fp, ", \"remap_bytes\": ");
+	    json_number(fp, st->valid, st->remap_bytes);
+	    fprintf(fp, ", \"purge_bytes\": ");
+	    json_number(fp, st->valid, st->purge_bytes);
+	    fprintf(fp, ", \"heap_bytes\": ");
+	    json_number(fp, st->valid, st->heap_bytes);
+	    fprintf(fp, ", \"rss_bytes\": ");
+	    json_number(fp, st->valid, st->rss_bytes);
+	    fprintf(fp, ", \"arena_kops\": ");
+	    json_number(fp, st->valid && st->arena_secs > 0,
+			(st->ops/1e3)/st->arena_secs);
+	    fprintf(fp, ", \"arena_util\": ");
+	    json_number(fp, st->valid && st->arena_secs > 0, st->arena_util);
+	    fprintf(fp, ",\n         \"pmc\": {");
+	    for (k = 0; k < PMC_NUM; k++) {
+		fprintf(fp, "%s\"%s\": ", k ? ", " : "", pmc_name(k));
+		json_number(fp, st->valid && st->pmc.valid[k],
+			    st->pmc.count[k]);
+	    }
+	    fprintf(fp, "}}");
+	}
+	fprintf(fp, "\n      ]\n    }");
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    return fclose(fp) == 0 ? 0 : -1;
+}
+
+/*
+ * report_csv - Write the results to file as CSV, one row per allocator
+ *     and trace
+ */
+int report_csv(char *file, result_t *res, int nres)
+{
+    FILE *fp;
+    stats_t *st;
+    int i, j, k;
+
+    if ((fp = fopen(file, "w")) == NULL)
+	return -1;
+
+    fprintf(fp, "revision,timer,allocator,trace,valid,ops,secs,mad,"
+	    "ci_lo,ci_hi,driver_secs,kops,net_kops,util,avg_util,int_frag,"
+	    "ext_frag,last_growth,moved_bytes,remap_bytes,purge_bytes,"
+	    "heap_bytes,rss_bytes,arena_kops,arena_util");
+    for (k = 0; k < PMC_NUM; k++)
+	fprintf(fp, ",%s", pmc_name(k));
+    fprintf(fp, "\n");
+
+    for (i = 0; i < nres; i++) {
+	for (j = 0; j < res[i].n; j++) {
+	    st = &res[i].stats[j];
+	    fprintf(fp, "%s,%s,%s,\"%s\",%d,%.0f", REVISION, TIMER,
+		    res[i].name, res[i].tracefiles[j], st->valid, st->ops);
+	    csv_number(fp, st->valid, st->secs);
+	    csv_number(fp, st->valid, st->mad);
+	    csv_number(fp, st->valid, st->ci_lo);
+	    csv_number(fp, st->valid, st->ci_hi);
+	    csv_number(fp, st->valid && st->driver_secs > 0, st->driver_secs);
+	    csv_number(fp, st->valid && st->secs > 0, (st->ops/1e3)/st->secs);
+	    csv_number(fp, st->valid && st->driver_secs > 0 &&
+		       st->secs > st->driver_secs,
+		       (st->ops/1e3)/(st->secs - st->driver_secs));
+	    csv_number(fp, st->valid, st->util);
+	    csv_number(fp, st->valid, st->avg_util);
+	    csv_number(fp, st->valid && st->int_frag >= 0, st->int_frag);
+	    csv_number(fp, st->valid && st->ext_frag >= 0, st->ext_frag);
+	    csv_number(fp, st->valid, st->last_growth);
+	    csv_number(fp, st->valid, st->moved_bytes);
+	    csv_number(fp, st->valid, st->remap_bytes);
+	    csv_number(fp, st->valid, st->purge_bytes);
+	    csv_number(fp, st->valid, st->heap_bytes);
+	    csv_number(fp, st->valid, st->rss_bytes);
+	    csv_number(fp, st->valid && st->arena_secs > 0,
+		       (st->ops/1e3)/st->arena_secs);
+	    csv_number(fp, st->valid && st->arena_secs > 0, st->arena_util);
+	    for (k = 0; k < PMC_NUM; k++)
+		csv_number(fp, st->valid && st->pmc.valid[k],
+			   st->pmc.count[k]);
+	    fprintf(fp, "\n");
+	}
+    }
+    return fclose(fp) == 0 ? 0 : -1;
+}
+
+/*
+ * report_compare - Compare the results against a JSON baseline
+ */
+int report_compare(char *baseline, result_t *res, int nres)
+{
+    FILE *fp;
+    char *buf;
+    const char *p;
+    long len;
+    jnode_t *doc, *base, *tb;
+    stats_t *st;
+    double bsecs, bmad, butil, change, noise, rc, rb;
+    int i, j, bad, regressions = 0;
+
+    /* Read and parse the whole baseline */
+    if ((fp = fopen(baseline, "r")) == NULL)
+	return -1;
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    rewind(fp);
+    if (len < 0 || (buf = malloc(len + 1)) == NULL) {
+	fclose(fp);
+	return -1;
+    }
+    len = fread(buf, 1, len, fp);
+    buf[len] = '\0';
+    fclose(fp);
+    p = buf;
+    doc = json_parse(&p);
+    free(buf);
+    if (doc == NULL || doc->type != J_OBJ)
+	goto bad_baseline;
+
+    printf("Comparison with %s (revision %s):\n", baseline,
+	   json_get(doc, "revision") && json_get(doc, "revision")->str ?
+	   json_get(doc, "revision")->str : "unknown");
+    for (i = 0; i < nres; i++) {
+	if ((base = json_find(json_get(doc, "allocators"), res[i].name))
+	    == NULL) {
+	    printf("%s: not in the baseline\n", res[i].name);
+	    continue;
+	}
+	printf("%s:\n%5s%10s%10s%9s%8s%8s%8s\n", res[i].name, "trace",
+	       "base Kops", "Kops", "change", "noise", "b.util", "util");
+	for (j = 0; j < res[i].n; j++) {
+	    st = &res[i].stats[j];
+	    tb = json_find(json_get(base, "traces"), res[i].tracefiles[j]);
+
+	    /* A trace that was valid and is no longer is the worst of all */
+	    if (!st->valid && tb != NULL && json_num(tb, "valid", 0) != 0) {
+		printf("%2d%13s  INVALID\n", j, "-");
+		regressions++;
+		continue;
+	    }
+	    if (!st->valid || tb == NULL || json_num(tb, "valid", 0) == 0) {
+		printf("%2d%13s\n", j, "-");
+		continue;
+	    }
+	    bsecs = json_num(tb, "secs", 0);
+	    bmad = json_num(tb, "mad", 0);
+	    butil = json_num(tb, "util", 0);
+	    if (bsecs <= 0 || st->secs <= 0) {
+		printf("%2d%13s\n", j, "-");
+		continue;
+	    }
+
+	    /* Relative noise of the two medians, combined */
+	    rb = MAD_SIGMA * bmad / bsecs;
+	    rc = MAD_SIGMA * st->mad / st->secs;
+	    noise = NOISE_K * sqrt(rb*rb + rc*rc);
+	    if (noise < MIN_NOISE)
+		noise = MIN_NOISE;
+	    change = bsecs / st->secs - 1;  /* relative throughput change */
+
+	    bad = 0;
+	    if (change < -noise)
+		bad |= 1;
+	    if (st->util < butil - UTIL_EPS)
+		bad |= 2;
+	    printf("%2d%13.0f%10.0f%8.1f%%%7.1f%%%7.0f%%%7.0f%%  %s%s\n", j,
+		   (st->ops/1e3)/bsecs, (st->ops/1e3)/st->secs,
+		   change*100, noise*100, butil*100, st->util*100,
+		   (bad & 1) ? "SLOWER " : "", (bad & 2) ? "LESS-UTIL" : "");
+	    if (bad)
+		regressions++;
+	}
+    }
+    json_free(doc);
+    return regressions;
+
+ bad_baseline:
+    json_free(doc);
+    return -1;
+}
+
+/**************************
+ * Internal helper routines
+ **************************/
+
+/*
+ * json_string - Write s as a quoted JSON string
+ */
+static void json_string(FILE *fp, const char *s)
+{
+    putc('"', fp);
+    for (; s && *s; s++) {
+	if (*s == '"' || *s == '\\')
+	    fprintf(fp, "\\%c", *s);
+	else if ((unsigned char)*s < 0x20)
+	    fprintf(fp, "\\u%04x", *s);
+	else
+	    putc(*s, fp);
+    }
+    putc('"', fp);
+}
+
+/*
+ * json_number - Write x, or null if it is not valid
+ */
+static void json_number(FILE *fp, int valid, double x)
+{
+    if (valid)
+	fprintf(fp, "%.9g", x);
+    else
+	fprintf(fp, "null");
+}
+
+/*
+ * csv_number - Write a comma and x, or just the comma if x is not valid
+ */
+static void csv_number(FILE *fp, int valid, double x)
+{
+    if (valid)
+	fprintf(fp, ",%.9g", x);
+    else
+	putc(',', fp);
+}
+
+/*
+ * json_parse - Parse the JSON value at *p, advancing *p past it.
+ *     Return NULL if it is malformed.
+ */
+static jnode_t *json_parse(const char **p)
+{
+    jnode_t *n, *kid, **tail;
+    const char *s;
+    char *end;
+
+    while (**p == ' ' || **p == '\t' || **p == '\n' || **p == '\r')
+	(*p)++;
+    if ((n = calloc(1, sizeof(jnode_t))) == NULL)
+	return NULL;
+    s = *p;
+
+    if (*s == '{' || *s == '[') {
+	n->type = (*s == '{') ? J_OBJ : J_ARR;
+	tail = &n->child;
+	(*p)++;
+	for (;;) {
+	    while (**p == ' ' || **p == '\t' || **p == '\n' || **p == '\r')
+		(*p)++;
+	    if (**p == (n->type == J_OBJ ? '}' : ']')) {
+		(*p)++;
+		return n;
+	    }
+	    if (n->child != NULL) {
+		if (**p != ',')
+		    goto bad;
+		(*p)++;
+		while (**p == ' ' || **p == '\t' || **p == '\n' || **p == '\r')
+		    (*p)++;
+	    }
+	    end = NULL;
+	    if (n->type == J_OBJ) {
+		if (**p != '"' || (end = json_parse_string(p)) == NULL)
+		    goto bad;
+		while (**p == ' ' || **p == '\t' || **p == '\n' || **p == '\r')
+		    (*p)++;
+		if (**p != ':') {
+		    free(end);
+		    goto bad;
+		}
+		(*p)++;
+	    }
+	    if ((kid = json_parse(p)) == NULL) {
+		free(end);
+		goto bad;
+	    }
+	    kid->key = end;
+	    *tail = kid;
+	    tail = &kid->next;
+	}
+    }
+    else if (*s == '"') {
+	n->type = J_STR;
+	if ((n->str = json_parse_string(p)) == NULL)
+	    goto bad;
+    }
+    else if (!strncmp(s, "true", 4) || !strncmp(s, "false", 5)) {
+	n->type = J_BOOL;
+	n->num = (*s == 't');
+	*p += (*s == 't') ? 4 : 5;
+    }
+    else if (!strncmp(s, "null", 4)) {
+	n->type = J_NULL;
+	*p += 4;
+    }
+    else {
+	n->type = J_NUM;
+	n->num = strtod(s, &end);
+	if (end == s)
+	    goto bad;
+	*p = end;
+    }
+    return n;
+
+ bad:
+    json_free(n);
+    return NULL;
+}
+
+/*
+ * json_parse_string - Parse the string literal at *p into a new string.
+ *     \uXXXX escapes are kept only for ASCII.
+ */
+static char *json_parse_string(const char **p)
+{
+    const char *s = *p + 1;
+    char *str, *d;
+
+    if ((str = d = malloc(strlen(s) + 1)) == NULL)
+	return NULL;
+    for (; *s && *s != '"'; s++) {
+	if (*s != '\\') {
+	    *d++ = *s;
+	    continue;
+	}
+	switch (*++s) {
+	case 'n': *d++ = '\n'; break;
+	case 't': *d++ = '\t'; break;
+	case 'r': *d++ = '\r'; break;
+	case 'b': *d++ = '\b'; break;
+	case 'f': *d++ = '\f'; break;
+	case 'u':
+	    if (strlen(s) < 5)
+		goto bad;
+	    *d++ = (char)strtol((char[]){s[1], s[2], s[3], s[4], 0}, NULL, 16);
+	    s += 4;
+	    break;
+	case '\0':
+	    goto bad;
+	default: *d++ = *s; break;
+	}
+    }
+    if (*s != '"')
+	goto bad;
+    *d = '\0';
+    *p = s + 1;
+    return str;
+
+ bad:
+    free(str);
+    return NULL;
+}
+
+/*
+ * json_free - Free a parsed JSON value
+ */
+static void json_free(jnode_t *n)
+{
+    jnode_t *kid, *next;
+
+    if (n == NULL)
+	return;
+    for (kid = n->child; kid != NULL; kid = next) {
+	next = kid->next;
+	json_free(kid);
+    }
+    free(n->str);
+    free(n->key);
+    free(n);
+}
+
+/*
+ * json_get - The member key of object obj, or NULL
+ */
+static jnode_t *json_get(jnode_t *obj, const char *key)
+{
+    jnode_t *kid;
+
+    if (obj == NULL || obj->type != J_OBJ)
+	return NULL;
+    for (kid = obj->child; kid != NULL; kid = kid->next)
+	if (!strcmp(kid->key, key))
+	    return kid;
+    return NULL;
+}
+
+/*
+ * json_num - The numeric member key of object obj, or dflt
+ */
+static double json_num(jnode_t *obj, const char *key, double dflt)
+{
+    jnode_t *n = json_get(obj, key);
+
+    return (n && (n->type == J_NUM || n->type == J_BOOL)) ? n->num : dflt;
+}
+
+/*
+ * json_find - The object in array arr whose "name" member is name, or NULL
+ */
+static jnode_t *json_find(jnode_t *arr, const char *name)
+{
+    jnode_t *kid, *n;
+
+    if (arr == NULL || arr->type != J_ARR)
+	return NULL;
+    for (kid = arr->child; kid != NULL; kid = kid->next)
+	if ((n = json_get(kid, "name")) && n->type == J_STR &&
+	    !strcmp(n->str, name))
+	    return kid;
+    return NULL;
+}
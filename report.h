@@ -0,0 +1,61 @@
+/*
+ * report.h - Machine-readable mdriver results (JSON and CSV), and
+ *     comparison of a run against a saved JSON baseline.
+ */
+#ifndef __REPORT_H_
+#define __REPORT_H_
+
+#include "pmc.h"
+
+/* Summarizes the important stats for some malloc function on some trace */
+typedef struct {
+    /* defined for both libc malloc and student malloc package (mm.c) */
+    double ops;      /* number of ops (malloc/free/realloc) in the trace */
+    int valid;       /* was the trace processed correctly by the allocator? */
+    double secs;     /* number of secs needed to run the trace */
+    double mad;      /* median absolute deviation of secs */
+    double ci_lo;    /* 95% confidence interval for secs */
+    double ci_hi;
+    double driver_secs; /* of secs, the driver's own overhead (-n), or 0 */
+
+    /* defined only for the student malloc package */
+    double util;     /* space utilization for this trace (always 0 for libc) */
+    double avg_util; /* payload over heap size, averaged over the ops */
+    double int_frag; /* 1 - payload / bytes in allocated blocks, averaged
+			over the heap samples (-s), or < 0 if not sampled */
+    double ext_frag; /* 1 - largest free block / free bytes, averaged over
+			the heap samples (-s), or < 0 if not sampled */
+    double last_growth; /* fraction of the ops done when the heap last grew */
+    double moved_bytes; /* payload bytes that reallocs moved to a new block */
+    double remap_bytes; /* bytes the allocator moved by remapping pages */
+    double purge_bytes; /* bytes of free pages the allocator gave back */
+    double heap_bytes;  /* heap size at the end of the trace */
+    double rss_bytes;   /* bytes of the heap resident then */
+    double arena_secs;  /* secs to run the trace with its scopes' blocks
+			   in arenas (-A), or 0 if not run */
+    double arena_util;  /* space utilization of that run */
+    pmc_counts_t pmc;/* hardware counters per run of the trace (-c) */
+
+    /* Note: secs and util are only defined if valid is true */
+} stats_t;
+
+/* The results of one allocator over the set of traces */
+typedef struct {
+    char *name;          /* allocator, e.g. "mm" or "libc" */
+    int n;               /* number of traces */
+    char **tracefiles;   /* their file names */
+    stats_t *stats;      /* and the allocator's stats on each */
+    double perfidx;      /* performance index, or < 0 if not computed */
+} result_t;
+
+/* Write the results to file as JSON or as CSV. Return 0, or -1 on error */
+int report_json(char *file, result_t *res, int nres);
+int report_csv(char *file, result_t *res, int nres);
+
+/* Compare the results with those in the JSON file baseline, print each
+   trace that got slower or less space-efficient by more than the noise,
+   or that was valid and is not, and return how many did, or -1 if the
+   baseline cannot be read */
+int report_compare(char *baseline, result_t *res, int nres);
+
+#endif /* __REPORT_H_ */
@@ -0,0 +1,252 @@
+/*
+ * rtimer.c - A statistically robust function timer
+ *
+ * The clock is the invariant TSC, read with rdtscp (which waits for the
+ * timed code to retire), when the CPU has one, and
+ * clock_gettime(CLOCK_MONOTONIC_RAW) otherwise. The TSC rate is taken
+ * from the kernel or the CPU when either publishes it, and measured
+ * against CLOCK_MONOTONIC_RAW only as a last resort.
+ *
+ * A measurement runs f for WARMUP_SECS to warm the caches, then takes
+ * between MIN_SAMPLES and MAX_SAMPLES samples in about TARGET_SECS, each
+ * sample batching enough runs of f to last SAMPLE_SECS. The median
+ * sample is the estimate; the median absolute deviation (MAD) and a
+ * distribution-free confidence interval for the median describe the
+ * noise, and unlike a mean neither is thrown off by the odd sample
+ * hit by an interrupt or a migration.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+#include "rtimer.h"
+
+#define WARMUP_SECS  0.05      /* run f this long before measuring */
+#define SAMPLE_SECS  0.005     /* shortest sample worth timing */
+#define TARGET_SECS  0.5       /* time to spend measuring */
+#define MIN_SAMPLES  11
+#define MAX_SAMPLES  201
+#define CALIB_NSECS  50000000  /* calibrate the TSC over 50 ms */
+#define Z95          1.96      /* normal quantile for a 95% interval */
+
+/* Global variables */
+static int use_tsc = 0;        /* time with the TSC rather than the clock? */
+static double tsc_hz;          /* TSC rate, if use_tsc */
+static double samples[MAX_SAMPLES];
+static double devs[MAX_SAMPLES];
+
+/* function prototypes for internal helper routines */
+static uint64_t raw_ns(void);
+static uint64_t now_ticks(void);
+static double elapsed_secs(uint64_t start);
+static int cmp_double(const void *a, const void *b);
+#if defined(__i386__) || defined(__x86_64__)
+static int tsc_invariant(void);
+static double tsc_hz_published(const char **source);
+static double tsc_hz_calibrated(void);
+#endif
+
+/*
+ * rtimer_init - Choose the clock and learn its rate
+ */
+void rtimer_init(int verbose)
+{
+    const char *source = "measured";
+
+#if defined(__i386__) || defined(__x86_64__)
+    if (tsc_invariant()) {
+	if ((tsc_hz = tsc_hz_published(&source)) == 0)
+	    tsc_hz = tsc_hz_calibrated();
+	use_tsc = 1;
+    }
+#endif
+    if (!verbose)
+	return;
+    if (use_tsc)
+	printf("Measuring performance with the TSC (%.3f MHz, %s).\n",
+	       tsc_hz / 1e6, source);
+    else
+	printf("Measuring performance with clock_gettime().\n");
+}
+
+/*
+ * rtimer - Return the median running time of f(argp) in seconds
+ */
+double rtimer(rtimer_test_funct f, void *argp, rtimer_stats_t *st)
+{
+    uint64_t start;
+    double one, med, secs;
+    long runs, batch, i;
+    int n, j, lo, hi;
+
+    /* Warm up, and get a rough idea of how long one run takes */
+    runs = 0;
+    start = now_ticks();
+    do {
+	f(argp);
+	runs++;
+    } while ((secs = elapsed_secs(start)) < WARMUP_SECS);
+    one = secs / runs;
+
+    /* Batch short runs, and fit the samples into TARGET_SECS */
+    batch = (long)ceil(SAMPLE_SECS / one);
+    n = (int)(TARGET_SECS / (batch * one));
+    if (n < MIN_SAMPLES)
+	n = MIN_SAMPLES;
+    if (n > MAX_SAMPLES)
+	n = MAX_SAMPLES;
+
+    for (j = 0; j < n; j++) {
+	start = now_ticks();
+	for (i = 0; i < batch; i++)
+	    f(argp);
+	samples[j] = elapsed_secs(start) / batch;
+    }
+
+    qsort(samples, n, sizeof(double), cmp_double);
+    med = (n & 1) ? samples[n/2] : (samples[n/2 - 1] + samples[n/2]) / 2;
+    if (st == NULL)
+	return med;
+
+    for (j = 0; j < n; j++)
+	devs[j] = fabs(samples[j] - med);
+    qsort(devs, n, sizeof(double), cmp_double);
+
+    /*
+     * The number of samples below the median is Binomial(n, 1/2), so
+     * order statistics n/2 -+ Z95*sqrt(n)/2 bracket it 95% of the time
+     */
+    lo = (int)floor(n/2.0 - Z95 * sqrt(n) / 2);
+    hi = (int)ceil(n/2.0 + Z95 * sqrt(n) / 2);
+    if (lo < 0)
+	lo = 0;
+    if (hi > n - 1)
+	hi = n - 1;
+
+    st->median = med;
+    st->mad = (n & 1) ? devs[n/2] : (devs[n/2 - 1] + devs[n/2]) / 2;
+    st->ci_lo = samples[lo];
+    st->ci_hi = samples[hi];
+    st->samples = n;
+    st->runs = n * batch;
+    return med;
+}
+
+/**************************
+ * Internal helper routines
+ **************************/
+
+/*
+ * raw_ns - Nanoseconds on the clock that NTP does not slew
+ */
+static uint64_t raw_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * now_ticks - Read the chosen clock
+ */
+static uint64_t now_ticks(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    unsigned int aux;
+
+    if (use_tsc)
+	return __rdtscp(&aux);
+#endif
+    return raw_ns();
+}
+
+/*
+ * elapsed_secs - Seconds since start, a value of now_ticks()
+ */
+static double elapsed_secs(uint64_t start)
+{
+    uint64_t t = now_ticks() - start;
+
+    return use_tsc ? t / tsc_hz : t * 1e-9;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+#if defined(__i386__) || defined(__x86_64__)
+/*
+ * tsc_invariant - Does the CPU have rdtscp and a TSC that ticks at a
+ *     constant rate across frequency changes and sleep states?
+ */
+static int tsc_invariant(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) == 0 ||
+	eax < 0x80000007)
+	return 0;
+    __get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx);
+    if (!(edx & (1 << 27)))   /* rdtscp */
+	return 0;
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return (edx & (1 << 8)) != 0;
+}
+
+/*
+ * tsc_hz_published - The TSC rate as the kernel or the CPU states it,
+ *     or 0 if neither does
+ */
+static double tsc_hz_published(const char **source)
+{
+    FILE *fp;
+    unsigned long khz;
+    unsigned int eax, ebx, ecx, edx;
+
+    /* Exported by kernels that know the rate, in kHz */
+    if ((fp = fopen("/sys/devices/system/cpu/cpu0/tsc_freq_khz", "r"))) {
+	if (fscanf(fp, "%lu", &khz) == 1 && khz > 0) {
+	    fclose(fp);
+	    *source = "from the kernel";
+	    return khz * 1e3;
+	}
+	fclose(fp);
+    }
+
+    /* Leaf 0x15: TSC = crystal clock * ebx / eax, when the crystal is known */
+    if (__get_cpuid_max(0, NULL) >= 0x15) {
+	__cpuid(0x15, eax, ebx, ecx, edx);
+	if (eax != 0 && ebx != 0 && ecx != 0) {
+	    *source = "from cpuid";
+	    return (double)ecx * ebx / eax;
+	}
+    }
+    return 0;
+}
+
+/*
+ * tsc_hz_calibrated - Measure the TSC against CLOCK_MONOTONIC_RAW
+ */
+static double tsc_hz_calibrated(void)
+{
+    uint64_t ns0, ns1, t0, t1;
+    unsigned int aux;
+
+    ns0 = raw_ns();
+    t0 = __rdtscp(&aux);
+    do {
+	ns1 = raw_ns();
+    } while (ns1 - ns0 < CALIB_NSECS);
+    t1 = __rdtscp(&aux);
+    return (double)(t1 - t0) * 1e9 / (double)(ns1 - ns0);
+}
+#endif
@@ -0,0 +1,29 @@
+/*
+ * rtimer.h - A statistically robust function timer
+ *
+ * Instead of averaging a fixed number of runs, rtimer warms f up, picks
+ * the number of runs so that measuring takes a fixed amount of time,
+ * and reports the median run time together with its spread.
+ */
+#ifndef __RTIMER_H_
+#define __RTIMER_H_
+
+typedef void (*rtimer_test_funct)(void *);
+
+typedef struct {
+    double median;   /* median seconds per run */
+    double mad;      /* median absolute deviation from the median */
+    double ci_lo;    /* 95% confidence interval for the median */
+    double ci_hi;
+    int samples;     /* number of timed samples */
+    long runs;       /* total runs of f, warm-up excluded */
+} rtimer_stats_t;
+
+/* Choose the clock and learn its rate. Say which when verbose */
+void rtimer_init(int verbose);
+
+/* Estimate the running time of f(argp) in seconds. Return the median
+   of the samples, and fill in *st if it is not NULL */
+double rtimer(rtimer_test_funct f, void *argp, rtimer_stats_t *st);
+
+#endif /* __RTIMER_H_ */
@@ -0,0 +1,514 @@
+/*
+ * sizetune.c - Derive the size classes of mm.c's segregated lists from
+ *     a set of traces.
+ *
+ * usage: sizetune [-h] [-d dsize] [-m lists] [-u bytes] [-e pct]
+ *                 -o <sizeclass.h> <trace.rep>...
+ *
+ * The traces are replayed on paper: every malloc and realloc is rounded
+ * up to the block size mm.c would give it, and a histogram is kept of
+ * how many blocks of each size are allocated and freed, and of how long
+ * they live, in ops. A realloc counts as a free of the old size and an
+ * allocation of the new one.
+ *
+ * The histogram is then cut into lists so as to minimize the expected
+ * cost of a malloc, under a simple model of mm.c: a free block goes on
+ * the head of the list of its size, so a list holds blocks in the
+ * proportions in which they are freed, in no order; and a list holds
+ * about as many blocks as there are live blocks of its sizes. A malloc
+ * walks its list until the first block that fits: it examines about
+ * (blocks on the list) / (blocks on it that fit) of them, or all of
+ * them if none fits. The block it takes leaves over its size less the
+ * size asked for, which is wasted or split off as a fragment; every -u
+ * bytes of that left over cost as much as one more step down the list.
+ *
+ * Since the cost of a list depends only on the sizes it holds, the best
+ * cut into k lists is found by dynamic programming for every k up to
+ * -m, and the fewest lists whose cost is within -e percent of the best
+ * are written to the header, as the largest block size of each list
+ * but the last. mm.c uses them when compiled with
+ * -DMM_SIZE_CLASSES='"sizeclass.h"'.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <float.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define MAXLINE   1024     /* max string size */
+#define HIST_UNITS 65536   /* sizes counted one by one, in DSIZE units... */
+#define HIST_LOGS 64       /* ...and above that, per power of two */
+#define MAX_GROUPS 256     /* at most this many places to cut lists */
+#define OLD_LISTS 20       /* lists of the power-of-two classes */
+#define MAX_LISTS 128      /* most lists that -m allows */
+
+/* Blocks of one size, or of a range of sizes once merged */
+typedef struct {
+    double bytes;      /* total size of the blocks allocated and freed */
+    size_t limit;      /* largest block size */
+    double allocs;     /* number of blocks allocated... */
+    double frees;      /* ...and freed */
+    double life;       /* total lifetime of the blocks, in ops */
+} point_t;
+
+/* Mean size of the blocks of a point */
+#define MEAN_SIZE(p) ((p)->bytes / ((p)->allocs + (p)->frees))
+
+/* Global variables */
+static size_t dsize = 8;              /* double word of the target (-d) */
+static double waste_unit = 64;        /* left over bytes per step (-u) */
+static point_t hist[HIST_UNITS + HIST_LOGS]; /* the size histogram */
+static point_t *groups;               /* its nonempty points, merged */
+static int ngroups = 0;
+static double total_ops = 0;          /* ops in all the traces */
+static double total_allocs = 0;       /* blocks allocated in all of them */
+
+/* function prototypes for internal helper routines */
+static void read_rep(char *path);
+static size_t block_size(unsigned size);
+static point_t *point(size_t bsize);
+static void make_groups(void);
+static void list_cost(int lo, int hi, double *steps, double *waste);
+static void cut(int maxlists, double tolerance, int *nlists, int *cuts);
+static double cost_of(int nlists, int *cuts, double *steps, double *waste);
+static void write_header(char *path, int argc, char **argv, int first,
+			 int nlists, int *cuts);
+static void usage(void);
+static void app_error(char *msg);
+static void unix_error(char *msg);
+
+int main(int argc, char **argv)
+{
+    char *outfile = NULL;
+    int maxlists = 32;
+    double tolerance = 1;
+    int cuts[MAX_LISTS], oldcuts[OLD_LISTS];
+    int nlists, nold;
+    double steps, waste, cost;
+    size_t limit;
+    int c, g, i;
+
+    while ((c = getopt(argc, argv, "d:m:u:e:o:h")) != EOF) {
+	switch (c) {
+	case 'd': dsize = atoi(optarg); break;
+	case 'm': maxlists = atoi(optarg); break;
+	case 'u': waste_unit = atof(optarg); break;
+	case 'e': tolerance = atof(optarg); break;
+	case 'o': outfile = optarg; break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (outfile == NULL || optind == argc || dsize < 4 ||
+	(dsize & (dsize - 1)) != 0 || maxlists < 2 ||
+	maxlists > MAX_LISTS || waste_unit <= 0 || tolerance < 0) {
+	usage();
+	exit(1);
+    }
+
+    for (i = optind; i < argc; i++)
+	read_rep(argv[i]);
+    if (total_allocs == 0)
+	app_error("The traces allocate nothing");
+    make_groups();
+
+    /* What the power-of-two lists of mm.c would cost, for comparison */
+    for (g = nold = 0; g < ngroups && nold < OLD_LISTS - 1; g++) {
+	limit = groups[g].limit;
+	for (i = 0; i < OLD_LISTS - 1 && limit > 1; i++)
+	    limit >>= 1;
+	while (nold < i)
+	    oldcuts[nold++] = g;
+    }
+    while (nold < OLD_LISTS - 1)
+	oldcuts[nold++] = ngroups;
+    cost = cost_of(OLD_LISTS, oldcuts, &steps, &waste);
+    printf("%d power-of-two lists: %.3f steps + %.1f bytes left over "
+	   "per malloc (cost %.3f)\n", OLD_LISTS, steps, waste, cost);
+
+    cut(maxlists, tolerance, &nlists, cuts);
+    cost = cost_of(nlists, cuts, &steps, &waste);
+    printf("%d tuned lists: %.3f steps + %.1f bytes left over "
+	   "per malloc (cost %.3f)\n", nlists, steps, waste, cost);
+
+    write_header(outfile, argc, argv, optind, nlists, cuts);
+    return 0;
+}
+
+/*
+ * read_rep - Add the blocks of one .rep trace to the histogram
+ */
+static void read_rep(char *path)
+{
+    FILE *fp;
+    char type[MAXLINE];
+    char msg[MAXLINE];
+    int sugg_heapsize, num_ids, num_ops, weight;
+    unsigned index, size;
+    size_t *bsizes;     /* block size of each live id, 0 if none */
+    long *born;         /* op at which it was allocated */
+    long op = 0;
+    int optype, thread;
+    point_t *p;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+	sprintf(msg, "Could not open %s", path);
+	unix_error(msg);
+    }
+    if (fscanf(fp, "%d %d %d %d", &sugg_heapsize, &num_ids, &num_ops,
+	       &weight) != 4 || num_ids < 0) {
+	sprintf(msg, "Malformed trace header in %s", path);
+	app_error(msg);
+    }
+    bsizes = calloc(num_ids, sizeof(size_t));
+    born = calloc(num_ids, sizeof(long));
+    if (bsizes == NULL || born == NULL)
+	unix_error("calloc failed in read_rep");
+
+    while (fscanf(fp, "%s", type) != EOF) {
+	optype = trace_optype(type, &thread);
+	if (optype == 'b' || optype == 'e')
+	    continue;                /* scopes have no block */
+	if ((optype == 'a' || optype == 'r') &&
+	    fscanf(fp, "%u %u", &index, &size) != 2)
+	    optype = '?';
+	else if (optype == 'f' && fscanf(fp, "%u", &index) != 1)
+	    optype = '?';
+	if (optype != 'a' && optype != 'r' && optype != 'f') {
+	    snprintf(msg, sizeof(msg), "Bogus request (%.64s) in tracefile %s",
+		     type, path);
+	    app_error(msg);
+	}
+	if (index >= num_ids) {
+	    sprintf(msg, "Id %u out of range in tracefile %s", index, path);
+	    app_error(msg);
+	}
+
+	/* A realloc or free ends the life of the block there was */
+	if (optype != 'a' && bsizes[index] != 0) {
+	    p = point(bsizes[index]);
+	    p->frees++;
+	    p->bytes += bsizes[index];
+	    p->life += op - born[index];
+	    bsizes[index] = 0;
+	}
+	if (optype != 'f') {
+	    bsizes[index] = block_size(size);
+	    born[index] = op;
+	    p = point(bsizes[index]);
+	    p->allocs++;
+	    p->bytes += bsizes[index];
+	    total_allocs++;
+	}
+	op++;
+    }
+    fclose(fp);
+
+    /* Blocks the trace never frees live until its end */
+    for (index = 0; index < num_ids; index++)
+	if (bsizes[index] != 0)
+	    point(bsizes[index])->life += op - born[index];
+    total_ops += op;
+    free(bsizes);
+    free(born);
+}
+
+/*
+ * block_size - The size of the block mm_malloc gives a request
+ */
+static size_t block_size(unsigned size)
+{
+    if (size <= dsize)
+	return 2 * dsize;
+    return dsize * ((size + dsize + dsize - 1) / dsize);
+}
+
+/*
+ * point - The histogram entry of a block size
+ */
+static point_t *point(size_t bsize)
+{
+    point_t *p;
+    int log;
+
+    if (bsize / dsize < HIST_UNITS)
+	p = &hist[bsize / dsize];
+    else {
+	for (log = 0; (bsize / dsize) >> log >= HIST_UNITS; log++)
+	    ;
+	p = &hist[HIST_UNITS + log];
+    }
+    if (bsize > p->limit)
+	p->limit = bsize;
+    return p;
+}
+
+/*
+ * make_groups - Merge the nonempty points of the histogram, in order of
+ *     size, into at most MAX_GROUPS groups of about equal traffic
+ */
+static void make_groups(void)
+{
+    double traffic = 0, share, sum = 0;
+    point_t *h, *g;
+    int i, n = 0;
+
+    for (i = 0; i < HIST_UNITS + HIST_LOGS; i++) {
+	traffic += hist[i].allocs + hist[i].frees;
+	if (hist[i].allocs + hist[i].frees > 0)
+	    n++;
+    }
+    share = (n > MAX_GROUPS) ? traffic / MAX_GROUPS : 0;
+    if ((groups = calloc(n, sizeof(point_t))) == NULL)
+	unix_error("calloc failed in make_groups");
+
+    for (i = 0; i < HIST_UNITS + HIST_LOGS; i++) {
+	h = &hist[i];
+	if (h->allocs + h->frees == 0)
+	    continue;
+	if (ngroups == 0 || sum >= share) {
+	    ngroups++;
+	    sum = 0;
+	}
+	g = &groups[ngroups - 1];
+	g->bytes += h->bytes;
+	g->limit = h->limit;
+	g->allocs += h->allocs;
+	g->frees += h->frees;
+	g->life += h->life;
+	sum += h->allocs + h->frees;
+    }
+}
+
+/*
+ * list_cost - The steps down the list, and the bytes left over, summed
+ *     over the mallocs of a list that holds groups lo to hi
+ */
+static void list_cost(int lo, int hi, double *steps, double *waste)
+{
+    double frees = 0, live = 0;
+    double fits = 0, fit_bytes = 0;
+    point_t *g;
+    int i;
+
+    for (i = lo; i <= hi; i++) {
+	frees += groups[i].frees;
+	live += groups[i].life;
+    }
+    live /= total_ops;       /* mean number of blocks on the list */
+
+    /* From the largest size down, so that the fits add up */
+    *steps = *waste = 0;
+    for (i = hi; i >= lo; i--) {
+	g = &groups[i];
+	fits += g->frees;
+	fit_bytes += g->frees * MEAN_SIZE(g);
+	if (g->allocs == 0)
+	    continue;
+	if (fits > 0) {
+	    *steps += g->allocs * frees / fits;
+	    *waste += g->allocs * (fit_bytes / fits - MEAN_SIZE(g));
+	}
+	else
+	    *steps += g->allocs * (1 + (frees > 0 ? live : 0));
+    }
+}
+
+/*
+ * cut - Find the fewest lists, up to maxlists, whose cost is within
+ *     tolerance percent of the least, and the groups they start at
+ */
+static void cut(int maxlists, double tolerance, int *nlists, int *cuts)
+{
+    double *cost;    /* cost of a list of groups i to j, at i*n + j */
+    double *best;    /* least cost of groups 0 to j-1 in k lists... */
+    int *from;       /* ...whose last list starts at this group */
+    double steps, waste, c, least;
+    int n = ngroups, k, i, j;
+
+    if (maxlists > n)
+	maxlists = (n < 2) ? 2 : n;
+    cost = malloc(n * n * sizeof(double));
+    best = malloc((maxlists + 1) * (n + 1) * sizeof(double));
+    from = malloc((maxlists + 1) * (n + 1) * sizeof(int));
+    if (cost == NULL || best == NULL || from == NULL)
+	unix_error("malloc failed in cut");
+
+    for (i = 0; i < n; i++)
+	for (j = i; j < n; j++) {
+	    list_cost(i, j, &steps, &waste);
+	    cost[i * n + j] = steps + waste / waste_unit;
+	}
+
+#define BEST(k, j) best[(k) * (n + 1) + (j)]
+#define FROM(k, j) from[(k) * (n + 1) + (j)]
+    for (j = 0; j <= n; j++)
+	BEST(0, j) = (j == 0) ? 0 : DBL_MAX;
+    for (k = 1; k <= maxlists; k++) {
+	for (j = 0; j <= n; j++) {
+	    BEST(k, j) = DBL_MAX;
+	    FROM(k, j) = j;
+	    for (i = 0; i < j; i++) {
+		if (BEST(k - 1, i) == DBL_MAX)
+		    continue;
+		c = BEST(k - 1, i) + cost[i * n + j - 1];
+		if (c < BEST(k, j)) {
+		    BEST(k, j) = c;
+		    FROM(k, j) = i;
+		}
+	    }
+	}
+    }
+
+    /* An empty last list is allowed when there are too few groups */
+    least = DBL_MAX;
+    for (k = 1; k <= maxlists; k++)
+	if (BEST(k, n) < least)
+	    least = BEST(k, n);
+    for (k = 2; k < maxlists && BEST(k, n) > least * (1 + tolerance / 100);
+	 k++)
+	;
+    *nlists = k;
+    if (BEST(k, n) == DBL_MAX) {        /* a single group */
+	cuts[0] = n;
+	*nlists = 2;
+    }
+    else
+	for (j = n; k > 1; k--) {
+	    j = FROM(k, j);
+	    cuts[k - 2] = j;
+	}
+#undef BEST
+#undef FROM
+
+    free(cost);
+    free(best);
+    free(from);
+}
+
+/*
+ * cost_of - The cost per malloc of the lists that start at groups 0,
+ *     cuts[0], ..., cuts[nlists-2], and its steps and left over bytes
+ */
+static double cost_of(int nlists, int *cuts, double *steps, double *waste)
+{
+    double s, w;
+    int k, lo, hi;
+
+    *steps = *waste = 0;
+    for (k = 0; k < nlists; k++) {
+	lo = (k == 0) ? 0 : cuts[k - 1];
+	hi = (k == nlists - 1) ? ngroups : cuts[k];
+	if (lo >= hi)
+	    continue;
+	list_cost(lo, hi - 1, &s, &w);
+	*steps += s;
+	*waste += w;
+    }
+    *steps /= total_allocs;
+    *waste /= total_allocs;
+    return *steps + *waste / waste_unit;
+}
+
+/*
+ * write_header - Write the size classes as a header for mm.c
+ */
+static void write_header(char *path, int argc, char **argv, int first,
+			 int nlists, int *cuts)
+{
+    FILE *fp;
+    double steps, waste, allocs, life;
+    int col, i, k, lo, hi;
+    size_t limit;
+
+    if ((fp = fopen(path, "w")) == NULL)
+	unix_error("Could not create output file");
+
+    fprintf(fp, "/*\n * %s - Size classes for mm.c, made by sizetune from\n"
+	    " *    ", path);
+    for (i = first, col = 7; i < argc; i++) {
+	if (col + strlen(argv[i]) > 72) {
+	    fprintf(fp, "\n *    ");
+	    col = 7;
+	}
+	col += fprintf(fp, " %s", argv[i]);
+    }
+    cost_of(nlists, cuts, &steps, &waste);
+    fprintf(fp, "\n *\n * Compile mm.c with -DMM_SIZE_CLASSES='\"%s\"' "
+	    "to use them. Expected\n * per malloc: %.3f steps down a list, "
+	    "%.1f bytes left over.\n *\n", path, steps, waste);
+    fprintf(fp, " * list  largest block  mallocs  mean lifetime (ops)\n");
+    for (k = 0; k < nlists; k++) {
+	lo = (k == 0) ? 0 : cuts[k - 1];
+	hi = (k == nlists - 1) ? ngroups : cuts[k];
+	for (i = lo, allocs = life = 0; i < hi; i++) {
+	    allocs += groups[i].allocs;
+	    life += groups[i].life;
+	}
+	limit = (k == nlists - 1 || hi == 0) ? 0 : groups[hi - 1].limit;
+	if (k < nlists - 1)
+	    fprintf(fp, " * %4d  %13zu", k, limit);
+	else
+	    fprintf(fp, " * %4d  %13s", k, "any");
+	fprintf(fp, "  %6.2f%%  %19.0f\n", 100 * allocs / total_allocs,
+		allocs > 0 ? life / allocs : 0);
+    }
+    fprintf(fp, " */\n");
+
+    fprintf(fp, "#define SIZE_CLASS_DSIZE %zu /* DSIZE they were made for */\n",
+	    dsize);
+    fprintf(fp, "#define LISTS %d\n", nlists);
+    fprintf(fp, "#define LIST_LIMITS {");
+    for (k = 0; k < nlists - 1; k++) {
+	hi = cuts[k];
+	limit = (hi == 0) ? 0 : groups[hi - 1].limit;
+	fprintf(fp, "%s%s%zu", k ? "," : "", k % 8 ? " " : " \\\n    ", limit);
+    }
+    fprintf(fp, " }\n");
+    if (fclose(fp) != 0)
+	unix_error("fclose failed");
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: sizetune [-h] [-d <dsize>] [-m <lists>] "
+	    "[-u <bytes>] [-e <pct>]\n"
+	    "                -o <file> <trace.rep>...\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-d <dsize> DSIZE of the mm.c to tune (8).\n");
+    fprintf(stderr, "\t-e <pct>   Use the fewest lists within <pct>%% of "
+	    "the best cost (1).\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-m <lists> Most lists to use (32).\n");
+    fprintf(stderr, "\t-o <file>  Write the size classes to header <file>.\n");
+    fprintf(stderr, "\t-u <bytes> Bytes left over that cost one list step "
+	    "(64).\n");
+}
+
+/*
+ * app_error - Report an arbitrary application error
+ */
+static void app_error(char *msg)
+{
+    fprintf(stderr, "%s\n", msg);
+    exit(1);
+}
+
+/*
+ * unix_error - Report a Unix-style error
+ */
+static void unix_error(char *msg)
+{
+    fprintf(stderr, "%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
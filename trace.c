@@ -0,0 +1,45 @@
+/*
+ * trace.c - Helpers for the trace formats described in trace.h
+ */
+#include <ctype.h>
+#include <stdlib.h>
+#include "trace.h"
+
+/*
+ * trace_checksum - FNV-1a over the 32-bit words of the ops array. 
+ *     Hashing whole words rather than bytes keeps verification of
+ *     multi-million op traces cheap.
+ */
+uint32_t trace_checksum(uint32_t sum, const traceop_t *ops, long n)
+{
+    const uint32_t *w = (const uint32_t *)ops;
+    const uint32_t *end = (const uint32_t *)(ops + n);
+
+    while (w < end) {
+	sum ^= *w++;
+	sum *= 16777619u;  /* FNV prime */
+    }
+    return sum;
+}
+
+/*
+ * trace_optype - Return the type character of a request token, and
+ *     store the thread it is prefixed with (0 if none) in *thread. A
+ *     malformed prefix yields type '?' and thread -1.
+ */
+int trace_optype(const char *tok, int *thread)
+{
+    char *end;
+    long t;
+
+    *thread = 0;
+    if (!isdigit((unsigned char)tok[0]))
+	return tok[0];
+    t = strtol(tok, &end, 10);
+    if (*end != ':' || t >= TRACE_MAX_THREADS) {
+	*thread = -1;
+	return '?';
+    }
+    *thread = t;
+    return end[1];
+}
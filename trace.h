@@ -0,0 +1,66 @@
+/*
+ * trace.h - In-memory and binary on-disk representations of the trace
+ *     files that drive the malloc lab.
+ *
+ * A binary trace is a tracehdr_t followed immediately by num_ops
+ * traceop_t records, all in host byte order. The records have the
+ * same layout on disk as in memory, so a binary trace can be mmap'd
+ * and replayed in place without being copied.
+ *
+ * Each op is made by one thread of the traced program, numbered from 0.
+ * In a .rep file a request may be prefixed with its thread, as in
+ * "2:a 17 64"; requests without a prefix are made by thread 0. A block
+ * may be freed or reallocated by a thread other than the one that
+ * allocated it; the ops on any one block take effect in trace order.
+ *
+ * A trace may also mark scopes, such as the handling of one request,
+ * whose blocks all die together: "b" begins a scope of its thread and
+ * "e" ends it, and every block a thread allocates while its scope is
+ * open must be freed before the scope ends. A thread has at most one
+ * scope open at a time. The scope ops have no block; their index and
+ * size are 0.
+ */
+#ifndef __TRACE_H_
+#define __TRACE_H_
+
+#include <stdint.h>
+
+#define TRACE_MAGIC   0x52544d4d /* "MMTR" when read as little-endian bytes */
+#define TRACE_VERSION 2
+#define TRACE_CKSUM_INIT 2166136261u /* FNV-1a offset basis */
+#define TRACE_MAX_THREADS 1024       /* threads numbered below this */
+
+/* Characterizes a single trace operation (allocator request) */
+typedef struct {
+    enum {ALLOC, FREE, REALLOC,       /* type of request */
+	  SCOPE_BEGIN, SCOPE_END} type;
+    int index;                        /* index for free() to use later */
+    int size;                         /* byte size of alloc/realloc request */
+    int thread;                       /* thread that makes the request */
+} traceop_t;
+
+/* Header of a binary trace file */
+typedef struct {
+    uint32_t magic;         /* TRACE_MAGIC */
+    uint32_t version;       /* TRACE_VERSION */
+    int32_t sugg_heapsize;  /* same four fields as a .rep header */
+    int32_t num_ids;
+    int32_t num_ops;
+    int32_t weight;
+    uint32_t oplen;         /* sizeof(traceop_t) of the writer */
+    uint32_t checksum;      /* trace_checksum() of the ops array */
+} tracehdr_t;
+
+/* 
+ * Fold n ops into a running checksum started at TRACE_CKSUM_INIT, so
+ * writers can checksum a trace as they stream it out.
+ */
+uint32_t trace_checksum(uint32_t sum, const traceop_t *ops, long n);
+
+/*
+ * Split a request token of a .rep file, such as "a" or "2:a", into the
+ * type character, which is returned, and the thread in *thread
+ */
+int trace_optype(const char *tok, int *thread);
+
+#endif /* __TRACE_H_ */
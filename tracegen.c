@@ -0,0 +1,581 @@
+/*
+ * tracegen.c - Synthetic workload generator for the malloc lab driver.
+ *
+ * Produces .rep (or binary, see trace.h) traces whose request sizes and
+ * block lifetimes are drawn from configurable distributions, so that an
+ * allocator can be stressed reproducibly at sizes far beyond those of
+ * the hand-written traces.
+ *
+ * usage: tracegen [-b] [-n ops] [-s dist] [-l dist] [-r pct] [-g growth]
+ *                 [-p bytes] [-T threads] [-x pct] [-A allocs] [-S seed]
+ *                 -o <file>
+ *
+ * A distribution is written as one of
+ *     fixed:N             always N
+ *     uniform:LO:HI       uniform integer in [LO, HI]
+ *     exp:MEAN            exponential with the given mean
+ *     lognormal:MU:SIGMA  exp(N(MU, SIGMA^2))
+ *     hist:FILE           empirical histogram, "value weight" per line
+ *
+ * Lifetimes are measured in allocations: a block with lifetime L is
+ * freed once L more blocks have been allocated after it. A realloc
+ * resizes a random live block according to the growth pattern, which
+ * is "mul:F" (multiply the size by F), "add:N" (add N bytes) or "dist"
+ * (draw a fresh size from the size distribution). Whenever an alloc or
+ * a realloc would take the live payload over the peak given with -p,
+ * the blocks closest to their death (other than the one reallocated)
+ * are freed early to make room, and a realloc grows a block to no more
+ * than the peak.
+ *
+ * With -T, each block is allocated by a random one of that many threads,
+ * which also makes its reallocs; -x gives the percentage of blocks that
+ * some other thread frees, as when one thread hands its blocks on to
+ * another.
+ *
+ * With -A, the allocations are grouped into scopes (see trace.h) of
+ * that many allocations each, in each of which every thread that
+ * allocates has a scope of its own; a block dies by the end of the
+ * scope it was allocated in.
+ *
+ * The generator keeps only the live blocks in memory and reuses the
+ * ids of freed blocks, so traces of hundreds of millions of ops take
+ * memory proportional to the peak live block count. Every block still
+ * live at the end is freed, so the traces are balanced.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "trace.h"
+
+#define MAXLINE  1024     /* max string size */
+#define OPBUF    4096     /* binary ops buffered between writes */
+#define HDRWIDTH 11       /* width of each padded .rep header field */
+
+/* A random distribution over positive integers */
+typedef struct {
+    enum {FIXED, UNIFORM, EXPONENTIAL, LOGNORMAL, HISTOGRAM} type;
+    double a, b;          /* parameters of the distribution */
+    int nbins;            /* histogram bins... */
+    long *values;         /* ... their values ... */
+    double *cdf;          /* ... and cumulative probabilities */
+} dist_t;
+
+/* A live block, kept in a min-heap ordered by time of death */
+typedef struct {
+    unsigned long long death; /* allocation clock at which it is freed */
+    int id;                   /* trace id of the block */
+    int size;                 /* current payload size */
+    int thread;               /* thread that allocated it */
+} block_t;
+
+/* Global variables */
+static unsigned long long rng_state;  /* xorshift64* state */
+static FILE *out;                     /* trace being written */
+static int binary = 0;                /* write the binary format (-b) */
+static traceop_t opbuf[OPBUF];        /* pending binary ops */
+static int nbuf = 0;                  /* number of pending binary ops */
+static tracehdr_t hdr;                /* header of the trace being written */
+static int nthreads = 1;              /* threads making the requests (-T) */
+static double remote_pct = 0;         /* blocks freed by another thread (-x) */
+static long long scope_len = 0;       /* allocations per scope (-A), or 0 */
+static long long *scopes;             /* scope each thread has open, or 0 */
+static int nopen = 0;                 /* number of threads with one open */
+
+static block_t *heap;                 /* live blocks */
+static int nlive = 0, heapcap = 0;    /* live block count and capacity */
+static int *freeids;                  /* ids of freed blocks, for reuse */
+static int nfreeids = 0;
+static long long live_bytes = 0;      /* live payload bytes */
+static long long peak_bytes = 0;      /* high water mark of live_bytes */
+
+/* function prototypes */
+static void parse_dist(dist_t *d, char *spec);
+static long draw(dist_t *d);
+static double uniform01(void);
+static void heap_push(block_t b);
+static block_t heap_pop(void);
+static block_t heap_remove(int i);
+static void heap_down(int i);
+static void emit(int type, int id, int size, int thread);
+static void write_header(void);
+static void free_block(void);
+static void usage(void);
+static void app_error(char *msg);
+static void unix_error(char *msg);
+
+int main(int argc, char **argv)
+{
+    long long num_ops = 100000;  /* requested trace length */
+    long long ops = 0;           /* ops written so far */
+    long long max_live = LLONG_MAX;
+    unsigned long long clock = 0;
+    unsigned long long seed = 1;
+    double realloc_pct = 0, growth = 1.5;
+    enum {MUL, ADD, REDRAW} pattern = MUL;
+    char *outfile = NULL;
+    char *size_spec = "uniform:1:4096";
+    char *life_spec = "exp:1000";
+    dist_t sizes, lives;
+    block_t b;
+    long long newsize, scope;
+    int c, i;
+
+    while ((c = getopt(argc, argv, "bn:s:l:r:g:p:T:x:A:S:o:h")) != EOF) {
+	switch (c) {
+	case 'b': binary = 1; break;
+	case 'n': num_ops = atoll(optarg); break;
+	case 's': size_spec = optarg; break;
+	case 'l': life_spec = optarg; break;
+	case 'r': realloc_pct = atof(optarg); break;
+	case 'p': max_live = atoll(optarg); break;
+	case 'T': nthreads = atoi(optarg); break;
+	case 'x': remote_pct = atof(optarg); break;
+	case 'A': scope_len = atoll(optarg); break;
+	case 'S': seed = strtoull(optarg, NULL, 0); break;
+	case 'o': outfile = optarg; break;
+	case 'g':
+	    if (!strncmp(optarg, "mul:", 4)) {
+		pattern = MUL;
+		growth = atof(optarg + 4);
+	    } else if (!strncmp(optarg, "add:", 4)) {
+		pattern = ADD;
+		growth = atof(optarg + 4);
+	    } else if (!strcmp(optarg, "dist")) {
+		pattern = REDRAW;
+	    } else
+		app_error("Bad growth pattern");
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (outfile == NULL || num_ops <= 0 || num_ops > INT_MAX ||
+	nthreads < 1 || nthreads > TRACE_MAX_THREADS || scope_len < 0) {
+	usage();
+	exit(1);
+    }
+    if ((scopes = calloc(nthreads, sizeof(long long))) == NULL)
+	unix_error("calloc failed in main");
+    parse_dist(&sizes, size_spec);
+    parse_dist(&lives, life_spec);
+
+    /* Seed the generator through splitmix64 so that any seed works */
+    rng_state = seed + 0x9e3779b97f4a7c15ULL;
+    rng_state = (rng_state ^ (rng_state >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    rng_state = (rng_state ^ (rng_state >> 27)) * 0x94d049bb133111ebULL;
+    rng_state ^= rng_state >> 31;
+    if (rng_state == 0)
+	rng_state = 1;
+
+    if ((out = fopen(outfile, "w")) == NULL)
+	unix_error("Could not create output file");
+    setvbuf(out, NULL, _IOFBF, 1 << 20);
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.checksum = TRACE_CKSUM_INIT;
+    write_header();
+
+    /*
+     * Every live block still costs one free, and every open scope its
+     * end, so ops + nlive + nopen is the length the trace would have if
+     * it ended now. An alloc adds two to it, or four if it begins a
+     * scope, a realloc one, and a free none.
+     */
+    while (ops + nlive + nopen < num_ops) {
+	/* Retire the blocks whose time has come */
+	while (nlive > 0 && heap[0].death <= clock) {
+	    free_block();
+	    ops++;
+	}
+
+	if (nlive > 0 && (ops + nlive + nopen + 2 > num_ops ||
+			  uniform01() * 100 < realloc_pct)) {
+	    /* Resize a random live block, taking it off the heap so that
+	       making room under the peak does not free it */
+	    b = heap_remove((int)(uniform01() * nlive));
+	    if (pattern == MUL)
+		newsize = (long long)(b.size * growth);
+	    else if (pattern == ADD)
+		newsize = b.size + (long long)growth;
+	    else
+		newsize = draw(&sizes);
+	    newsize = (newsize < 1) ? 1 : (newsize > INT_MAX) ? INT_MAX : newsize;
+	    while (nlive > 0 && live_bytes + (newsize - b.size) > max_live) {
+		free_block();
+		ops++;
+	    }
+	    if (newsize > max_live)
+		newsize = (max_live > 1) ? max_live : 1;
+	    live_bytes += newsize - b.size;
+	    b.size = newsize;
+	    heap_push(b);
+	    emit(REALLOC, b.id, b.size, b.thread);
+	}
+	else {
+	    /* Allocate a new block, making room under the peak if needed */
+	    b.size = draw(&sizes);
+	    while (nlive > 0 && live_bytes + b.size > max_live) {
+		free_block();
+		ops++;
+	    }
+	    if (ops + nlive + nopen + 2 > num_ops)
+		break;
+	    b.death = ++clock + draw(&lives);
+	    b.thread = (int)(uniform01() * nthreads);
+	    if (scope_len > 0) {
+		/* Begin the thread's scope for this allocation if need be;
+		   the blocks of the one it ends are dead by now */
+		scope = (clock - 1) / scope_len + 1;
+		if (scopes[b.thread] != scope) {
+		    if (ops + nlive + nopen + 4 > num_ops)
+			break;
+		    if (scopes[b.thread] != 0) {
+			emit(SCOPE_END, 0, 0, b.thread);
+			ops++;
+			nopen--;
+		    }
+		    emit(SCOPE_BEGIN, 0, 0, b.thread);
+		    ops++;
+		    nopen++;
+		    scopes[b.thread] = scope;
+		}
+		if (b.death > scope * scope_len)
+		    b.death = scope * scope_len;
+	    }
+	    b.id = (nfreeids > 0) ? freeids[--nfreeids] : hdr.num_ids++;
+	    live_bytes += b.size;
+	    heap_push(b);
+	    emit(ALLOC, b.id, b.size, b.thread);
+	}
+	ops++;
+	peak_bytes = (live_bytes > peak_bytes) ? live_bytes : peak_bytes;
+    }
+
+    /* Free everything that is still live, in order of death */
+    while (nlive > 0) {
+	free_block();
+	ops++;
+    }
+    for (i = 0; i < nthreads; i++)
+	if (scopes[i] != 0) {
+	    emit(SCOPE_END, 0, 0, i);
+	    ops++;
+	}
+
+    /* Go back and fill in the real header */
+    hdr.num_ops = ops;
+    hdr.sugg_heapsize = (peak_bytes > INT_MAX) ? INT_MAX : peak_bytes;
+    hdr.weight = 1;
+    write_header();
+    if (fclose(out) != 0)
+	unix_error("fclose failed");
+
+    fprintf(stderr, "%s: %lld ops, %d ids, peak live payload %lld bytes\n",
+	    outfile, ops, hdr.num_ids, peak_bytes);
+    return 0;
+}
+
+/*
+ * parse_dist - Fill in d from a distribution spec like "uniform:1:100"
+ */
+static void parse_dist(dist_t *d, char *spec)
+{
+    char msg[MAXLINE];
+    FILE *fp;
+    long value;
+    double weight, total = 0;
+    int cap = 0;
+
+    memset(d, 0, sizeof(dist_t));
+    if (sscanf(spec, "fixed:%lf", &d->a) == 1)
+	d->type = FIXED;
+    else if (sscanf(spec, "uniform:%lf:%lf", &d->a, &d->b) == 2)
+	d->type = UNIFORM;
+    else if (sscanf(spec, "exp:%lf", &d->a) == 1)
+	d->type = EXPONENTIAL;
+    else if (sscanf(spec, "lognormal:%lf:%lf", &d->a, &d->b) == 2)
+	d->type = LOGNORMAL;
+    else if (!strncmp(spec, "hist:", 5)) {
+	d->type = HISTOGRAM;
+	if ((fp = fopen(spec + 5, "r")) == NULL) {
+	    sprintf(msg, "Could not open histogram %s", spec + 5);
+	    unix_error(msg);
+	}
+	while (fscanf(fp, "%ld %lf", &value, &weight) == 2) {
+	    if (d->nbins == cap) {
+		cap = cap ? 2 * cap : 64;
+		d->values = realloc(d->values, cap * sizeof(long));
+		d->cdf = realloc(d->cdf, cap * sizeof(double));
+		if (d->values == NULL || d->cdf == NULL)
+		    unix_error("realloc failed in parse_dist");
+	    }
+	    total += weight;
+	    d->values[d->nbins] = value;
+	    d->cdf[d->nbins++] = total;
+	}
+	fclose(fp);
+	if (d->nbins == 0 || total <= 0) {
+	    sprintf(msg, "Empty histogram %s", spec + 5);
+	    app_error(msg);
+	}
+	for (cap = 0; cap < d->nbins; cap++)
+	    d->cdf[cap] /= total;
+    }
+    else {
+	sprintf(msg, "Bad distribution %s", spec);
+	app_error(msg);
+    }
+}
+
+/*
+ * draw - Draw a positive integer from distribution d
+ */
+static long draw(dist_t *d)
+{
+    double x = 0, u;
+    int lo, hi, mid;
+
+    switch (d->type) {
+    case FIXED:
+	x = d->a;
+	break;
+    case UNIFORM:
+	x = floor(d->a + uniform01() * (d->b - d->a + 1));
+	break;
+    case EXPONENTIAL:
+	x = -d->a * log(1.0 - uniform01());
+	break;
+    case LOGNORMAL:
+	/* Box-Muller transform for the underlying normal */
+	u = 1.0 - uniform01();
+	x = exp(d->a + d->b * sqrt(-2.0 * log(u)) *
+		cos(2.0 * M_PI * uniform01()));
+	break;
+    case HISTOGRAM:
+	u = uniform01();
+	for (lo = 0, hi = d->nbins - 1; lo < hi; ) {
+	    mid = (lo + hi) / 2;
+	    if (d->cdf[mid] <= u)
+		lo = mid + 1;
+	    else
+		hi = mid;
+	}
+	x = d->values[lo];
+	break;
+    }
+    return (x < 1) ? 1 : (x > INT_MAX) ? INT_MAX : (long)x;
+}
+
+/*
+ * uniform01 - xorshift64* scaled to a double in [0, 1)
+ */
+static double uniform01(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return ((rng_state * 0x2545f4914f6cdd1dULL) >> 11) * (1.0 / (1ULL << 53));
+}
+
+/*
+ * heap_push - Add a live block to the heap
+ */
+static void heap_push(block_t b)
+{
+    int i, parent;
+
+    if (nlive == heapcap) {
+	heapcap = heapcap ? 2 * heapcap : 1024;
+	if ((heap = realloc(heap, heapcap * sizeof(block_t))) == NULL ||
+	    (freeids = realloc(freeids, heapcap * sizeof(int))) == NULL)
+	    unix_error("realloc failed in heap_push");
+    }
+    for (i = nlive++; i > 0; i = parent) {
+	parent = (i - 1) / 2;
+	if (heap[parent].death <= b.death)
+	    break;
+	heap[i] = heap[parent];
+    }
+    heap[i] = b;
+}
+
+/*
+ * heap_pop - Remove and return the live block that dies first
+ */
+static block_t heap_pop(void)
+{
+    block_t b = heap[0];
+
+    heap[0] = heap[--nlive];
+    heap_down(0);
+    return b;
+}
+
+/*
+ * heap_remove - Remove and return the live block heap[i]
+ */
+static block_t heap_remove(int i)
+{
+    block_t b = heap[i];
+    int parent;
+
+    /* Move it up to the root, as if it died first, and pop it */
+    for (; i > 0; i = parent) {
+	parent = (i - 1) / 2;
+	heap[i] = heap[parent];
+    }
+    heap[0] = b;
+    return heap_pop();
+}
+
+/*
+ * heap_down - Sift heap[i] down to its place
+ */
+static void heap_down(int i)
+{
+    block_t b = heap[i];
+    int child;
+
+    while ((child = 2 * i + 1) < nlive) {
+	if (child + 1 < nlive && heap[child + 1].death < heap[child].death)
+	    child++;
+	if (b.death <= heap[child].death)
+	    break;
+	heap[i] = heap[child];
+	i = child;
+    }
+    heap[i] = b;
+}
+
+/*
+ * free_block - Free the live block that dies first and recycle its id
+ */
+static void free_block(void)
+{
+    block_t b = heap_pop();
+    int thread = b.thread;
+
+    /* Maybe have another thread free it */
+    if (nthreads > 1 && uniform01() * 100 < remote_pct)
+	thread = (b.thread + 1 + (int)(uniform01() * (nthreads - 1))) % 
+	    nthreads;
+
+    live_bytes -= b.size;
+    freeids[nfreeids++] = b.id;
+    emit(FREE, b.id, 0, thread);
+}
+
+/*
+ * emit - Append one op to the trace
+ */
+static void emit(int type, int id, int size, int thread)
+{
+    if (!binary) {
+	if (nthreads > 1)
+	    fprintf(out, "%d:", thread);
+	if (type == FREE)
+	    fprintf(out, "f %d\n", id);
+	else if (type == SCOPE_BEGIN || type == SCOPE_END)
+	    fprintf(out, "%c\n", (type == SCOPE_BEGIN) ? 'b' : 'e');
+	else
+	    fprintf(out, "%c %d %d\n", (type == ALLOC) ? 'a' : 'r', id, size);
+	return;
+    }
+
+    opbuf[nbuf].type = type;
+    opbuf[nbuf].index = id;
+    opbuf[nbuf].size = size;
+    opbuf[nbuf].thread = thread;
+    if (++nbuf == OPBUF) {
+	hdr.checksum = trace_checksum(hdr.checksum, opbuf, nbuf);
+	if (fwrite(opbuf, sizeof(traceop_t), nbuf, out) != nbuf)
+	    unix_error("fwrite failed");
+	nbuf = 0;
+    }
+}
+
+/*
+ * write_header - Write the header at the start of the trace. It is
+ *     written once as a placeholder and again once the counts are
+ *     known; .rep fields are padded so the rewrite fits exactly.
+ */
+static void write_header(void)
+{
+    if (binary && nbuf > 0) {
+	hdr.checksum = trace_checksum(hdr.checksum, opbuf, nbuf);
+	if (fwrite(opbuf, sizeof(traceop_t), nbuf, out) != nbuf)
+	    unix_error("fwrite failed");
+	nbuf = 0;
+    }
+    if (fseek(out, 0, SEEK_SET) != 0)
+	unix_error("fseek failed");
+
+    if (binary) {
+	hdr.magic = TRACE_MAGIC;
+	hdr.version = TRACE_VERSION;
+	hdr.oplen = sizeof(traceop_t);
+	if (fwrite(&hdr, sizeof(hdr), 1, out) != 1)
+	    unix_error("fwrite failed");
+    }
+    else
+	fprintf(out, "%-*d\n%-*d\n%-*d\n%-*d\n", HDRWIDTH, hdr.sugg_heapsize,
+		HDRWIDTH, hdr.num_ids, HDRWIDTH, hdr.num_ops,
+		HDRWIDTH, hdr.weight);
+    if (fseek(out, 0, SEEK_END) != 0)
+	unix_error("fseek failed");
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: tracegen [-hb] [-n <ops>] [-s <dist>] [-l <dist>] "
+	    "[-r <pct>] [-g <growth>] [-p <bytes>]\n"
+	    "                [-T <threads>] [-x <pct>] [-A <allocs>] [-S <seed>] "
+	    "-o <file>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-A <allocs> Group the allocations into scopes of "
+	    "<allocs> each.\n");
+    fprintf(stderr, "\t-b         Write the binary trace format.\n");
+    fprintf(stderr, "\t-g <growth> Realloc growth: mul:F, add:N or dist (mul:1.5).\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-l <dist>  Lifetime distribution, in allocations (exp:1000).\n");
+    fprintf(stderr, "\t-n <ops>   Number of ops in the trace (100000).\n");
+    fprintf(stderr, "\t-o <file>  Write the trace to <file>.\n");
+    fprintf(stderr, "\t-p <bytes> Target peak live payload bytes.\n");
+    fprintf(stderr, "\t-r <pct>   Percentage of ops that are reallocs (0).\n");
+    fprintf(stderr, "\t-s <dist>  Size distribution (uniform:1:4096).\n");
+    fprintf(stderr, "\t-S <seed>  Random seed (1).\n");
+    fprintf(stderr, "\t-T <threads> Number of threads making requests (1).\n");
+    fprintf(stderr, "\t-x <pct>   Percentage of blocks freed by another "
+	    "thread (0).\n");
+    fprintf(stderr, "Distributions: fixed:N uniform:LO:HI exp:MEAN "
+	    "lognormal:MU:SIGMA hist:FILE\n");
+}
+
+/*
+ * app_error - Report an arbitrary application error
+ */
+static void app_error(char *msg)
+{
+    fprintf(stderr, "%s\n", msg);
+    exit(1);
+}
+
+/*
+ * unix_error - Report a Unix-style error
+ */
+static void unix_error(char *msg)
+{
+    fprintf(stderr, "%s: %s\n", msg, strerror(errno));
+    exit(1);
+}